@@ -0,0 +1,341 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the host side of the bulk channel. See the header file
+// for interface documentation to this code.
+//
+// The device's serial port is found through sysfs, so outside of Linux it has
+// to be given with STENOSAURUS_TTY.
+
+#include "bulk.h"
+
+extern "C" {
+#include "../firmware/crc32.h"
+}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+enum {
+    BULK_READ = 1,
+    BULK_WRITE = 2,
+    BULK_DATA = 3,
+    BULK_END = 4,
+};
+
+static const uint8_t RESPONSE_OK = 1;
+
+static const uint32_t BULK_DATA_SIZE = 256;
+// The longest payload. Buffers also need room for its CRC.
+static const uint32_t MAX_FRAME = 6 + BULK_DATA_SIZE;
+
+static uint32_t get_word(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put_word(uint8_t *b, uint32_t word) {
+    b[0] = word & 0xFF;
+    b[1] = (word >> 8) & 0xFF;
+    b[2] = (word >> 16) & 0xFF;
+    b[3] = (word >> 24) & 0xFF;
+}
+
+#ifdef _WIN32
+
+bool bulk_open(int vendor_id, bulk_channel *channel) {
+    (void)vendor_id;
+    (void)channel;
+    return false;
+}
+
+void bulk_close(bulk_channel *channel) {
+    (void)channel;
+}
+
+bool bulk_read_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                      uint8_t *data, uint32_t max_length, uint32_t *length,
+                      uint32_t *device_ms) {
+    (void)channel; (void)stream; (void)offset; (void)data;
+    (void)max_length; (void)length; (void)device_ms;
+    return false;
+}
+
+bool bulk_write_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                       const uint8_t *data, uint32_t length,
+                       uint32_t *device_ms) {
+    (void)channel; (void)stream; (void)offset; (void)data; (void)length;
+    (void)device_ms;
+    return false;
+}
+
+#else
+
+// Reads a hex number from a sysfs file.
+static bool read_sysfs_hex(const char *path, int *value) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    bool result = fscanf(fp, "%x", value) == 1;
+    fclose(fp);
+    return result;
+}
+
+// Puts the path of the first ACM serial port belonging to a USB device with
+// vendor_id in path.
+static bool find_tty(int vendor_id, char *path, size_t size) {
+    DIR *dir = opendir("/sys/class/tty");
+    if (dir == NULL) return false;
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "ttyACM", 6) != 0) continue;
+        // device is the USB interface and its parent is the USB device.
+        char vendor_path[512];
+        snprintf(vendor_path, sizeof(vendor_path),
+                 "/sys/class/tty/%s/device/../idVendor", entry->d_name);
+        int vendor;
+        if (read_sysfs_hex(vendor_path, &vendor) && vendor == vendor_id) {
+            snprintf(path, size, "/dev/%s", entry->d_name);
+            found = true;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+bool bulk_open(int vendor_id, bulk_channel *channel) {
+    char path[256];
+    const char *tty = getenv("STENOSAURUS_TTY");
+    if (tty == NULL) {
+        if (!find_tty(vendor_id, path, sizeof(path))) return false;
+        tty = path;
+    }
+    channel->fd = open(tty, O_RDWR | O_NOCTTY);
+    if (channel->fd < 0) return false;
+    channel->next_tag = 1;
+    struct termios options;
+    tcgetattr(channel->fd, &options);
+    cfmakeraw(&options);
+    // Reads give up after two seconds of silence.
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 20;
+    tcsetattr(channel->fd, TCSANOW, &options);
+    // Throw away any strokes that were waiting.
+    tcflush(channel->fd, TCIOFLUSH);
+    return true;
+}
+
+void bulk_close(bulk_channel *channel) {
+    if (channel->fd >= 0) close(channel->fd);
+    channel->fd = -1;
+}
+
+// Adds the CRC to payload, which must have room for it, and sends it as one
+// frame.
+static bool send_frame(bulk_channel *channel, uint8_t *payload,
+                       uint32_t length) {
+    put_word(payload + length, crc32_update(0xFFFFFFFF, payload, length));
+    length += 4;
+    uint8_t frame[MAX_FRAME + 4 + (MAX_FRAME + 4) / 254 + 3];
+    frame[0] = 0;
+    uint32_t code_at = 1;
+    uint32_t out = 2;
+    uint8_t code = 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (payload[i] != 0) {
+            frame[out++] = payload[i];
+            ++code;
+        }
+        if (payload[i] == 0 || code == 0xFF) {
+            frame[code_at] = code;
+            code_at = out++;
+            code = 1;
+        }
+    }
+    frame[code_at] = code;
+    frame[out++] = 0;
+    return write(channel->fd, frame, out) == (ssize_t)out;
+}
+
+// Adds a decoded byte to a frame being received.
+static void append_byte(uint8_t *payload, uint32_t *length, bool *overflow,
+                        uint8_t b) {
+    if (*length < MAX_FRAME + 4) {
+        payload[(*length)++] = b;
+    } else {
+        *overflow = true;
+    }
+}
+
+// Receives the next good frame into payload, which must hold MAX_FRAME + 4
+// bytes, and returns its length without the CRC, or zero if nothing arrives in
+// time. Anything that isn't a whole frame with a good CRC, such as TX Bolt
+// output, is skipped.
+static uint32_t receive_frame(bulk_channel *channel, uint8_t *payload) {
+    uint32_t length = 0;
+    bool overflow = false;
+    uint8_t code = 0;
+    uint8_t left = 0;
+    uint8_t b;
+    while (read(channel->fd, &b, 1) == 1) {
+        if (b == 0) {
+            if (!overflow && length >= 6 &&
+                    crc32_update(0xFFFFFFFF, payload, length - 4) ==
+                    get_word(payload + length - 4)) {
+                return length - 4;
+            }
+            length = 0;
+            overflow = false;
+            code = 0;
+            left = 0;
+        } else if (left == 0) {
+            // A code byte. The block before it stood for its bytes and a
+            // zero, unless it was a full block.
+            if (code != 0 && code != 0xFF) {
+                append_byte(payload, &length, &overflow, 0);
+            }
+            code = b;
+            left = b - 1;
+        } else {
+            append_byte(payload, &length, &overflow, b);
+            --left;
+        }
+    }
+    return 0;
+}
+
+// Receives frames until one of the given type and tag arrives. Returns its
+// length without the CRC, or zero if none arrives in time.
+static uint32_t receive_response(bulk_channel *channel, uint8_t *payload,
+                                 uint8_t type, uint8_t tag) {
+    uint32_t length;
+    while ((length = receive_frame(channel, payload)) != 0) {
+        if (length >= 3 && payload[0] == type && payload[1] == tag) {
+            return length;
+        }
+    }
+    printf("No response from the device over the bulk channel.\n");
+    return 0;
+}
+
+// Checks the BULK_END frame that finishes a transfer.
+static bool check_end(const uint8_t *payload, uint32_t length, uint32_t crc,
+                      uint32_t expected_length, uint32_t *device_ms) {
+    if (length < 15 || payload[2] != RESPONSE_OK) {
+        printf("The device reported an error.\n");
+        return false;
+    }
+    if (get_word(payload + 3) != crc ||
+            get_word(payload + 7) != expected_length) {
+        printf("CRC mismatch. Actual: %u, Received: %u\n", crc,
+               get_word(payload + 3));
+        return false;
+    }
+    if (device_ms) *device_ms = get_word(payload + 11);
+    return true;
+}
+
+bool bulk_read_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                      uint8_t *data, uint32_t max_length, uint32_t *length,
+                      uint32_t *device_ms) {
+    uint8_t tag = channel->next_tag++;
+    uint8_t payload[MAX_FRAME + 4];
+    payload[0] = BULK_READ;
+    payload[1] = tag;
+    payload[2] = stream;
+    put_word(payload + 3, offset);
+    put_word(payload + 7, max_length);
+    if (!send_frame(channel, payload, 11)) return false;
+
+    uint32_t size = receive_response(channel, payload, BULK_READ, tag);
+    if (size == 0) return false;
+    if (size < 7 || payload[2] != RESPONSE_OK) {
+        printf("The device can't read that stream.\n");
+        return false;
+    }
+    uint32_t total = get_word(payload + 3);
+    if (total > max_length) total = max_length;
+
+    uint32_t received = 0;
+    uint32_t crc = 0xFFFFFFFF;
+    while ((size = receive_frame(channel, payload)) != 0) {
+        if (size < 2 || payload[1] != tag) continue;
+        if (payload[0] == BULK_END) {
+            *length = received;
+            return check_end(payload, size, crc, received, device_ms) &&
+                   received == total;
+        }
+        if (payload[0] != BULK_DATA || size < 6) continue;
+        uint32_t count = size - 6;
+        if (get_word(payload + 2) != received || count > total - received) {
+            printf("Data out of order at %u.\n", received);
+            return false;
+        }
+        memcpy(data + received, payload + 6, count);
+        crc = crc32_update(crc, payload + 6, count);
+        received += count;
+    }
+    printf("The device stopped sending after %u of %u bytes.\n", received,
+           total);
+    return false;
+}
+
+bool bulk_write_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                       const uint8_t *data, uint32_t length,
+                       uint32_t *device_ms) {
+    uint8_t tag = channel->next_tag++;
+    uint32_t crc = crc32_update(0xFFFFFFFF, data, length);
+    uint8_t payload[MAX_FRAME + 4];
+    payload[0] = BULK_WRITE;
+    payload[1] = tag;
+    payload[2] = stream;
+    put_word(payload + 3, offset);
+    put_word(payload + 7, length);
+    put_word(payload + 11, crc);
+    if (!send_frame(channel, payload, 15)) return false;
+    uint32_t size = receive_response(channel, payload, BULK_WRITE, tag);
+    if (size == 0) return false;
+    if (payload[2] != RESPONSE_OK) {
+        printf("The device can't write that stream.\n");
+        return false;
+    }
+
+    // The device's OUT endpoint paces these.
+    for (uint32_t sent = 0; sent < length; ) {
+        uint32_t count = length - sent;
+        if (count > BULK_DATA_SIZE) count = BULK_DATA_SIZE;
+        payload[0] = BULK_DATA;
+        payload[1] = tag;
+        put_word(payload + 2, sent);
+        memcpy(payload + 6, data + sent, count);
+        if (!send_frame(channel, payload, 6 + count)) return false;
+        sent += count;
+    }
+    payload[0] = BULK_END;
+    payload[1] = tag;
+    if (!send_frame(channel, payload, 2)) return false;
+    size = receive_response(channel, payload, BULK_END, tag);
+    return size != 0 && check_end(payload, size, crc, length, device_ms);
+}
+
+#endif
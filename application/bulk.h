@@ -0,0 +1,54 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the host side of the bulk channel, which moves streams
+// over the device's serial port much faster than raw HID can. See the
+// firmware's bulk.c for the protocol.
+//
+// See the .cpp file for implementation details.
+
+#ifndef STENOSAURUS_APPLICATION_BULK_H
+#define STENOSAURUS_APPLICATION_BULK_H
+
+#include <stdint.h>
+
+struct bulk_channel {
+    int fd;
+    uint8_t next_tag;
+};
+
+// Finds the serial port of the device with the given USB vendor id and opens
+// it. The STENOSAURUS_TTY environment variable overrides the search. Returns
+// false if there isn't one, in which case callers should use raw HID.
+bool bulk_open(int vendor_id, bulk_channel *channel);
+
+void bulk_close(bulk_channel *channel);
+
+// Reads up to max_length bytes from stream starting at offset into data. The
+// number of bytes read is put in length and, if device_ms isn't NULL, the time
+// the device spent sending them in device_ms.
+bool bulk_read_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                      uint8_t *data, uint32_t max_length, uint32_t *length,
+                      uint32_t *device_ms);
+
+// Writes length bytes from data to stream starting at offset. If device_ms
+// isn't NULL the time the device spent receiving them is put in it.
+bool bulk_write_stream(bulk_channel *channel, uint8_t stream, uint32_t offset,
+                       const uint8_t *data, uint32_t length,
+                       uint32_t *device_ms);
+
+#endif // STENOSAURUS_APPLICATION_BULK_H
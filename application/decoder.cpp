@@ -0,0 +1,192 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the serial steno protocol decoder. See the header file
+// for interface documentation to this code.
+//
+// Both serial protocols mark each byte with what it is, so the decoder never
+// needs to look back: in TX Bolt the top two bits give the set, and a set that
+// isn't after the last one starts a new stroke, and in Gemini PR the top bit is
+// only set in the first byte of a packet. After noise or lost bytes the decoder
+// picks up again at the next byte that starts a stroke. Each byte's keys are
+// found with one table lookup, from tables built from the layout in the
+// firmware's stroke.h. Plover HID reports are decoded a byte at a time the same
+// way.
+
+#include "decoder.h"
+
+#include "../firmware/stroke.h"
+
+// The stroke bits for the keys in the low bits of each byte of a packet.
+static uint32_t txbolt_keys[4][64];
+static uint32_t gemini_keys[6][128];
+static uint32_t plover_hid_keys[8][256];
+static bool tables_built = false;
+
+static void build_tables(void) {
+    for (int value = 0; value < 128; ++value) {
+#define KEY_BITS(name, label, bit, txbolt_byte, txbolt_bit, gemini_byte, \
+                 gemini_bit, ...) \
+        if ((txbolt_byte) < 4 && value < 64 && ((value >> (txbolt_bit)) & 1)) \
+            txbolt_keys[txbolt_byte][value] |= 1 << (bit); \
+        if ((value >> (gemini_bit)) & 1) \
+            gemini_keys[gemini_byte][value] |= 1 << (bit);
+        STENO_LAYOUT(KEY_BITS)
+#undef KEY_BITS
+    }
+    // Plover HID key n is bit 7 - n % 8 of byte n / 8.
+    for (int value = 0; value < 256; ++value) {
+#define PLOVER_HID_BITS(name, label, bit, txbolt_byte, txbolt_bit, \
+                        gemini_byte, gemini_bit, plover_key, ...) \
+        if ((value >> (7 - (plover_key) % 8)) & 1) \
+            plover_hid_keys[(plover_key) / 8][value] |= 1 << (bit);
+        STENO_LAYOUT(PLOVER_HID_BITS)
+#undef PLOVER_HID_BITS
+    }
+    tables_built = true;
+}
+
+void decoder_init(steno_decoder *decoder, int protocol) {
+    if (!tables_built) build_tables();
+    decoder->protocol = protocol;
+    decoder->stroke = 0;
+    decoder->position = 0;
+    decoder->errors = 0;
+}
+
+bool decoder_pending(const steno_decoder *decoder) {
+    return decoder->position != 0;
+}
+
+// TX Bolt strokes end at a zero byte, at a byte from a set that isn't after
+// the last one, or at the last set since nothing can come after it. The
+// device always sends the zero byte but others might not.
+static uint32_t decode_txbolt(steno_decoder *d, const uint8_t *data,
+                              uint32_t length, uint32_t *strokes,
+                              uint32_t max_strokes, uint32_t *used) {
+    uint32_t stroke = d->stroke;
+    int position = d->position;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i < length && count < max_strokes; ++i) {
+        uint8_t byte = data[i];
+        int set = byte >> 6;
+        if (byte == 0) {
+            if (position != 0) strokes[count++] = stroke;
+            position = 0;
+            stroke = 0;
+            continue;
+        }
+        if (set == 3 && (byte & 0x20)) {
+            // The last set only has five keys, so this is noise and the stroke
+            // it landed in can't be trusted either.
+            ++d->errors;
+            position = 0;
+            stroke = 0;
+            continue;
+        }
+        if (set < position) {
+            strokes[count++] = stroke;
+            stroke = 0;
+            // There may not be room for the stroke this byte ends.
+            if (count == max_strokes) {
+                position = 0;
+                break;
+            }
+        }
+        stroke |= txbolt_keys[set][byte & 0x3F];
+        position = set + 1;
+        if (set == 3) {
+            strokes[count++] = stroke;
+            position = 0;
+            stroke = 0;
+        }
+    }
+    d->stroke = stroke;
+    d->position = position;
+    *used = i;
+    return count;
+}
+
+static uint32_t decode_gemini_pr(steno_decoder *d, const uint8_t *data,
+                                 uint32_t length, uint32_t *strokes,
+                                 uint32_t max_strokes, uint32_t *used) {
+    uint32_t stroke = d->stroke;
+    int position = d->position;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i < length && count < max_strokes; ++i) {
+        uint8_t byte = data[i];
+        if (byte & 0x80) {
+            // A packet that was cut short is lost.
+            if (position != 0) d->errors += position;
+            stroke = gemini_keys[0][byte & 0x7F];
+            position = 1;
+        } else if (position == 0) {
+            ++d->errors;
+        } else {
+            stroke |= gemini_keys[position][byte];
+            if (++position == 6) {
+                strokes[count++] = stroke;
+                position = 0;
+            }
+        }
+    }
+    d->stroke = stroke;
+    d->position = position;
+    *used = i;
+    return count;
+}
+
+// The report ID that the device gives Plover HID reports, 'P'.
+static const uint8_t PLOVER_HID_REPORT_ID = 0x50;
+
+bool decoder_plover_hid(steno_decoder *decoder, const uint8_t *report,
+                        uint32_t length, uint32_t *stroke) {
+    if (length < 9 || report[0] != PLOVER_HID_REPORT_ID) {
+        decoder->errors += length;
+        return false;
+    }
+    uint32_t keys = 0;
+    bool down = false;
+    for (int i = 0; i < 8; ++i) {
+        keys |= plover_hid_keys[i][report[1 + i]];
+        down |= report[1 + i] != 0;
+    }
+    if (down) {
+        decoder->stroke |= keys;
+        decoder->position = 1;
+        return false;
+    }
+    if (decoder->position == 0) return false;
+    *stroke = decoder->stroke;
+    decoder->stroke = 0;
+    decoder->position = 0;
+    return true;
+}
+
+uint32_t decoder_decode(steno_decoder *decoder, const uint8_t *data,
+                        uint32_t length, uint32_t *strokes,
+                        uint32_t max_strokes, uint32_t *used) {
+    if (decoder->protocol == DECODER_GEMINI_PR) {
+        return decode_gemini_pr(decoder, data, length, strokes, max_strokes,
+                                used);
+    } else {
+        return decode_txbolt(decoder, data, length, strokes, max_strokes,
+                             used);
+    }
+}
@@ -0,0 +1,72 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines a decoder for the serial steno protocols that the device
+// sends strokes in, TX Bolt and Gemini PR, and for the reports of its Plover
+// HID interface. See the firmware's encoder.c and usb.c for the formats.
+//
+// See the .cpp file for implementation details.
+
+#ifndef STENOSAURUS_APPLICATION_DECODER_H
+#define STENOSAURUS_APPLICATION_DECODER_H
+
+#include <stdint.h>
+
+// The protocols, numbered as in the firmware's encoder.h.
+enum {
+    DECODER_TXBOLT = 0,
+    DECODER_GEMINI_PR = 1,
+    // Not a serial protocol; see decoder_plover_hid().
+    DECODER_PLOVER_HID = 2,
+};
+
+struct steno_decoder {
+    int protocol;
+    // The keys of the stroke that is coming in, as in the firmware's stroke.h.
+    uint32_t stroke;
+    // For TX Bolt, one more than the set of the last byte of the stroke, or
+    // zero between strokes. For Gemini PR, the number of bytes of the packet
+    // so far. For Plover HID, one while keys are down.
+    int position;
+    // Bytes that didn't fit the protocol and were thrown away, along with any
+    // stroke they were part of.
+    uint32_t errors;
+};
+
+void decoder_init(steno_decoder *decoder, int protocol);
+
+// Decodes length bytes of data, which can be cut anywhere, even in the middle
+// of a stroke. The data is read where it is and only the stroke in progress
+// is kept between calls. Whole strokes are put in strokes and their number is
+// returned. At most max_strokes are decoded; the number of bytes used up,
+// which is less than length only if strokes filled up, is put in used.
+uint32_t decoder_decode(steno_decoder *decoder, const uint8_t *data,
+                        uint32_t length, uint32_t *strokes,
+                        uint32_t max_strokes, uint32_t *used);
+
+// Decodes one report read from the Plover HID interface, which needs a decoder
+// initialised with DECODER_PLOVER_HID. The keys in the reports are gathered
+// and, as Plover does, the stroke is taken when a report has no keys, in which
+// case it is put in stroke and true is returned.
+bool decoder_plover_hid(steno_decoder *decoder, const uint8_t *report,
+                        uint32_t length, uint32_t *stroke);
+
+// Returns true if there is a partial stroke that could still be finished by
+// more data.
+bool decoder_pending(const steno_decoder *decoder);
+
+#endif // STENOSAURUS_APPLICATION_DECODER_H
@@ -0,0 +1,201 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This program measures how fast decoder.cpp decodes TX Bolt and Gemini PR.
+// The strokes are encoded with the firmware's encoder.c, then decoded both in
+// small pieces, the way they come from a tty, and in large ones, the way a
+// captured session is replayed. Every decoded stroke is checked. It also checks
+// that the decoder picks up again after bytes are lost or garbage is mixed in.
+//
+// Usage: decoder-benchmark [strokes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decoder.h"
+
+extern "C" {
+#include "../firmware/encoder.h"
+#include "../firmware/stroke.h"
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Strokes look like steno: usually a few keys, from anywhere on the keyboard.
+static void make_strokes(uint32_t *strokes, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = 0;
+        int keys = 1 + rand() % 7;
+        for (int k = 0; k < keys; ++k) {
+            s |= 1 << (rand() % STENO_KEY_COUNT);
+        }
+        strokes[i] = s;
+    }
+}
+
+// Decodes length bytes in pieces of up to chunk bytes, or of random sizes up
+// to -chunk if it is negative, and returns the number of strokes.
+static uint32_t decode(int protocol, const uint8_t *data, uint32_t length,
+                       int chunk, uint32_t *strokes, uint32_t max_strokes,
+                       uint32_t *errors) {
+    steno_decoder decoder;
+    decoder_init(&decoder, protocol);
+    uint32_t count = 0;
+    uint32_t offset = 0;
+    while (offset < length) {
+        uint32_t size = chunk > 0 ? chunk : 1 + rand() % -chunk;
+        if (size > length - offset) size = length - offset;
+        uint32_t used;
+        count += decoder_decode(&decoder, data + offset, size, strokes + count,
+                                max_strokes - count, &used);
+        offset += used;
+    }
+    if (errors) *errors = decoder.errors;
+    return count;
+}
+
+static bool check(const char *what, const uint32_t *expected,
+                  uint32_t expected_count, const uint32_t *decoded,
+                  uint32_t decoded_count) {
+    if (decoded_count != expected_count) {
+        fprintf(stderr, "%s: %u strokes instead of %u\n", what, decoded_count,
+                expected_count);
+        return false;
+    }
+    for (uint32_t i = 0; i < expected_count; ++i) {
+        if (decoded[i] != expected[i]) {
+            fprintf(stderr, "%s: stroke %u is %06x instead of %06x\n", what, i,
+                    decoded[i], expected[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *PROTOCOL_NAMES[] = {"TX Bolt", "Gemini PR"};
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (count < 100) count = 100;
+    uint32_t *strokes = new uint32_t[count];
+    // Room for a stroke more than expected so that a decoder that makes too
+    // many is caught.
+    uint32_t *decoded = new uint32_t[count + 1];
+    uint8_t *data = new uint8_t[count * ENCODER_MAX_BYTES];
+    uint8_t *damaged = new uint8_t[count * ENCODER_MAX_BYTES * 2];
+    uint32_t *survivors = new uint32_t[count];
+    make_strokes(strokes, count);
+
+    printf("%d strokes\n", count);
+    for (int protocol = 0; protocol < 2; ++protocol) {
+        encoder_set_protocol(protocol);
+        uint32_t length = encoder_encode(strokes, count, data);
+
+        // Pieces of any size, down to single bytes, and a full output array
+        // part way through a piece, must all give the same strokes.
+        uint32_t n = decode(protocol, data, length, -64, decoded, count + 1,
+                            NULL);
+        if (!check(PROTOCOL_NAMES[protocol], strokes, count, decoded, n)) {
+            return 1;
+        }
+        steno_decoder decoder;
+        decoder_init(&decoder, protocol);
+        n = 0;
+        for (uint32_t offset = 0; offset < length;) {
+            uint32_t used;
+            uint32_t room = 1 + rand() % 3;
+            if (room > count + 1 - n) room = count + 1 - n;
+            n += decoder_decode(&decoder, data + offset, length - offset,
+                                decoded + n, room, &used);
+            offset += used;
+        }
+        if (!check(PROTOCOL_NAMES[protocol], strokes, count, decoded, n)) {
+            return 1;
+        }
+
+        // Garbage between strokes is skipped: a TX Bolt byte with a bit that
+        // the last set doesn't have, and Gemini PR bytes outside a packet.
+        // Strokes with a lost byte are dropped by Gemini PR; TX Bolt can't
+        // tell, so it only gets garbage. Garbage right after a short Gemini PR
+        // packet would look like its missing byte, as would the rest of a
+        // packet that lost its first byte, so damage is never back to back.
+        uint32_t damaged_length = 0;
+        uint32_t survivor_count = 0;
+        bool short_packet = false;
+        encoder_set_protocol(protocol);
+        for (int i = 0; i < count; ++i) {
+            uint8_t bytes[ENCODER_MAX_BYTES];
+            uint32_t size = encoder_encode(strokes + i, 1, bytes);
+            int damage = rand() % 50;
+            if (damage == 0 && !short_packet) {
+                damaged[damaged_length++] = protocol == DECODER_TXBOLT ?
+                    0xE0 | (rand() & 0x1F) : rand() & 0x7F;
+            }
+            if (damage == 1 && protocol == DECODER_GEMINI_PR &&
+                    !short_packet) {
+                int lost = rand() % size;
+                memcpy(damaged + damaged_length, bytes, lost);
+                memcpy(damaged + damaged_length + lost, bytes + lost + 1,
+                       size - lost - 1);
+                damaged_length += size - 1;
+                short_packet = true;
+                continue;
+            }
+            short_packet = false;
+            memcpy(damaged + damaged_length, bytes, size);
+            damaged_length += size;
+            survivors[survivor_count++] = strokes[i];
+        }
+        uint32_t errors;
+        n = decode(protocol, damaged, damaged_length, -64, decoded, count + 1,
+                   &errors);
+        if (!check(PROTOCOL_NAMES[protocol], survivors, survivor_count,
+                   decoded, n)) {
+            return 1;
+        }
+
+        // A tty read gives at most a USB packet or so at a time; a replay can
+        // hand over the whole capture.
+        static const int CHUNKS[] = {64, 4096, 0};
+        for (int c = 0; c < 3; ++c) {
+            int chunk = CHUNKS[c] ? CHUNKS[c] : length;
+            double start = seconds();
+            n = decode(protocol, data, length, chunk, decoded, count + 1, NULL);
+            double elapsed = seconds() - start;
+            char pieces[32];
+            snprintf(pieces, sizeof(pieces), CHUNKS[c] ? "%d byte reads" :
+                     "one read", chunk);
+            printf("%-9s %-15s %7.1f M strokes/s %7.1f MB/s\n",
+                   PROTOCOL_NAMES[protocol], pieces, n / elapsed / 1e6,
+                   length / elapsed / 1e6);
+        }
+        printf("%-9s recovered from %u bad bytes\n", PROTOCOL_NAMES[protocol],
+               errors);
+    }
+    delete[] strokes;
+    delete[] decoded;
+    delete[] data;
+    delete[] damaged;
+    delete[] survivors;
+    return 0;
+}
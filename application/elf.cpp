@@ -0,0 +1,175 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the ELF symbol reader. See the header file for
+// interface documentation to this code.
+//
+// Only what's needed to find the symbol table is read: the file header, the
+// section headers and the SHT_SYMTAB section with its string table. The
+// layouts are in the System V ABI's ELF chapter.
+
+#include "elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t SHT_SYMTAB = 2;
+static const uint32_t SHT_NOBITS = 8;
+static const uint32_t SHF_ALLOC = 2;
+static const uint8_t STT_FUNC = 2;
+static const int SECTION_HEADER_SIZE = 40;
+static const int SYMBOL_SIZE = 16;
+
+static uint16_t read16(const uint8_t *b) {
+    return b[0] | (b[1] << 8);
+}
+
+static uint32_t read32(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    uint32_t x = ((const elf_symbol *)a)->address;
+    uint32_t y = ((const elf_symbol *)b)->address;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Collects the functions from the symbol table in the section header at
+// section. Returns false if the table doesn't fit in the file.
+static bool read_functions(elf_file *elf, const uint8_t *section,
+                           const uint8_t *sections, uint16_t section_count) {
+    uint32_t offset = read32(section + 16);
+    uint32_t size = read32(section + 20);
+    uint32_t link = read32(section + 24);
+    if (link >= section_count) return false;
+    const uint8_t *strings_header = sections + link * SECTION_HEADER_SIZE;
+    uint32_t strings_offset = read32(strings_header + 16);
+    uint32_t strings_size = read32(strings_header + 20);
+    if (offset + size > elf->size || strings_offset + strings_size > elf->size) {
+        return false;
+    }
+
+    int count = size / SYMBOL_SIZE;
+    elf->functions = (elf_symbol *)malloc(sizeof(elf_symbol) * (count + 1));
+    elf->function_count = 0;
+    for (int i = 0; i < count; ++i) {
+        const uint8_t *symbol = elf->data + offset + i * SYMBOL_SIZE;
+        uint32_t name = read32(symbol);
+        if ((symbol[12] & 0xF) != STT_FUNC || name >= strings_size) continue;
+        elf_symbol *f = &elf->functions[elf->function_count++];
+        f->name = (const char *)elf->data + strings_offset + name;
+        f->address = read32(symbol + 4) & ~1u;
+        f->size = read32(symbol + 8);
+    }
+    qsort(elf->functions, elf->function_count, sizeof(elf_symbol),
+          compare_symbols);
+    return true;
+}
+
+bool elf_open(const char *filename, elf_file *elf) {
+    memset(elf, 0, sizeof(*elf));
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("Could not open file: %s\n", filename);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    elf->data = (uint8_t *)malloc(size > 0 ? size : 1);
+    elf->size = size;
+    bool result = size > 0x34 && fread(elf->data, 1, size, fp) == (size_t)size;
+    fclose(fp);
+
+    // The magic number, 32 bit class and little endian data encoding.
+    if (!result || memcmp(elf->data, "\x7F" "ELF\x01\x01", 6) != 0) {
+        printf("Not a 32 bit little endian ELF file: %s\n", filename);
+        elf_close(elf);
+        return false;
+    }
+
+    uint32_t section_offset = read32(elf->data + 0x20);
+    uint16_t section_count = read16(elf->data + 0x30);
+    if (section_offset + section_count * SECTION_HEADER_SIZE > elf->size) {
+        printf("Corrupt ELF file: %s\n", filename);
+        elf_close(elf);
+        return false;
+    }
+    const uint8_t *sections = elf->data + section_offset;
+    for (int i = 0; i < section_count; ++i) {
+        const uint8_t *section = sections + i * SECTION_HEADER_SIZE;
+        if (read32(section + 4) == SHT_SYMTAB) {
+            if (read_functions(elf, section, sections, section_count)) {
+                return true;
+            }
+            break;
+        }
+    }
+    printf("No symbol table in %s\n", filename);
+    elf_close(elf);
+    return false;
+}
+
+void elf_close(elf_file *elf) {
+    free(elf->data);
+    free(elf->functions);
+    memset(elf, 0, sizeof(*elf));
+}
+
+const elf_symbol *elf_find_function(const elf_file *elf, uint32_t address) {
+    address &= ~1u;
+    // Find the last function starting at or before address.
+    int low = 0;
+    int high = elf->function_count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (elf->functions[middle].address <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) return NULL;
+    const elf_symbol *f = &elf->functions[low - 1];
+    if (f->size != 0 && address >= f->address + f->size) return NULL;
+    return f;
+}
+
+const char *elf_read_string(const elf_file *elf, uint32_t address) {
+    uint32_t section_offset = read32(elf->data + 0x20);
+    uint16_t section_count = read16(elf->data + 0x30);
+    for (int i = 0; i < section_count; ++i) {
+        const uint8_t *section =
+            elf->data + section_offset + i * SECTION_HEADER_SIZE;
+        uint32_t type = read32(section + 4);
+        uint32_t flags = read32(section + 8);
+        uint32_t start = read32(section + 12);
+        uint32_t offset = read32(section + 16);
+        uint32_t size = read32(section + 20);
+        if (!(flags & SHF_ALLOC) || type == SHT_NOBITS ||
+            address < start || address - start >= size ||
+            offset + size > elf->size) {
+            continue;
+        }
+        // Only return it if it's terminated inside the section.
+        const char *s = (const char *)elf->data + offset + (address - start);
+        if (memchr(s, 0, size - (address - start)) == NULL) return NULL;
+        return s;
+    }
+    return NULL;
+}
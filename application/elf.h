@@ -0,0 +1,58 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines a reader for the symbols in an ELF file such as the
+// firmware's firmware.elf, which the host tool uses to turn addresses on the
+// device into names and strings.
+//
+// See the .cpp file for implementation details.
+
+#ifndef STENOSAURUS_APPLICATION_ELF_H
+#define STENOSAURUS_APPLICATION_ELF_H
+
+#include <stdint.h>
+
+struct elf_symbol {
+    uint32_t address;
+    uint32_t size;
+    const char *name;
+};
+
+struct elf_file {
+    // The whole file.
+    uint8_t *data;
+    uint32_t size;
+    // The function symbols sorted by address.
+    elf_symbol *functions;
+    int function_count;
+};
+
+// Reads filename, which must be a 32 bit little endian ELF file with a symbol
+// table. Returns false if it can't.
+bool elf_open(const char *filename, elf_file *elf);
+
+void elf_close(elf_file *elf);
+
+// Returns the function containing address, or NULL if there isn't one. The
+// low bit of address is ignored since it only marks Thumb code.
+const elf_symbol *elf_find_function(const elf_file *elf, uint32_t address);
+
+// Returns the NUL terminated string at address in one of the sections that are
+// loaded onto the device, or NULL if there isn't one there.
+const char *elf_read_string(const elf_file *elf, uint32_t address);
+
+#endif // STENOSAURUS_APPLICATION_ELF_H
@@ -0,0 +1,172 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This program measures what it costs to turn strokes into serial protocol
+// bytes with the firmware's encoder.c against the make_packet() that it
+// replaced, which built each TX Bolt set a key at a time. It also checks that
+// the encoder gives the same TX Bolt bytes as make_packet() and the same Gemini
+// PR bytes as a plain encoder that works a key at a time.
+//
+// Usage: encoder-benchmark [strokes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+#include "../firmware/encoder.h"
+#include "../firmware/stroke.h"
+}
+
+// The old way, as it was in txbolt.c.
+typedef struct {
+    uint8_t length;
+    uint8_t byte[5];
+} packet;
+
+static void make_packet(uint32_t s, packet *p) {
+    uint8_t pages[5] = {0};
+#define TXBOLT_KEY(name, label, bit, page, page_bit, ...) \
+    pages[page] |= stroke_has(s, bit) << (page_bit);
+    STENO_LAYOUT(TXBOLT_KEY)
+#undef TXBOLT_KEY
+
+    p->length = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (pages[i]) {
+            p->byte[(p->length)++] = pages[i] | i << 6;
+        }
+    }
+    p->byte[(p->length)++] = 0;
+    for (int i = p->length; i < 5; ++i) {
+        p->byte[i] = 0;
+    }
+}
+
+// Gemini PR a key at a time, to check the encoder against.
+static void make_gemini_pr(uint32_t s, uint8_t *out) {
+    memset(out, 0, 6);
+    out[0] = 0x80;
+#define GEMINI_KEY(name, label, bit, txbolt_byte, txbolt_bit, gemini_byte, \
+                   gemini_bit, ...) \
+    out[gemini_byte] |= stroke_has(s, bit) << (gemini_bit);
+    STENO_LAYOUT(GEMINI_KEY)
+#undef GEMINI_KEY
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Strokes look like steno: usually a few keys, from anywhere on the keyboard.
+static void make_strokes(uint32_t *strokes, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = 0;
+        int keys = 1 + rand() % 7;
+        for (int k = 0; k < keys; ++k) {
+            s |= 1 << (rand() % STENO_KEY_COUNT);
+        }
+        strokes[i] = s;
+    }
+}
+
+// How many strokes the firmware encodes at once at most. See main.c.
+static const int BATCH = 8;
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (count < 100) count = 100;
+    uint32_t *strokes = new uint32_t[count];
+    make_strokes(strokes, count);
+    uint8_t *old_out = new uint8_t[count * ENCODER_MAX_BYTES];
+    uint8_t *new_out = new uint8_t[count * ENCODER_MAX_BYTES];
+
+    // Check every stroke word before timing anything.
+    for (uint32_t s = 0; s <= STENO_ALL_KEYS; ++s) {
+        packet p;
+        make_packet(s, &p);
+        uint8_t bytes[ENCODER_MAX_BYTES];
+        encoder_set_protocol(ENCODER_TXBOLT);
+        uint32_t length = encoder_encode(&s, 1, bytes);
+        if (length != p.length || memcmp(bytes, p.byte, length) != 0) {
+            fprintf(stderr, "TX Bolt differs for stroke %06x\n", s);
+            return 1;
+        }
+        uint8_t gemini[6];
+        make_gemini_pr(s, gemini);
+        encoder_set_protocol(ENCODER_GEMINI_PR);
+        length = encoder_encode(&s, 1, bytes);
+        if (length != 6 || memcmp(bytes, gemini, 6) != 0) {
+            fprintf(stderr, "Gemini PR differs for stroke %06x\n", s);
+            return 1;
+        }
+    }
+
+    double start = seconds();
+    uint8_t *o = old_out;
+    for (int i = 0; i < count; ++i) {
+        packet p;
+        make_packet(strokes[i], &p);
+        memcpy(o, p.byte, p.length);
+        o += p.length;
+    }
+    double old_time = seconds() - start;
+    uint32_t old_length = o - old_out;
+
+    encoder_set_protocol(ENCODER_TXBOLT);
+    start = seconds();
+    uint32_t new_length = 0;
+    for (int i = 0; i < count; i += BATCH) {
+        int n = count - i < BATCH ? count - i : BATCH;
+        new_length += encoder_encode(strokes + i, n, new_out + new_length);
+    }
+    double txbolt_time = seconds() - start;
+    if (new_length != old_length || memcmp(old_out, new_out, old_length) != 0) {
+        fprintf(stderr, "TX Bolt streams differ\n");
+        return 1;
+    }
+
+    start = seconds();
+    new_length = encoder_encode(strokes, count, new_out);
+    double whole_time = seconds() - start;
+
+    encoder_set_protocol(ENCODER_GEMINI_PR);
+    start = seconds();
+    new_length = 0;
+    for (int i = 0; i < count; i += BATCH) {
+        int n = count - i < BATCH ? count - i : BATCH;
+        new_length += encoder_encode(strokes + i, n, new_out + new_length);
+    }
+    double gemini_time = seconds() - start;
+
+    printf("%d strokes\n", count);
+    printf("make_packet:           %6.2f ns per stroke\n",
+           old_time * 1e9 / count);
+    printf("TX Bolt, %d at a time:  %6.2f ns per stroke\n", BATCH,
+           txbolt_time * 1e9 / count);
+    printf("TX Bolt, all at once:  %6.2f ns per stroke\n",
+           whole_time * 1e9 / count);
+    printf("Gemini PR, %d at a time: %5.2f ns per stroke\n", BATCH,
+           gemini_time * 1e9 / count);
+    delete[] strokes;
+    delete[] old_out;
+    delete[] new_out;
+    return 0;
+}
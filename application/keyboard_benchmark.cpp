@@ -0,0 +1,199 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This program runs the firmware's keyboard.c on the host to see how fast it
+// can type. The USB side is replaced by a fake that queues reports the same
+// way usb.c does and hands one to the "host" every polling interval. The host
+// turns the reports back into text the way an operating system would, so any
+// overlap that changes what gets typed shows up as a mismatch.
+//
+// Usage: keyboard-benchmark [text file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "../firmware/events.h"
+#include "../firmware/keyboard.h"
+#include "../firmware/stats.h"
+
+volatile uint32_t stats_counters[STAT_COUNT];
+
+void events_post(event_type type, uint32_t argument) {
+    (void)type;
+    (void)argument;
+}
+}
+
+static const char DEFAULT_TEXT[] =
+    "The quick brown fox jumps over the lazy dog. Stenography lets a writer "
+    "press a whole word at once, so the keyboard has to type it out quickly "
+    "before the next stroke arrives! Words like \"bookkeeper\" and "
+    "\"Mississippi\" repeat letters, which can't share a report. Numbers "
+    "(like 1,234 and 56.78%) and symbols such as @, #, & and * need shift.\n"
+    "She said: 'Let's meet at 10:30 on the 3rd floor; bring the notes.'\n";
+
+// The same depth as the keyboard report queue in usb.c.
+static const uint32_t QUEUE_SIZE = 16;
+
+typedef std::vector<uint8_t> report;
+
+static report current(32);
+static report last_sent(32);
+static std::vector<report> queue;
+
+extern "C" {
+
+uint32_t usb_keyboard_queue_space(void) {
+    return QUEUE_SIZE - queue.size();
+}
+
+bool usb_keyboard_key_down(uint8_t usb_keycode) {
+    if (usb_keyboard_queue_space() == 0) return false;
+    current[usb_keycode / 8] |= 1 << (usb_keycode % 8);
+    return true;
+}
+
+bool usb_keyboard_key_up(uint8_t usb_keycode) {
+    if (usb_keyboard_queue_space() == 0) return false;
+    current[usb_keycode / 8] &= ~(1 << (usb_keycode % 8));
+    return true;
+}
+
+bool usb_keyboard_report_due(void) {
+    return usb_keyboard_queue_space() > 0;
+}
+
+uint32_t usb_send_keys_if_changed(void) {
+    if (current == last_sent) return 0;
+    queue.push_back(current);
+    last_sent = current;
+    return 1;
+}
+
+}
+
+static bool is_down(const report &r, uint8_t keycode) {
+    return r[keycode / 8] & (1 << (keycode % 8));
+}
+
+// Returns what a US layout host types for keycode, or zero.
+static char key_to_ascii(uint8_t keycode, bool shift) {
+    static const struct {
+        uint8_t keycode;
+        char plain;
+        char shifted;
+    } KEYS[] = {
+        {KEY_SPACE, ' ', ' '}, {KEY_ENTER, '\n', '\n'}, {KEY_TAB, '\t', '\t'},
+        {KEY_MINUS, '-', '_'}, {KEY_EQUALS, '=', '+'},
+        {KEY_LEFT_BRACE, '[', '{'}, {KEY_RIGHT_BRACE, ']', '}'},
+        {KEY_BACKSLASH, '\\', '|'}, {KEY_SEMICOLON, ';', ':'},
+        {KEY_QUOTE, '\'', '"'}, {KEY_BACKQUOTE, '`', '~'},
+        {KEY_COMMA, ',', '<'}, {KEY_PERIOD, '.', '>'}, {KEY_SLASH, '/', '?'},
+        {KEY_0, '0', ')'},
+    };
+    static const char SHIFTED_DIGITS[] = "!@#$%^&*(";
+    if (keycode >= KEY_A && keycode <= KEY_Z) {
+        return (shift ? 'A' : 'a') + (keycode - KEY_A);
+    }
+    if (keycode >= KEY_1 && keycode <= KEY_9) {
+        return shift ? SHIFTED_DIGITS[keycode - KEY_1] : '1' + (keycode - KEY_1);
+    }
+    for (size_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); ++i) {
+        if (KEYS[i].keycode == keycode) {
+            return shift ? KEYS[i].shifted : KEYS[i].plain;
+        }
+    }
+    return 0;
+}
+
+// Types text through keyboard.c, taking one report every interval
+// milliseconds, and returns how long it took in milliseconds. The text the
+// host saw is put in typed and the number of reports in reports.
+static uint32_t run(const std::string &text, uint32_t interval,
+                    std::string &typed, uint32_t &reports) {
+    report seen(32);
+    uint32_t elapsed = 0;
+    size_t offset = 0;
+    typed.clear();
+    reports = 0;
+    for (;;) {
+        offset += keyboard_type(text.c_str() + offset);
+        keyboard_poll();
+        if (queue.empty()) {
+            if (offset == text.size()) break;
+            continue;
+        }
+        report r = queue.front();
+        queue.erase(queue.begin());
+        elapsed += interval;
+        ++reports;
+        bool shift = is_down(r, KEY_LEFT_SHIFT) || is_down(r, KEY_RIGHT_SHIFT);
+        for (int keycode = 0; keycode < 256; ++keycode) {
+            if (keycode >= KEY_LEFT_CONTROL && keycode <= KEY_RIGHT_GUI) {
+                continue;
+            }
+            if (is_down(r, keycode) && !is_down(seen, keycode)) {
+                char c = key_to_ascii(keycode, shift);
+                if (c) typed += c;
+            }
+        }
+        seen = r;
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    std::string text = DEFAULT_TEXT;
+    if (argc > 1) {
+        FILE *f = fopen(argv[1], "rb");
+        if (!f) {
+            fprintf(stderr, "Can't open %s\n", argv[1]);
+            return 1;
+        }
+        text.clear();
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            text.append(buf, n);
+        }
+        fclose(f);
+    }
+
+    int result = 0;
+    static const uint32_t INTERVALS[] = {1, 10};
+    for (int i = 0; i < 2; ++i) {
+        for (int enable = 0; enable <= 1; ++enable) {
+            keyboard_set_overlap(enable);
+            std::string typed;
+            uint32_t reports;
+            uint32_t ms = run(text, INTERVALS[i], typed, reports);
+            bool ok = typed == text;
+            printf("%2u ms, overlap %-3s: %6u reports, %.2f reports/char, "
+                   "%7.1f chars/s%s\n",
+                   INTERVALS[i], enable ? "on" : "off", reports,
+                   (double)reports / text.size(),
+                   ms ? text.size() * 1000.0 / ms : 0.0,
+                   ok ? "" : "  MISMATCH");
+            if (!ok) result = 1;
+        }
+    }
+    return result;
+}
@@ -17,19 +17,38 @@
 //
 // This file implements the host application to work with the Stenosaurus.
 
+#include "bulk.h"
+#include "decoder.h"
+#include "elf.h"
+#include "../firmware/stroke.h"
+
+extern "C" {
+// The byte at a time CRC that segmented and bulk transfers are checked with,
+// shared with the firmware.
+#include "../firmware/crc32.h"
+}
+
 #include <hidapi/hidapi.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string.h>
 #include <wchar.h>
 
-// Headers needed for sleeping.
+// Headers needed for sleeping and timing.
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <termios.h>
 #include <unistd.h>
 #endif
+#include <time.h>
 
 void sleep(int miliseconds) {
 #ifdef WIN32
@@ -39,6 +58,17 @@ void sleep(int miliseconds) {
 #endif
 }
 
+// Milliseconds since some arbitrary point. Only useful for measuring time.
+uint64_t now_ms(void) {
+#ifdef WIN32
+    return GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
 #define UNUSED(x) (void)(x)
 
 static const int STENOSAURUS_VID = 0x6666;
@@ -53,10 +83,43 @@ static const int REQUEST_VERIFY_PROGRAM = 4;
 static const int REQUEST_BOOTLOADER = 5;
 static const int REQUEST_RESET = 6;
 static const int REQUEST_DEBUG = 9;
+static const int REQUEST_SD_INIT = 10;
+static const int REQUEST_SD_READ = 11;
+static const int REQUEST_READ_STREAM = 12;
+static const int REQUEST_WRITE_STREAM = 13;
+static const int REQUEST_SEGMENT = 14;
+static const int REQUEST_SET_THRESHOLD = 15;
+static const int REQUEST_RESET_LATENCY = 16;
+static const int REQUEST_TRACE = 17;
+static const int REQUEST_PROFILE = 18;
+static const int REQUEST_SERIAL_BENCHMARK = 19;
+static const int REQUEST_MATRIX = 20;
+static const int REQUEST_CHORD_MODE = 21;
+static const int REQUEST_SERIAL_PROTOCOL = 22;
+static const int REQUEST_SERIAL_FLUSH = 23;
+static const int REQUEST_STROKE_OUTPUTS = 24;
 
 static const uint8_t RESPONSE_UNSOLICITED = 0;
 static const uint8_t RESPONSE_OK = 1;
 static const uint8_t RESPONSE_ERROR = 2;
+static const uint8_t RESPONSE_PENDING = 3;
+static const uint8_t RESPONSE_BUSY = 4;
+static const uint8_t RESPONSE_SEGMENT = 5;
+
+// The streams that can be read or written with segmented transfers.
+static const struct {
+    const char *name;
+    uint8_t id;
+} STREAMS[] = {
+    { "dictionary", 1 },
+    { "stats", 2 },
+    { "latency", 3 },
+    { "trace", 4 },
+    { "profile", 5 },
+    { "memory", 6 },
+    { "log", 7 },
+    { "chatter", 8 },
+};
 
 void mypause(void) {
     printf("Press enter to continue ");
@@ -71,6 +134,15 @@ void write_word(uint8_t *packet, uint32_t word) {
     packet[3] = (word >> 24) & 0xFF;
 }
 
+uint32_t read_word(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+uint8_t next_tag(void) {
+    static uint8_t tag = 0;
+    return ++tag;
+}
+
 void make_erase_packet(uint8_t *packet) {
     packet[0] = REQUEST_ERASE_PROGRAM;
     memset(packet + 1, 0, PACKET_SIZE - 1);
@@ -99,6 +171,121 @@ void make_reset_packet(uint8_t* packet, bool bootloader) {
     memset(packet + 2, 0, PACKET_SIZE - 2);
 }
 
+// The device sends unsolicited reports with events alongside the responses to
+// requests. A thread reads everything the device sends, passes the events to
+// the event handler and queues the rest for receive(). Only one device is open
+// at a time so there is a single reader.
+static const int RECEIVE_QUEUE_SIZE = 64;
+static struct {
+    hid_device *handle;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t queue[RECEIVE_QUEUE_SIZE][PACKET_SIZE];
+    int head;
+    int count;
+    bool running;
+    bool failed;
+    void (*event_handler)(const uint8_t *report);
+} reader = { 0, pthread_t(), PTHREAD_MUTEX_INITIALIZER,
+             PTHREAD_COND_INITIALIZER, {{0}}, 0, 0, false, false, 0 };
+
+void *reader_main(void *) {
+    uint8_t packet[PACKET_SIZE];
+    pthread_mutex_lock(&reader.lock);
+    while (reader.running) {
+        pthread_mutex_unlock(&reader.lock);
+        // Wake up now and then to see if it's time to stop.
+        int res = hid_read_timeout(reader.handle, packet, PACKET_SIZE, 100);
+        pthread_mutex_lock(&reader.lock);
+        if (res < 0) {
+            reader.failed = true;
+            pthread_cond_broadcast(&reader.changed);
+            break;
+        } else if (res == 0) {
+            continue;
+        } else if (packet[0] == RESPONSE_UNSOLICITED) {
+            if (reader.event_handler) {
+                reader.event_handler(packet);
+            }
+            continue;
+        }
+        // Wait for room rather than lose a response.
+        while (reader.running && reader.count == RECEIVE_QUEUE_SIZE) {
+            pthread_cond_wait(&reader.changed, &reader.lock);
+        }
+        int tail = (reader.head + reader.count) % RECEIVE_QUEUE_SIZE;
+        memcpy(reader.queue[tail], packet, PACKET_SIZE);
+        ++reader.count;
+        pthread_cond_broadcast(&reader.changed);
+    }
+    pthread_mutex_unlock(&reader.lock);
+    return 0;
+}
+
+void start_reader(hid_device *handle) {
+    reader.handle = handle;
+    reader.head = 0;
+    reader.count = 0;
+    reader.running = true;
+    reader.failed = false;
+    pthread_create(&reader.thread, 0, reader_main, 0);
+}
+
+void stop_reader(void) {
+    pthread_mutex_lock(&reader.lock);
+    reader.running = false;
+    pthread_cond_broadcast(&reader.changed);
+    pthread_mutex_unlock(&reader.lock);
+    pthread_join(reader.thread, 0);
+}
+
+// Like hid_read_timeout() but only returns responses to requests.
+int receive(hid_device *handle, uint8_t *packet, int timeout_ms) {
+    UNUSED(handle);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int result = 0;
+    pthread_mutex_lock(&reader.lock);
+    while (reader.count == 0 && !reader.failed) {
+        if (pthread_cond_timedwait(&reader.changed, &reader.lock,
+                                   &deadline) != 0) {
+            break;
+        }
+    }
+    if (reader.count != 0) {
+        memcpy(packet, reader.queue[reader.head], PACKET_SIZE);
+        reader.head = (reader.head + 1) % RECEIVE_QUEUE_SIZE;
+        --reader.count;
+        pthread_cond_broadcast(&reader.changed);
+        result = PACKET_SIZE;
+    } else if (reader.failed) {
+        result = -1;
+    }
+    pthread_mutex_unlock(&reader.lock);
+    return result;
+}
+
+// Sets the function that is called, on the reader thread, with each
+// unsolicited report.
+void set_event_handler(void (*handler)(const uint8_t *report)) {
+    pthread_mutex_lock(&reader.lock);
+    reader.event_handler = handler;
+    pthread_mutex_unlock(&reader.lock);
+}
+
+void disconnect(hid_device *handle) {
+    stop_reader();
+    hid_close(handle);
+}
+
 bool send_receive(hid_device *handle, unsigned char * const packet) {
     uint8_t buf[PACKET_SIZE + 1];
     buf[0] = 0;
@@ -109,8 +296,7 @@ bool send_receive(hid_device *handle, unsigned char * const packet) {
         printf("Failed to send.\n");
         return false;
     }
-    res = hid_read_timeout(handle, packet, PACKET_SIZE,  30 * 1000);
-    //res = hid_read(handle, packet, PACKET_SIZE);
+    res = receive(handle, packet, 30 * 1000);
     if (res <= 0) {
         printf("failed to receive.\n");
         return false;
@@ -130,6 +316,54 @@ bool send_receive(hid_device *handle, unsigned char * const packet) {
     return result;
 }
 
+// Requests from REQUEST_SD_INIT up are tagged. The request is laid out as
+// [request] [tag] [arguments...] and the response as [status] [request] [tag]
+// [results...]. Slow requests are first answered with RESPONSE_PENDING and the
+// real response arrives later with the same tag so this keeps reading until it
+// sees it. The packet must have the request and arguments filled in and the tag
+// is picked here.
+bool send_receive_tagged(hid_device *handle, uint8_t * const packet,
+                         int timeout_ms) {
+    uint8_t request = packet[0];
+    uint8_t tag = next_tag();
+    packet[1] = tag;
+
+    uint8_t buf[PACKET_SIZE + 1];
+    buf[0] = 0;
+    memcpy(buf + 1, packet, PACKET_SIZE);
+
+    while (true) {
+        if (hid_write(handle, buf, PACKET_SIZE + 1) < 0) {
+            printf("Failed to send.\n");
+            return false;
+        }
+        bool busy = false;
+        while (!busy) {
+            int res = receive(handle, packet, timeout_ms);
+            if (res <= 0) {
+                printf("failed to receive.\n");
+                return false;
+            }
+            // Skip anything that isn't for this request, like a late response
+            // to an earlier one that timed out.
+            if (packet[1] != request || packet[2] != tag) continue;
+
+            if (packet[0] == RESPONSE_OK) {
+                return true;
+            } else if (packet[0] == RESPONSE_ERROR) {
+                return false;
+            } else if (packet[0] == RESPONSE_BUSY) {
+                busy = true;
+            } else if (packet[0] != RESPONSE_PENDING) {
+                printf("Unknown response\n");
+                return false;
+            }
+        }
+        // The device has too many slow requests queued. Give it a moment.
+        sleep(10);
+    }
+}
+
 bool is_bootloader(hid_device *handle, bool *result) {
     uint8_t packet[PACKET_SIZE];
     make_bootloader_packet(packet);
@@ -158,6 +392,9 @@ bool connect(hid_device** handle) {
         next = next->next;
     }
     hid_free_enumeration(list);
+    if (*handle != 0) {
+        start_reader(*handle);
+    }
     return *handle != 0;
 }
 
@@ -189,11 +426,11 @@ hid_device* enter_device_mode(bool bootloader) {
                     printf("Not in application mode.\n");
                 }
                 if (--attempts == 0) {
-                    hid_close(handle);
+                    disconnect(handle);
                     return 0;
                 }
                 send_reset(handle, bootloader);
-                hid_close(handle);
+                disconnect(handle);
                 printf("Switching to requested mode.\n");
                 sleep(2000);
             }
@@ -243,6 +480,1681 @@ uint32_t compute_crc(const uint8_t * buf, uint32_t size) {
     return(result);
 }
 
+// Segmented transfers move blocks of data bigger than a packet. See the
+// firmware's protocol.c for the packet layouts. Each segment is copied straight
+// between the packet and its place in the caller's buffer.
+static const uint32_t SEGMENT_READ_SIZE = PACKET_SIZE - 5;
+static const uint32_t SEGMENT_WRITE_SIZE = PACKET_SIZE - 4;
+static const uint8_t DEFAULT_WINDOW = 8;
+
+// The entry types in the response to REQUEST_INFO. See the firmware's
+// protocol.c for what each one holds.
+static const uint8_t INFO_PROTOCOL_VERSION = 1;
+static const uint8_t INFO_BUILD_ID = 2;
+static const uint8_t INFO_REQUESTS = 3;
+static const uint8_t INFO_MAX_WINDOW = 4;
+static const uint8_t INFO_QUEUE_DEPTH = 5;
+static const uint8_t INFO_COMPRESSION = 6;
+static const uint8_t INFO_ENDPOINTS = 7;
+static const uint8_t INFO_FLASH_SIZES = 8;
+static const uint8_t INFO_RAM_SIZES = 9;
+static const uint8_t INFO_STREAMS = 10;
+
+static const uint8_t INFO_ENDPOINT_RAW_HID = 1;
+static const uint8_t INFO_ENDPOINT_BULK = 2;
+static const uint8_t INFO_ENDPOINT_CDC_SERIAL = 4;
+
+// What the device says it can do.
+struct capabilities {
+    uint16_t protocol_version;
+    uint32_t build_id;
+    uint32_t requests;
+    uint8_t max_window;
+    uint8_t queue_depth;
+    uint8_t compression;
+    uint8_t endpoints;
+    uint32_t bootloader_flash_size;
+    uint32_t firmware_flash_size;
+    uint32_t ram_size;
+    uint32_t dictionary_size;
+    uint8_t streams[PACKET_SIZE];
+    uint8_t stream_count;
+};
+
+bool supports(const capabilities &caps, int request) {
+    return (caps.requests >> request) & 1;
+}
+
+// Asks the device what it can do. The bootloader and older firmware answer
+// REQUEST_INFO with a string instead, so in that case this fills in what they
+// are known to support: the untagged requests, one request at a time.
+bool query_capabilities(hid_device *handle, capabilities *caps) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_INFO;
+    if (!send_receive(handle, packet)) return false;
+
+    memset(caps, 0, sizeof(*caps));
+    caps->requests = 1 << REQUEST_INFO | 1 << REQUEST_ERASE_PROGRAM |
+                     1 << REQUEST_FLASH_PROGRAM | 1 << REQUEST_VERIFY_PROGRAM |
+                     1 << REQUEST_BOOTLOADER | 1 << REQUEST_RESET;
+    caps->max_window = 1;
+    caps->queue_depth = 1;
+    caps->endpoints = INFO_ENDPOINT_RAW_HID;
+    if (packet[2] != INFO_PROTOCOL_VERSION) return true;
+
+    int i = 2;
+    while (i + 2 <= PACKET_SIZE && packet[i] != 0) {
+        uint8_t type = packet[i];
+        uint8_t length = packet[i + 1];
+        const uint8_t *value = packet + i + 2;
+        i += 2 + length;
+        if (i > PACKET_SIZE) break;
+
+        if (type == INFO_PROTOCOL_VERSION && length >= 2) {
+            caps->protocol_version = value[0] | (value[1] << 8);
+        } else if (type == INFO_BUILD_ID && length >= 4) {
+            caps->build_id = read_word(value);
+        } else if (type == INFO_REQUESTS && length >= 4) {
+            caps->requests = read_word(value);
+        } else if (type == INFO_MAX_WINDOW && length >= 1) {
+            caps->max_window = value[0];
+        } else if (type == INFO_QUEUE_DEPTH && length >= 1) {
+            caps->queue_depth = value[0];
+        } else if (type == INFO_COMPRESSION && length >= 1) {
+            caps->compression = value[0];
+        } else if (type == INFO_ENDPOINTS && length >= 1) {
+            caps->endpoints = value[0];
+        } else if (type == INFO_FLASH_SIZES && length >= 8) {
+            caps->bootloader_flash_size = read_word(value);
+            caps->firmware_flash_size = read_word(value + 4);
+        } else if (type == INFO_RAM_SIZES && length >= 8) {
+            caps->ram_size = read_word(value);
+            caps->dictionary_size = read_word(value + 4);
+        } else if (type == INFO_STREAMS) {
+            memcpy(caps->streams, value, length);
+            caps->stream_count = length;
+        }
+    }
+    return true;
+}
+
+// How to move data to and from the device, chosen from its capabilities.
+struct transport {
+    // Segments sent before waiting for an acknowledgement.
+    uint8_t window;
+    // Slow requests kept in flight at once.
+    uint8_t batch;
+};
+
+transport choose_transport(const capabilities &caps) {
+    transport t;
+    t.window = DEFAULT_WINDOW;
+    if (t.window > caps.max_window) t.window = caps.max_window;
+    if (t.window == 0) t.window = 1;
+    t.batch = caps.queue_depth ? caps.queue_depth : 1;
+    return t;
+}
+
+void print_capabilities(const capabilities &caps) {
+    if (caps.protocol_version == 0) {
+        printf("Device predates capability discovery.\n");
+        return;
+    }
+    printf("Protocol version: %u\n", caps.protocol_version);
+    printf("Build: %08x\n", caps.build_id);
+    printf("Requests:");
+    for (int i = 0; i < 32; ++i) {
+        if (supports(caps, i)) printf(" %d", i);
+    }
+    printf("\n");
+    printf("Max window: %u\n", caps.max_window);
+    printf("Queue depth: %u\n", caps.queue_depth);
+    printf("Compression: %s\n", caps.compression ? "yes" : "none");
+    printf("Endpoints:%s%s%s\n",
+           caps.endpoints & INFO_ENDPOINT_RAW_HID ? " raw-hid" : "",
+           caps.endpoints & INFO_ENDPOINT_BULK ? " bulk" : "",
+           caps.endpoints & INFO_ENDPOINT_CDC_SERIAL ? " cdc-serial" : "");
+    printf("Flash: %u bytes bootloader, %u bytes firmware\n",
+           caps.bootloader_flash_size, caps.firmware_flash_size);
+    printf("RAM: %u bytes, %u bytes for the dictionary\n", caps.ram_size,
+           caps.dictionary_size);
+    printf("Streams:");
+    for (int i = 0; i < caps.stream_count; ++i) {
+        const char *name = "unknown";
+        for (size_t j = 0; j < sizeof(STREAMS) / sizeof(STREAMS[0]); ++j) {
+            if (STREAMS[j].id == caps.streams[i]) name = STREAMS[j].name;
+        }
+        printf(" %s(%u)", name, caps.streams[i]);
+    }
+    printf("\n");
+}
+
+void print_throughput(const char *direction, uint32_t length,
+                      uint64_t host_ms, uint32_t device_ms) {
+    double seconds = host_ms ? host_ms / 1000.0 : 0.001;
+    printf("%s %u bytes in %u ms (%.1f KB/s), device took %u ms.\n",
+           direction, length, (unsigned)host_ms,
+           length / seconds / 1024.0, device_ms);
+}
+
+// Reads up to max_length bytes from stream starting at offset into data. The
+// number of bytes read is put in length and, if device_ms isn't NULL, the time
+// the device spent sending them in device_ms.
+bool read_stream(hid_device *handle, uint8_t stream, uint32_t offset,
+                 uint8_t *data, uint32_t max_length, uint32_t *length,
+                 uint32_t *device_ms) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    uint8_t tag = next_tag();
+    packet[0] = REQUEST_READ_STREAM;
+    packet[1] = tag;
+    packet[2] = stream;
+    write_word(packet + 3, offset);
+    write_word(packet + 7, max_length);
+
+    uint8_t buf[PACKET_SIZE + 1];
+    buf[0] = 0;
+    memcpy(buf + 1, packet, PACKET_SIZE);
+    if (hid_write(handle, buf, PACKET_SIZE + 1) < 0) {
+        printf("Failed to send.\n");
+        return false;
+    }
+
+    uint32_t expected_length = 0;
+    uint32_t received = 0;
+    uint16_t sequence = 0;
+    uint32_t crc = 0xFFFFFFFF;
+    while (true) {
+        if (receive(handle, packet, 5 * 1000) <= 0) {
+            printf("failed to receive.\n");
+            return false;
+        }
+        if (packet[1] != REQUEST_READ_STREAM || packet[2] != tag) continue;
+
+        if (packet[0] == RESPONSE_PENDING) {
+            expected_length = read_word(packet + 3);
+            if (expected_length > max_length) {
+                printf("Device wants to send too much: %u\n", expected_length);
+                return false;
+            }
+        } else if (packet[0] == RESPONSE_SEGMENT) {
+            uint16_t s = packet[3] | (packet[4] << 8);
+            if (s != sequence) {
+                printf("Lost segment %u.\n", sequence);
+                return false;
+            }
+            uint32_t size = expected_length - received;
+            if (size > SEGMENT_READ_SIZE) size = SEGMENT_READ_SIZE;
+            memcpy(data + received, packet + 5, size);
+            crc = crc32_update(crc, packet + 5, size);
+            received += size;
+            ++sequence;
+        } else if (packet[0] == RESPONSE_OK) {
+            if (received != expected_length ||
+                    read_word(packet + 7) != received) {
+                printf("Expected %u bytes but got %u.\n", expected_length,
+                       received);
+                return false;
+            }
+            if (read_word(packet + 3) != crc) {
+                printf("CRC mismatch. Actual: %u, Received: %u\n", crc,
+                       read_word(packet + 3));
+                return false;
+            }
+            *length = received;
+            if (device_ms) *device_ms = read_word(packet + 11);
+            return true;
+        } else {
+            printf("Device could not read the stream.\n");
+            return false;
+        }
+    }
+}
+
+// Waits for the device's answer to the segment with the given sequence number.
+bool wait_for_segment_ack(hid_device *handle, uint8_t tag, uint16_t sequence,
+                          uint8_t *packet) {
+    while (true) {
+        if (receive(handle, packet, 5 * 1000) <= 0) {
+            printf("failed to receive.\n");
+            return false;
+        }
+        if (packet[1] != REQUEST_SEGMENT || packet[2] != tag) continue;
+        uint16_t s = packet[3] | (packet[4] << 8);
+        if (packet[0] != RESPONSE_OK || s != sequence) {
+            printf("Device rejected segment %u.\n", s);
+            return false;
+        }
+        return true;
+    }
+}
+
+// Writes length bytes from data into stream starting at offset.
+bool write_stream(hid_device *handle, uint8_t stream, uint32_t offset,
+                  const uint8_t *data, uint32_t length, uint8_t window) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_WRITE_STREAM;
+    packet[2] = stream;
+    write_word(packet + 3, offset);
+    write_word(packet + 7, length);
+    write_word(packet + 11, crc32_update(0xFFFFFFFF, data, length));
+    packet[15] = window;
+    uint64_t start = now_ms();
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        printf("Device refused the write.\n");
+        return false;
+    }
+    uint8_t tag = packet[2];
+    window = packet[3];
+
+    uint8_t buf[PACKET_SIZE + 1];
+    uint32_t sent = 0;
+    uint16_t sequence = 0;
+    while (sent < length) {
+        uint32_t size = length - sent;
+        if (size > SEGMENT_WRITE_SIZE) size = SEGMENT_WRITE_SIZE;
+        memset(buf, 0, sizeof(buf));
+        buf[1] = REQUEST_SEGMENT;
+        buf[2] = tag;
+        buf[3] = sequence & 0xFF;
+        buf[4] = sequence >> 8;
+        memcpy(buf + 5, data + sent, size);
+        if (hid_write(handle, buf, PACKET_SIZE + 1) < 0) {
+            printf("Failed to send.\n");
+            return false;
+        }
+        sent += size;
+        bool last = sent == length;
+        if (last || (sequence + 1) % window == 0) {
+            if (!wait_for_segment_ack(handle, tag, sequence, packet)) {
+                return false;
+            }
+        }
+        ++sequence;
+    }
+    print_throughput("Wrote", length, now_ms() - start, read_word(packet + 9));
+    return true;
+}
+
+bool find_stream(const char *name, uint8_t *id) {
+    for (size_t i = 0; i < sizeof(STREAMS) / sizeof(STREAMS[0]); ++i) {
+        if (strcmp(STREAMS[i].name, name) == 0) {
+            *id = STREAMS[i].id;
+            return true;
+        }
+    }
+    printf("Unknown stream: %s\n", name);
+    return false;
+}
+
+// Transfers at least this big go over the bulk channel when the device has
+// one, since the round trip to set it up costs more than it saves on small
+// ones. Reads don't know their size up front so they always use it.
+static const uint32_t BULK_MIN_WRITE = 4 * 1024;
+
+// Opens the bulk channel if the device supports it and its serial port can be
+// found.
+bool open_bulk(const capabilities &caps, bulk_channel *channel) {
+    return (caps.endpoints & INFO_ENDPOINT_BULK) &&
+           bulk_open(STENOSAURUS_VID, channel);
+}
+
+bool read_stream_to_file(const char *name, const char *filename) {
+    uint8_t id;
+    if (!find_stream(name, &id)) return false;
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    if (!query_capabilities(handle, &caps) ||
+            !supports(caps, REQUEST_READ_STREAM)) {
+        printf("Device can't read streams.\n");
+        disconnect(handle);
+        return false;
+    }
+
+    static const uint32_t MAX_STREAM_SIZE = 1024 * 1024;
+    uint8_t *data = (uint8_t *)malloc(MAX_STREAM_SIZE);
+    if (data == NULL) {
+        printf("Could not allocate %u bytes for the stream.\n",
+               MAX_STREAM_SIZE);
+        disconnect(handle);
+        return false;
+    }
+    uint32_t length = 0;
+    uint32_t device_ms = 0;
+    uint64_t start = now_ms();
+    bool result;
+    bulk_channel channel;
+    if (open_bulk(caps, &channel)) {
+        result = bulk_read_stream(&channel, id, 0, data, MAX_STREAM_SIZE,
+                                  &length, &device_ms);
+        bulk_close(&channel);
+    } else {
+        result = read_stream(handle, id, 0, data, MAX_STREAM_SIZE, &length,
+                             &device_ms);
+    }
+    disconnect(handle);
+    if (result) {
+        print_throughput("Read", length, now_ms() - start, device_ms);
+        FILE *fp = fopen(filename, "wb");
+        if (fp == NULL) {
+            printf("Could not open file: %s\n", filename);
+            result = false;
+        } else {
+            fwrite(data, 1, length, fp);
+            fclose(fp);
+        }
+    }
+    free(data);
+    return result;
+}
+
+bool write_stream_from_file(const char *name, const char *filename,
+                            uint32_t offset) {
+    uint8_t id;
+    if (!find_stream(name, &id)) return false;
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("Could not open file: %s\n", filename);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(length > 0 ? length : 1);
+    bool result = fread(data, 1, length, fp) == (size_t)length;
+    fclose(fp);
+
+    hid_device *handle = result ? enter_device_mode(false) : 0;
+    capabilities caps;
+    if (handle == 0) {
+        result = false;
+    } else if (!query_capabilities(handle, &caps) ||
+               !supports(caps, REQUEST_WRITE_STREAM)) {
+        printf("Device can't write streams.\n");
+        disconnect(handle);
+        result = false;
+    } else {
+        bulk_channel channel;
+        if (length >= BULK_MIN_WRITE && open_bulk(caps, &channel)) {
+            uint32_t device_ms = 0;
+            uint64_t start = now_ms();
+            result = bulk_write_stream(&channel, id, offset, data, length,
+                                       &device_ms);
+            bulk_close(&channel);
+            if (result) {
+                print_throughput("Wrote", length, now_ms() - start,
+                                 device_ms);
+            }
+        } else {
+            transport t = choose_transport(caps);
+            result = write_stream(handle, id, offset, data, length, t.window);
+        }
+        disconnect(handle);
+    }
+    free(data);
+    return result;
+}
+
+// The counters in the stats stream. See the firmware's stats.h and stats.c.
+static const char *STAT_NAMES[] = {
+    "strokes",
+    "usb-reports-sent",
+    "usb-reports-dropped",
+    "cdc-bytes",
+    "usb-interrupts",
+    "sd-ops",
+    "sd-errors",
+    "cdc-bytes-dropped",
+    "keyboard-queue-high-water",
+    "keyboard-reports-refused",
+    "key-events",
+    "key-events-refused",
+    "key-fifo-high-water",
+    "usb-poll-period",
+    "strokes-dropped",
+    "steno-reports-dropped",
+};
+static const int STAT_COUNT = sizeof(STAT_NAMES) / sizeof(STAT_NAMES[0]);
+static const int STATS_KEYS = STENO_KEY_COUNT;
+static const uint8_t STREAM_STATS = 2;
+
+// The label of the steno key with the given stroke bit, from the firmware's
+// layout.
+static const char *steno_key_label(int bit) {
+#define KEY_LABEL(name, label, key_bit, ...) if (bit == key_bit) return label;
+    STENO_LAYOUT(KEY_LABEL)
+#undef KEY_LABEL
+    return "?";
+}
+
+struct stats {
+    uint32_t counters[STAT_COUNT];
+    uint32_t strokes_per_minute;
+    uint32_t keys_per_stroke[STATS_KEYS + 1];
+    uint32_t key_usage[STATS_KEYS];
+};
+
+bool read_stats(hid_device *handle, stats *s) {
+    uint8_t data[sizeof(stats)];
+    uint32_t length = 0;
+    if (!read_stream(handle, STREAM_STATS, 0, data, sizeof(data), &length,
+                     0)) {
+        return false;
+    }
+    // Newer firmware may add counters, which shifts everything after them.
+    // Only the layout this was written for is understood.
+    if (length != sizeof(data)) {
+        printf("Unexpected stats size: %u\n", length);
+        return false;
+    }
+    uint32_t *words = (uint32_t *)s;
+    for (size_t i = 0; i < sizeof(stats) / 4; ++i) {
+        words[i] = read_word(data + i * 4);
+    }
+    return true;
+}
+
+void print_stats(const stats &s, const stats *previous, double seconds) {
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        printf("%-26s %10u", STAT_NAMES[i], s.counters[i]);
+        if (previous) {
+            printf("  %10.1f/s",
+                   (s.counters[i] - previous->counters[i]) / seconds);
+        }
+        printf("\n");
+    }
+    printf("%-26s %10u\n", "strokes-per-minute", s.strokes_per_minute);
+
+    printf("\nKeys per stroke:\n");
+    for (int i = 0; i <= STATS_KEYS; ++i) {
+        if (s.keys_per_stroke[i]) {
+            printf("%4d %10u\n", i, s.keys_per_stroke[i]);
+        }
+    }
+
+    printf("\nKey usage:\n");
+    uint32_t most = 1;
+    for (int i = 0; i < STATS_KEYS; ++i) {
+        if (s.key_usage[i] > most) most = s.key_usage[i];
+    }
+    for (int i = STATS_KEYS - 1; i >= 0; --i) {
+        int bar = (int)(s.key_usage[i] * 40ULL / most);
+        printf("%4s %10u ", steno_key_label(i), s.key_usage[i]);
+        for (int j = 0; j < bar; ++j) printf("#");
+        printf("\n");
+    }
+}
+
+// Prints the device statistics. With watch set it redraws them every second
+// along with the rate each counter is going up at.
+bool show_stats(bool watch) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    stats previous;
+    stats current;
+    uint64_t previous_ms = now_ms();
+    bool result = read_stats(handle, &previous);
+    if (result) print_stats(previous, 0, 0);
+    while (result && watch) {
+        sleep(1000);
+        result = read_stats(handle, &current);
+        if (!result) break;
+        uint64_t ms = now_ms();
+        // Clear the screen and go to the top left.
+        printf("\033[2J\033[H");
+        print_stats(current, &previous, (ms - previous_ms) / 1000.0);
+        fflush(stdout);
+        previous = current;
+        previous_ms = ms;
+    }
+    disconnect(handle);
+    return result;
+}
+
+// Asks the device to send an event when the named counter reaches value.
+bool set_threshold(const char *name, uint32_t value) {
+    int counter = 0;
+    while (counter < STAT_COUNT && strcmp(STAT_NAMES[counter], name) != 0) {
+        ++counter;
+    }
+    if (counter == STAT_COUNT) {
+        printf("Unknown counter: %s\n", name);
+        return false;
+    }
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_SET_THRESHOLD;
+    packet[2] = counter;
+    write_word(packet + 3, value);
+    bool result = send_receive_tagged(handle, packet, 5 * 1000);
+    if (!result) printf("Could not set the threshold.\n");
+    disconnect(handle);
+    return result;
+}
+
+// The latency histograms. See the firmware's latency.c for the layout.
+static const uint8_t STREAM_LATENCY = 3;
+static const int LATENCY_BUCKETS = 33;
+static const double CYCLES_PER_US = 48;
+static const char *LATENCY_STAGES[] = {
+    "key to stroke",
+    "stroke to queued",
+    "queued to sent",
+    "key to sent",
+};
+static const int LATENCY_STAGE_COUNT =
+    sizeof(LATENCY_STAGES) / sizeof(LATENCY_STAGES[0]);
+
+struct latency_histogram {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+// Estimates the time in cycles below which the given fraction of samples fall.
+// Bucket n holds times from 2^(n-1) to 2^n - 1 so this assumes the samples are
+// spread evenly through the bucket and clamps to the known min and max.
+double percentile(const latency_histogram &h, double fraction) {
+    double target = fraction * h.count;
+    double seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        if (h.buckets[i] == 0) continue;
+        if (seen + h.buckets[i] >= target) {
+            double low = i == 0 ? 0 : (double)(1ULL << (i - 1));
+            double high = (double)(1ULL << i);
+            double result = low + (high - low) * (target - seen) / h.buckets[i];
+            if (result < h.min) result = h.min;
+            if (result > h.max) result = h.max;
+            return result;
+        }
+        seen += h.buckets[i];
+    }
+    return h.max;
+}
+
+// Prints the latency of each stage in microseconds, then clears the histograms
+// if reset is set.
+bool show_latency(bool reset) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    latency_histogram histograms[LATENCY_STAGE_COUNT];
+    uint8_t data[sizeof(histograms)];
+    uint32_t length = 0;
+    bool result = read_stream(handle, STREAM_LATENCY, 0, data, sizeof(data),
+                              &length, 0);
+    if (result && length != sizeof(data)) {
+        printf("Unexpected latency size: %u\n", length);
+        result = false;
+    }
+    if (result) {
+        uint32_t *words = (uint32_t *)histograms;
+        for (size_t i = 0; i < sizeof(histograms) / 4; ++i) {
+            words[i] = read_word(data + i * 4);
+        }
+        printf("%-18s %8s %9s %9s %9s %9s %9s %9s\n", "stage (us)", "count",
+               "min", "p50", "p90", "p99", "p99.9", "max");
+        for (int i = 0; i < LATENCY_STAGE_COUNT; ++i) {
+            const latency_histogram &h = histograms[i];
+            printf("%-18s %8u", LATENCY_STAGES[i], h.count);
+            if (h.count == 0) {
+                printf("\n");
+                continue;
+            }
+            printf(" %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                   h.min / CYCLES_PER_US,
+                   percentile(h, 0.5) / CYCLES_PER_US,
+                   percentile(h, 0.9) / CYCLES_PER_US,
+                   percentile(h, 0.99) / CYCLES_PER_US,
+                   percentile(h, 0.999) / CYCLES_PER_US,
+                   h.max / CYCLES_PER_US);
+        }
+    }
+    if (result && reset) {
+        uint8_t packet[PACKET_SIZE];
+        memset(packet, 0, PACKET_SIZE);
+        packet[0] = REQUEST_RESET_LATENCY;
+        result = send_receive_tagged(handle, packet, 5 * 1000);
+        if (!result) printf("Could not reset the histograms.\n");
+    }
+    disconnect(handle);
+    return result;
+}
+
+// The event trace. See the firmware's trace.h and trace.c. Each event is shown
+// in the Chrome trace viewer on the track of the context that records it, as
+// either a begin, an end or an instant.
+static const uint8_t STREAM_TRACE = 4;
+static const int TRACE_RECORD_SIZE = 12;
+static const int TRACE_TRACKS = 3;
+static const char *TRACE_TRACK_NAMES[TRACE_TRACKS] = {
+    "main loop", "USB interrupt", "sys tick",
+};
+static const struct {
+    const char *name;
+    char phase;
+    int track;
+} TRACE_EVENTS[] = {
+    { 0, 0, 0 },
+    { "USB interrupt", 'B', 1 },
+    { "USB interrupt", 'E', 1 },
+    { "sys tick", 'i', 2 },
+    { "SD read", 'B', 0 },
+    { "SD read", 'E', 0 },
+    { "SD write", 'B', 0 },
+    { "SD write", 'E', 0 },
+    { "SD init", 'B', 0 },
+    { "SD init", 'E', 0 },
+    { "command", 'B', 0 },
+    { "command", 'E', 0 },
+    { "key change", 'i', 0 },
+    { "stroke", 'i', 0 },
+};
+static const uint16_t TRACE_EVENT_COUNT =
+    sizeof(TRACE_EVENTS) / sizeof(TRACE_EVENTS[0]);
+
+bool enable_trace(hid_device *handle, bool enable) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_TRACE;
+    packet[2] = enable ? 1 : 0;
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        printf("Could not %s the trace. Is the firmware built with TRACE=1?\n",
+               enable ? "start" : "stop");
+        return false;
+    }
+    return true;
+}
+
+// Writes the records in data to fp as Chrome trace events. The cycle counter
+// wraps every 89 seconds so times are kept as the sum of the differences
+// between records, in cycles since the first one, in *time. *previous holds
+// the cycle count of the last record written.
+void write_trace_events(FILE *fp, const uint8_t *data, uint32_t length,
+                        uint64_t *time, uint32_t *previous, bool *first) {
+    for (uint32_t i = 0; i + TRACE_RECORD_SIZE <= length;
+            i += TRACE_RECORD_SIZE) {
+        const uint8_t *record = data + i;
+        uint32_t cycles = read_word(record);
+        uint32_t argument = read_word(record + 4);
+        uint16_t id = record[8] | (record[9] << 8);
+        if (id == 0 || id >= TRACE_EVENT_COUNT) continue;
+        if (!*first) {
+            *time += (int32_t)(cycles - *previous);
+        }
+        *previous = cycles;
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u}%s}",
+                *first ? "" : ",", TRACE_EVENTS[id].name,
+                TRACE_EVENTS[id].phase, *time / CYCLES_PER_US,
+                TRACE_EVENTS[id].track, argument,
+                TRACE_EVENTS[id].phase == 'i' ? ",\"s\":\"t\"" : "");
+        *first = false;
+    }
+}
+
+// Records a trace for the given number of seconds and writes it to filename in
+// the Chrome trace event format, which chrome://tracing and Perfetto can open.
+// The device only holds a few hundred records so it is drained as it goes.
+bool record_trace(const char *filename, int seconds) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        printf("Could not open file: %s\n", filename);
+        return false;
+    }
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) {
+        fclose(fp);
+        return false;
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int i = 0; i < TRACE_TRACKS; ++i) {
+        fprintf(fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}},", i,
+                TRACE_TRACK_NAMES[i]);
+    }
+
+    static const uint32_t MAX_DRAIN = 64 * 1024;
+    uint8_t *data = (uint8_t *)malloc(MAX_DRAIN);
+    uint64_t time = 0;
+    uint32_t previous = 0;
+    bool first = true;
+    uint32_t records = 0;
+    bool result = enable_trace(handle, true);
+    uint64_t end = now_ms() + seconds * 1000ULL;
+    while (result) {
+        bool last = now_ms() >= end;
+        if (last) {
+            result = enable_trace(handle, false);
+            if (!result) break;
+        }
+        uint32_t length = 0;
+        result = read_stream(handle, STREAM_TRACE, 0, data, MAX_DRAIN, &length,
+                             0);
+        if (!result) break;
+        write_trace_events(fp, data, length, &time, &previous, &first);
+        records += length / TRACE_RECORD_SIZE;
+        if (last) break;
+        sleep(100);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    free(data);
+    disconnect(handle);
+    if (result) {
+        printf("Wrote %u records to %s\n", records, filename);
+    }
+    return result;
+}
+
+// The sampling profile. See the firmware's profiler.c for the layout.
+static const uint8_t STREAM_PROFILE = 5;
+static const int PROFILE_HEADER_SIZE = 16;
+static const int PROFILE_ENTRY_SIZE = 12;
+
+bool start_profile(hid_device *handle, uint32_t rate) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_PROFILE;
+    write_word(packet + 2, rate);
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        printf("Could not %s the profiler.\n", rate ? "start" : "stop");
+        return false;
+    }
+    return true;
+}
+
+struct profile_line {
+    const char *name;
+    uint32_t count;
+};
+
+int compare_profile_lines(const void *a, const void *b) {
+    uint32_t x = ((const profile_line *)a)->count;
+    uint32_t y = ((const profile_line *)b)->count;
+    return x > y ? -1 : x < y ? 1 : 0;
+}
+
+// Gives the name of the function containing address, or the address itself in
+// name_buffer if there isn't one. Exception return values in LR mean the
+// sample was taken at the start of an interrupt handler.
+const char *symbolize(const elf_file &elf, uint32_t address,
+                      char *name_buffer) {
+    if (address >= 0xFFFFFFF0) return "[exception]";
+    const elf_symbol *f = elf_find_function(&elf, address);
+    if (f) return f->name;
+    sprintf(name_buffer, "0x%08x", address);
+    return name_buffer;
+}
+
+// Adds count to the line for name, or adds a line for it.
+void add_profile_line(profile_line *lines, int *line_count, const char *name,
+                      uint32_t count) {
+    for (int i = 0; i < *line_count; ++i) {
+        if (strcmp(lines[i].name, name) == 0) {
+            lines[i].count += count;
+            return;
+        }
+    }
+    lines[*line_count].name = strdup(name);
+    lines[*line_count].count = count;
+    ++*line_count;
+}
+
+// Samples the firmware at rate times a second for the given number of seconds
+// and prints where the time went using the symbols in elf_filename. The flat
+// profile lists functions by the samples taken in them. The folded profile has
+// a line for each caller;function pair with its samples, which is the input
+// flamegraph.pl takes.
+bool run_profile(const char *elf_filename, int seconds, uint32_t rate,
+                 bool folded) {
+    elf_file elf;
+    if (!elf_open(elf_filename, &elf)) return false;
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) {
+        elf_close(&elf);
+        return false;
+    }
+
+    static const uint32_t MAX_PROFILE_SIZE = 64 * 1024;
+    uint8_t *data = (uint8_t *)malloc(MAX_PROFILE_SIZE);
+    uint32_t length = 0;
+    bool result = start_profile(handle, rate);
+    if (result) {
+        sleep(seconds * 1000);
+        result = start_profile(handle, 0) &&
+                 read_stream(handle, STREAM_PROFILE, 0, data, MAX_PROFILE_SIZE,
+                             &length, 0);
+    }
+    disconnect(handle);
+    if (result && length < PROFILE_HEADER_SIZE) {
+        printf("Profile is too short.\n");
+        result = false;
+    }
+
+    if (result) {
+        uint32_t samples = read_word(data);
+        uint32_t dropped = read_word(data + 4);
+        int entries = (length - PROFILE_HEADER_SIZE) / PROFILE_ENTRY_SIZE;
+        profile_line *lines =
+            (profile_line *)malloc(sizeof(profile_line) * (entries + 1));
+        int line_count = 0;
+        char caller_buffer[16];
+        char callee_buffer[16];
+        char name[512];
+        for (int i = 0; i < entries; ++i) {
+            const uint8_t *entry =
+                data + PROFILE_HEADER_SIZE + i * PROFILE_ENTRY_SIZE;
+            uint32_t pc = read_word(entry);
+            uint32_t lr = read_word(entry + 4);
+            uint32_t count = read_word(entry + 8);
+            if (count == 0) continue;
+            const char *callee = symbolize(elf, pc, callee_buffer);
+            if (folded) {
+                snprintf(name, sizeof(name), "%s;%s",
+                         symbolize(elf, lr, caller_buffer), callee);
+                add_profile_line(lines, &line_count, name, count);
+            } else {
+                add_profile_line(lines, &line_count, callee, count);
+            }
+        }
+        qsort(lines, line_count, sizeof(profile_line), compare_profile_lines);
+        if (!folded) {
+            printf("%u samples at %u Hz, %u dropped\n", samples, rate,
+                   dropped);
+        }
+        for (int i = 0; i < line_count; ++i) {
+            if (folded) {
+                printf("%s %u\n", lines[i].name, lines[i].count);
+            } else {
+                printf("%6.2f%% %8u  %s\n",
+                       samples ? 100.0 * lines[i].count / samples : 0.0,
+                       lines[i].count, lines[i].name);
+            }
+            free((void *)lines[i].name);
+        }
+        free(lines);
+    }
+    free(data);
+    elf_close(&elf);
+    return result;
+}
+
+// The RAM use. See the firmware's memory.c for the layout.
+static const uint8_t STREAM_MEMORY = 6;
+static const char *MEMORY_BUFFER_NAMES[] = {
+    "unknown", "dictionary", "command queue", "SD block cache",
+};
+static const uint32_t MEMORY_BUFFER_NAME_COUNT =
+    sizeof(MEMORY_BUFFER_NAMES) / sizeof(MEMORY_BUFFER_NAMES[0]);
+
+void print_budget_line(const char *name, uint32_t size, uint32_t used) {
+    printf("%-20s %8u %8u %8u %5.1f%%\n", name, size, used, size - used,
+           size ? 100.0 * used / size : 0.0);
+}
+
+// The chatter count for each key. See the firmware's debounce.c.
+static const uint8_t STREAM_CHATTER = 8;
+static const int CHATTER_KEYS = 32;
+// These must match matrix.h.
+static const int MATRIX_COLUMNS = 7;
+static const int MATRIX_USER_BUTTON = 31;
+
+// Prints how many times each key has bounced back before its debounce time
+// was up. Keys that haven't are left out.
+bool show_chatter(void) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    uint8_t data[CHATTER_KEYS * 4];
+    uint32_t length = 0;
+    bool result = read_stream(handle, STREAM_CHATTER, 0, data, sizeof(data),
+                              &length, 0);
+    disconnect(handle);
+    if (!result) return false;
+    if (length != sizeof(data)) {
+        printf("Unexpected chatter size: %u\n", length);
+        return false;
+    }
+    int shown = 0;
+    for (int key = 0; key < CHATTER_KEYS; ++key) {
+        uint32_t count = read_word(data + key * 4);
+        if (count == 0) continue;
+        if (key == MATRIX_USER_BUTTON) {
+            printf("user button      %8u\n", count);
+        } else {
+            printf("row %d column %d   %8u\n", key / MATRIX_COLUMNS,
+                   key % MATRIX_COLUMNS, count);
+        }
+        ++shown;
+    }
+    if (shown == 0) {
+        printf("No key has chattered.\n");
+    }
+    return true;
+}
+
+// Prints how the device's RAM is used and how much is left. The stack's free
+// space is what no stack has reached since start up, which is the headroom
+// for new static buffers.
+bool show_memory(void) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    uint8_t data[1024];
+    uint32_t length = 0;
+    bool result = read_stream(handle, STREAM_MEMORY, 0, data, sizeof(data),
+                              &length, 0);
+    disconnect(handle);
+    if (!result) return false;
+    if (length < 24) {
+        printf("Memory report is too short.\n");
+        return false;
+    }
+
+    uint32_t ram = read_word(data);
+    uint32_t data_size = read_word(data + 4);
+    uint32_t bss = read_word(data + 8);
+    uint32_t stack_space = read_word(data + 12);
+    uint32_t stack_used = read_word(data + 16);
+    uint32_t buffers = read_word(data + 20);
+    if (length < 24 + buffers * 12) {
+        printf("Memory report is too short.\n");
+        return false;
+    }
+
+    printf("%-20s %8s %8s %8s %6s\n", "", "size", "used", "free", "used");
+    print_budget_line("RAM", ram, data_size + bss + stack_used);
+    print_budget_line(".data", data_size, data_size);
+    print_budget_line(".bss", bss, bss);
+    print_budget_line("stack (peak)", stack_space, stack_used);
+    if (buffers) {
+        printf("\nWatched buffers, part of .bss:\n");
+    }
+    for (uint32_t i = 0; i < buffers; ++i) {
+        const uint8_t *b = data + 24 + i * 12;
+        uint32_t id = read_word(b);
+        print_budget_line(
+            MEMORY_BUFFER_NAMES[id < MEMORY_BUFFER_NAME_COUNT ? id : 0],
+            read_word(b + 4), read_word(b + 8));
+    }
+    printf("\nHeadroom for new buffers: %u bytes\n", stack_space - stack_used);
+    return true;
+}
+
+// The deferred log. See the firmware's log.c for the layout.
+static const uint8_t STREAM_LOG = 7;
+static const uint32_t FLASH_START = 0x08000000;
+
+// Formats one message the way printf would have on the device. Each argument
+// is a 32 bit word and %s arguments are addresses of strings in the firmware.
+void format_log_message(const elf_file *elf, const char *format,
+                        const uint32_t *args, uint32_t count, char *out,
+                        size_t size) {
+    size_t n = 0;
+    uint32_t used = 0;
+    const char *f = format;
+    while (*f && n + 1 < size) {
+        if (*f != '%') {
+            out[n++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[n++] = '%';
+            f += 2;
+            continue;
+        }
+        // Copy the conversion, dropping any length modifiers since every
+        // argument is a word.
+        char spec[16];
+        size_t s = 0;
+        spec[s++] = *f++;
+        while (*f && strchr("-+ #0123456789.", *f) && s < sizeof(spec) - 3) {
+            spec[s++] = *f++;
+        }
+        while (*f && strchr("hlzjt", *f)) ++f;
+        if (!*f) break;
+        char conversion = *f++;
+        uint32_t arg = used < count ? args[used] : 0;
+        ++used;
+        int written;
+        if (conversion == 's') {
+            const char *string = elf_read_string(elf, arg);
+            spec[s++] = 's';
+            spec[s] = 0;
+            written = snprintf(out + n, size - n, spec,
+                               string ? string : "(bad string)");
+        } else {
+            spec[s++] = strchr("diucxXo", conversion) ? conversion : 'X';
+            spec[s] = 0;
+            written = snprintf(out + n, size - n, spec, arg);
+        }
+        if (written > 0) n += written;
+        if (n >= size) n = size - 1;
+    }
+    // Messages from print_arg1 and friends have no conversions, so their
+    // arguments go on the end.
+    for (uint32_t i = used; i < count && n + 1 < size; ++i) {
+        int written = snprintf(out + n, size - n, " 0x%08X", args[i]);
+        if (written > 0) n += written;
+        if (n >= size) n = size - 1;
+    }
+    // The old print() calls end their lines themselves.
+    while (n > 0 && (out[n - 1] == '\r' || out[n - 1] == '\n')) --n;
+    out[n] = 0;
+}
+
+// Prints the device's log for the given number of seconds, or forever if it's
+// zero. The device only stores the address of each format string so
+// firmware.elf has to be the build that is running on the device.
+bool show_log(const char *elf_filename, int seconds) {
+    elf_file elf;
+    if (!elf_open(elf_filename, &elf)) return false;
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) {
+        elf_close(&elf);
+        return false;
+    }
+
+    uint8_t data[4096];
+    bool result = true;
+    uint64_t end = now_ms() + seconds * 1000ULL;
+    while (seconds == 0 || now_ms() < end) {
+        uint32_t length = 0;
+        result = read_stream(handle, STREAM_LOG, 0, data, sizeof(data),
+                             &length, 0);
+        if (!result) break;
+        if (length >= 4 && read_word(data) > 0) {
+            printf("(%u messages dropped)\n", read_word(data));
+        }
+        uint32_t offset = 4;
+        while (offset + 8 <= length) {
+            uint32_t header = read_word(data + offset);
+            uint32_t millis = read_word(data + offset + 4);
+            uint32_t count = header & 3;
+            if (offset + 8 + count * 4 > length) break;
+            uint32_t args[3];
+            for (uint32_t i = 0; i < count; ++i) {
+                args[i] = read_word(data + offset + 8 + i * 4);
+            }
+            uint32_t address = FLASH_START + (header >> 2);
+            const char *format = elf_read_string(&elf, address);
+            char message[256];
+            if (format) {
+                format_log_message(&elf, format, args, count, message,
+                                   sizeof(message));
+            } else {
+                snprintf(message, sizeof(message),
+                         "(unknown format at 0x%08X)", address);
+            }
+            printf("%10u.%03u %s\n", millis / 1000, millis % 1000, message);
+            offset += 8 + count * 4;
+        }
+        fflush(stdout);
+        sleep(100);
+    }
+    disconnect(handle);
+    elf_close(&elf);
+    return result;
+}
+
+// Measures how fast the device can send over its serial port. The device is
+// asked over raw HID to send a counting pattern on the serial port, which is
+// read from tty, such as /dev/ttyACM0, and checked.
+bool serial_benchmark(const char *tty, uint32_t length) {
+#ifdef _WIN32
+    (void)tty;
+    (void)length;
+    printf("The serial benchmark isn't supported on Windows.\n");
+    return false;
+#else
+    int fd = open(tty, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        printf("Could not open %s\n", tty);
+        return false;
+    }
+    struct termios options;
+    tcgetattr(fd, &options);
+    cfmakeraw(&options);
+    // Return whatever has arrived, or nothing after a second.
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 10;
+    tcsetattr(fd, TCSANOW, &options);
+    tcflush(fd, TCIFLUSH);
+
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) {
+        close(fd);
+        return false;
+    }
+    capabilities caps;
+    if (!query_capabilities(handle, &caps) ||
+            !supports(caps, REQUEST_SERIAL_BENCHMARK)) {
+        printf("The device doesn't support the serial benchmark.\n");
+        disconnect(handle);
+        close(fd);
+        return false;
+    }
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_SERIAL_BENCHMARK;
+    write_word(packet + 2, length);
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        printf("Could not start the serial benchmark.\n");
+        disconnect(handle);
+        close(fd);
+        return false;
+    }
+
+    // The clock starts with the first byte so the request isn't counted.
+    uint8_t buffer[4096];
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    uint64_t start = 0;
+    while (received < length) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break;
+        if (received == 0) start = now_ms();
+        for (ssize_t i = 0; i < n; ++i) {
+            if (buffer[i] != (uint8_t)(received + i)) ++errors;
+        }
+        received += n;
+    }
+    uint64_t elapsed = now_ms() - start;
+    disconnect(handle);
+    close(fd);
+
+    printf("Received %u of %u bytes in %llu ms", received, length,
+           (unsigned long long)elapsed);
+    if (elapsed > 0) {
+        printf(", %.1f KB/s", received / 1024.0 / (elapsed / 1000.0));
+    }
+    printf("\n");
+    if (errors) {
+        printf("%u bytes didn't match the pattern.\n", errors);
+    }
+    return received == length && errors == 0;
+#endif
+}
+
+struct matrix_status {
+    uint32_t rate;
+    uint32_t scans;
+    uint32_t cycles;
+};
+
+// Sends REQUEST_MATRIX with the given rate, or zero to leave it alone.
+bool matrix_request(hid_device *handle, uint32_t rate, matrix_status *status) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_MATRIX;
+    write_word(packet + 2, rate);
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        return false;
+    }
+    status->rate = read_word(packet + 3);
+    status->scans = read_word(packet + 7);
+    status->cycles = read_word(packet + 11);
+    return true;
+}
+
+// Sets the key matrix scan rate if rate isn't zero, then measures the real
+// scan rate and the share of the CPU that scanning takes over a second.
+bool show_matrix(uint32_t rate) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    if (!query_capabilities(handle, &caps) ||
+            !supports(caps, REQUEST_MATRIX)) {
+        printf("The device doesn't have a key matrix scanner.\n");
+        disconnect(handle);
+        return false;
+    }
+    matrix_status before, after;
+    if (!matrix_request(handle, rate, &before)) {
+        printf("Could not set the scan rate.\n");
+        disconnect(handle);
+        return false;
+    }
+    uint64_t start = now_ms();
+    sleep(1000);
+    bool result = matrix_request(handle, 0, &after);
+    double seconds = (now_ms() - start) / 1000.0;
+    disconnect(handle);
+    if (!result) {
+        printf("Could not read the scanner status.\n");
+        return false;
+    }
+    uint32_t scans = after.scans - before.scans;
+    uint32_t cycles = after.cycles - before.cycles;
+    printf("Scan rate:  %u scans/s set, %.0f scans/s measured\n", after.rate,
+           scans / seconds);
+    printf("CPU cost:   %.3f%%", cycles / CYCLES_PER_US / 1e4 / seconds);
+    if (scans) {
+        printf(", %.0f cycles per scan", (double)cycles / scans);
+    }
+    printf("\n");
+    return true;
+}
+
+// The chord engine's mode bits. See the firmware's chord.h.
+static const uint8_t CHORD_FIRST_UP = 1;
+static const uint8_t CHORD_REPEAT = 2;
+
+// Chooses when the device sends a stroke: "all-up" once every key is
+// released, or "first-up" as soon as one is. With repeat, a held stroke is
+// sent again and again.
+bool set_chord_mode(const char *name, bool repeat) {
+    uint8_t mode;
+    if (strcmp(name, "all-up") == 0) {
+        mode = 0;
+    } else if (strcmp(name, "first-up") == 0) {
+        mode = CHORD_FIRST_UP;
+    } else {
+        printf("Unknown chord mode: %s\n", name);
+        return false;
+    }
+    if (repeat) mode |= CHORD_REPEAT;
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    bool result = query_capabilities(handle, &caps) &&
+                  supports(caps, REQUEST_CHORD_MODE);
+    if (!result) {
+        printf("The device doesn't support chord modes.\n");
+    } else {
+        uint8_t packet[PACKET_SIZE];
+        memset(packet, 0, PACKET_SIZE);
+        packet[0] = REQUEST_CHORD_MODE;
+        packet[2] = mode;
+        result = send_receive_tagged(handle, packet, 5 * 1000);
+        if (!result) printf("Could not set the chord mode.\n");
+    }
+    disconnect(handle);
+    return result;
+}
+
+// The outputs that strokes go to, in the order of the firmware's
+// CHORD_OUTPUT_* values.
+static const char *STROKE_OUTPUTS[] = {"keyboard", "serial", "plover-hid",
+                                       "events"};
+
+// Chooses the outputs that strokes go to from a comma separated list of
+// STROKE_OUTPUTS, or "none".
+bool set_stroke_outputs(const char *list) {
+    uint8_t outputs = 0;
+    int count = sizeof(STROKE_OUTPUTS) / sizeof(STROKE_OUTPUTS[0]);
+    if (strcmp(list, "none") != 0) {
+        const char *name = list;
+        while (true) {
+            size_t length = strcspn(name, ",");
+            int output = 0;
+            while (output < count &&
+                   (strlen(STROKE_OUTPUTS[output]) != length ||
+                    strncmp(name, STROKE_OUTPUTS[output], length) != 0)) {
+                ++output;
+            }
+            if (output == count) {
+                printf("Unknown stroke output: %.*s\n", (int)length, name);
+                return false;
+            }
+            outputs |= 1 << output;
+            if (name[length] == 0) break;
+            name += length + 1;
+        }
+    }
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    bool result = query_capabilities(handle, &caps) &&
+                  supports(caps, REQUEST_STROKE_OUTPUTS);
+    if (!result) {
+        printf("The device doesn't support choosing stroke outputs.\n");
+    } else {
+        uint8_t packet[PACKET_SIZE];
+        memset(packet, 0, PACKET_SIZE);
+        packet[0] = REQUEST_STROKE_OUTPUTS;
+        packet[2] = outputs;
+        result = send_receive_tagged(handle, packet, 5 * 1000);
+        if (!result) printf("Could not set the stroke outputs.\n");
+    }
+    disconnect(handle);
+    return result;
+}
+
+// The serial protocols. See the firmware's encoder.h.
+static const char *SERIAL_PROTOCOLS[] = {"txbolt", "gemini"};
+
+// Chooses the protocol that strokes are sent in over the serial port.
+bool set_serial_protocol(const char *name) {
+    int protocol = 0;
+    int count = sizeof(SERIAL_PROTOCOLS) / sizeof(SERIAL_PROTOCOLS[0]);
+    while (protocol < count && strcmp(name, SERIAL_PROTOCOLS[protocol]) != 0) {
+        ++protocol;
+    }
+    if (protocol == count) {
+        printf("Unknown serial protocol: %s\n", name);
+        return false;
+    }
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    bool result = query_capabilities(handle, &caps) &&
+                  supports(caps, REQUEST_SERIAL_PROTOCOL);
+    if (!result) {
+        printf("The device doesn't support choosing the serial protocol.\n");
+    } else {
+        uint8_t packet[PACKET_SIZE];
+        memset(packet, 0, PACKET_SIZE);
+        packet[0] = REQUEST_SERIAL_PROTOCOL;
+        packet[2] = protocol;
+        result = send_receive_tagged(handle, packet, 5 * 1000);
+        if (!result) printf("Could not set the serial protocol.\n");
+    }
+    disconnect(handle);
+    return result;
+}
+
+// Sets how long the device holds a partial serial packet for more bytes.
+bool set_serial_flush(uint32_t ms) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    capabilities caps;
+    bool result = query_capabilities(handle, &caps) &&
+                  supports(caps, REQUEST_SERIAL_FLUSH);
+    if (!result) {
+        printf("The device doesn't support setting the serial flush delay.\n");
+    } else {
+        uint8_t packet[PACKET_SIZE];
+        memset(packet, 0, PACKET_SIZE);
+        packet[0] = REQUEST_SERIAL_FLUSH;
+        write_word(packet + 2, ms);
+        result = send_receive_tagged(handle, packet, 5 * 1000);
+        if (!result) printf("Could not set the serial flush delay.\n");
+    }
+    disconnect(handle);
+    return result;
+}
+
+// Writes a stroke in steno order, like "STKPWHR-FRPBLG", into text, which
+// must have room for STENO_KEY_COUNT + 2 characters.
+static void stroke_to_text(uint32_t stroke, char *text) {
+    bool middle = false;
+    bool right = false;
+#define KEY_TEXT(name, label, bit, ...) \
+    if (stroke_has(stroke, bit)) { \
+        if (label[0] == '-') { \
+            if (!middle && !right) *text++ = '-'; \
+            right = true; \
+            *text++ = label[1]; \
+        } else { \
+            middle |= label[1] != '-' && label[0] != '#'; \
+            *text++ = label[0]; \
+        } \
+    }
+    STENO_LAYOUT(KEY_TEXT)
+#undef KEY_TEXT
+    *text = 0;
+}
+
+#ifndef _WIN32
+// Finds the hidraw device of the device's Plover HID interface by its report
+// descriptor, which starts with the usage page and usage that Plover looks
+// for.
+static bool find_plover_hidraw(char *path, size_t size) {
+    static const uint8_t PLOVER_USAGE[] = {0x06, 0x50, 0xFF, 0x0A, 0x56, 0x4C};
+    DIR *dir = opendir("/sys/class/hidraw");
+    if (dir == NULL) return false;
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "hidraw", 6) != 0) continue;
+        char sysfs_path[512];
+        snprintf(sysfs_path, sizeof(sysfs_path),
+                 "/sys/class/hidraw/%s/device/uevent", entry->d_name);
+        FILE *fp = fopen(sysfs_path, "r");
+        if (fp == NULL) continue;
+        char line[256];
+        unsigned int bus, vendor = 0, product;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product);
+        }
+        fclose(fp);
+        if ((int)vendor != STENOSAURUS_VID) continue;
+        snprintf(sysfs_path, sizeof(sysfs_path),
+                 "/sys/class/hidraw/%s/device/report_descriptor",
+                 entry->d_name);
+        fp = fopen(sysfs_path, "rb");
+        if (fp == NULL) continue;
+        uint8_t descriptor[sizeof(PLOVER_USAGE)];
+        size_t length = fread(descriptor, 1, sizeof(descriptor), fp);
+        if (length == sizeof(descriptor) &&
+            memcmp(descriptor, PLOVER_USAGE, sizeof(descriptor)) == 0) {
+            snprintf(path, size, "/dev/%s", entry->d_name);
+            found = true;
+        }
+        fclose(fp);
+    }
+    closedir(dir);
+    return found;
+}
+
+// Opens the device's Plover HID interface. Returns -1 if it can't.
+static int open_plover_hid(void) {
+    char path[256];
+    if (!find_plover_hidraw(path, sizeof(path))) {
+        printf("Could not find the Plover HID interface.\n");
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) printf("Could not open %s\n", path);
+    return fd;
+}
+
+// Opens tty, such as /dev/ttyACM0, for reading strokes. Returns -1 if it
+// can't.
+static int open_stroke_tty(const char *tty) {
+    int fd = open(tty, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        printf("Could not open %s\n", tty);
+        return -1;
+    }
+    struct termios options;
+    tcgetattr(fd, &options);
+    cfmakeraw(&options);
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &options);
+    tcflush(fd, TCIFLUSH);
+    return fd;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+// Prints the strokes that the device sends. source is either a tty, such as
+// /dev/ttyACM0, to read the serial port in the given protocol, or "hid" to
+// read the Plover HID interface.
+bool show_strokes(const char *source, const char *protocol_name) {
+#ifdef _WIN32
+    (void)source;
+    (void)protocol_name;
+    printf("Reading strokes isn't supported on Windows.\n");
+    return false;
+#else
+    int protocol = 0;
+    int count = sizeof(SERIAL_PROTOCOLS) / sizeof(SERIAL_PROTOCOLS[0]);
+    while (protocol < count &&
+           strcmp(protocol_name, SERIAL_PROTOCOLS[protocol]) != 0) {
+        ++protocol;
+    }
+    if (protocol == count) {
+        printf("Unknown serial protocol: %s\n", protocol_name);
+        return false;
+    }
+    bool hid = strcmp(source, "hid") == 0;
+    if (hid) protocol = DECODER_PLOVER_HID;
+    int fd = hid ? open_plover_hid() : open_stroke_tty(source);
+    if (fd < 0) return false;
+
+    steno_decoder decoder;
+    decoder_init(&decoder, protocol);
+    uint32_t errors = 0;
+    uint8_t buffer[4096];
+    uint32_t strokes[64];
+    while (true) {
+        // A read from hidraw gives one whole report.
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break;
+        uint32_t decoded = 0;
+        for (uint32_t offset = 0; offset < (uint32_t)n;) {
+            uint32_t used = n - offset;
+            if (hid) {
+                decoded = decoder_plover_hid(&decoder, buffer, n, strokes);
+            } else {
+                decoded = decoder_decode(&decoder, buffer + offset,
+                                         n - offset, strokes, 64, &used);
+            }
+            offset += used;
+            for (uint32_t i = 0; i < decoded; ++i) {
+                char text[STENO_KEY_COUNT + 2];
+                stroke_to_text(strokes[i], text);
+                printf("%s\n", text);
+            }
+        }
+        if (decoder.errors != errors) {
+            printf("(%u bytes didn't fit the protocol)\n",
+                   decoder.errors - errors);
+            errors = decoder.errors;
+        }
+        fflush(stdout);
+    }
+    close(fd);
+    return true;
+#endif
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Compares how soon strokes reach the host over the Plover HID interface and
+// as TX Bolt over the serial port, read from tty. Both are sent for every
+// stroke at the same time, so the difference in when they arrive is the
+// difference in latency between the two paths, including the host's drivers.
+bool steno_latency(const char *tty, int count) {
+#ifdef _WIN32
+    (void)tty;
+    (void)count;
+    printf("Measuring stroke latency isn't supported on Windows.\n");
+    return false;
+#else
+    int serial_fd = open_stroke_tty(tty);
+    if (serial_fd < 0) return false;
+    int hid_fd = open_plover_hid();
+    if (hid_fd < 0) {
+        close(serial_fd);
+        return false;
+    }
+    printf("Write %d strokes. The serial port must be sending TX Bolt.\n",
+           count);
+
+    steno_decoder serial_decoder, hid_decoder;
+    decoder_init(&serial_decoder, DECODER_TXBOLT);
+    decoder_init(&hid_decoder, DECODER_PLOVER_HID);
+    // Strokes from each path that haven't been matched with the other yet.
+    static const int PENDING = 64;
+    uint32_t serial_strokes[PENDING], hid_strokes[PENDING];
+    uint64_t serial_times[PENDING], hid_times[PENDING];
+    int serial_count = 0, hid_count = 0;
+    // How much later each stroke came over the serial port than over HID.
+    int64_t *lags = (int64_t *)malloc(sizeof(int64_t) * count);
+    int matched = 0, mismatched = 0;
+    while (matched < count) {
+        struct pollfd fds[2] = {{serial_fd, POLLIN, 0}, {hid_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) <= 0) break;
+        uint64_t now = now_us();
+        uint8_t buffer[256];
+        if (fds[0].revents & POLLIN) {
+            ssize_t n = read(serial_fd, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            for (uint32_t offset = 0;
+                 offset < (uint32_t)n && serial_count < PENDING;) {
+                uint32_t used;
+                uint32_t decoded = decoder_decode(
+                    &serial_decoder, buffer + offset, n - offset,
+                    serial_strokes + serial_count, PENDING - serial_count,
+                    &used);
+                for (uint32_t i = 0; i < decoded; ++i) {
+                    serial_times[serial_count++] = now;
+                }
+                offset += used;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t n = read(hid_fd, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            if (hid_count < PENDING &&
+                decoder_plover_hid(&hid_decoder, buffer, n,
+                                   hid_strokes + hid_count)) {
+                hid_times[hid_count++] = now;
+            }
+        }
+        int pairs = serial_count < hid_count ? serial_count : hid_count;
+        for (int i = 0; i < pairs && matched < count; ++i) {
+            char text[STENO_KEY_COUNT + 2];
+            stroke_to_text(hid_strokes[i], text);
+            if (serial_strokes[i] != hid_strokes[i]) {
+                ++mismatched;
+                printf("%-24s differs between the two paths\n", text);
+                continue;
+            }
+            int64_t lag = (int64_t)(serial_times[i] - hid_times[i]);
+            lags[matched++] = lag;
+            printf("%-24s serial %+8.3f ms after HID\n", text, lag / 1000.0);
+        }
+        memmove(serial_strokes, serial_strokes + pairs,
+                (serial_count - pairs) * sizeof(uint32_t));
+        memmove(serial_times, serial_times + pairs,
+                (serial_count - pairs) * sizeof(uint64_t));
+        memmove(hid_strokes, hid_strokes + pairs,
+                (hid_count - pairs) * sizeof(uint32_t));
+        memmove(hid_times, hid_times + pairs,
+                (hid_count - pairs) * sizeof(uint64_t));
+        serial_count -= pairs;
+        hid_count -= pairs;
+        fflush(stdout);
+    }
+    close(serial_fd);
+    close(hid_fd);
+
+    if (matched > 0) {
+        qsort(lags, matched, sizeof(int64_t), compare_int64);
+        int64_t total = 0;
+        for (int i = 0; i < matched; ++i) total += lags[i];
+        printf("\n%d strokes: serial after HID by %.3f ms on average, "
+               "%.3f ms median, %.3f to %.3f ms\n", matched,
+               total / 1000.0 / matched, lags[matched / 2] / 1000.0,
+               lags[0] / 1000.0, lags[matched - 1] / 1000.0);
+    }
+    if (mismatched > 0) {
+        printf("%d strokes didn't match between the two paths.\n",
+               mismatched);
+    }
+    free(lags);
+    return matched == count && mismatched == 0;
+#endif
+}
+
 bool flash_program(const char  * const filename) {
     int res;
     hid_device *handle;
@@ -370,6 +2282,182 @@ bool flash_program(const char  * const filename) {
 #undef PROGRAM_MEMORY_SIZE
 }
 
+bool sd_init(hid_device *handle) {
+    uint8_t packet[PACKET_SIZE];
+    memset(packet, 0, PACKET_SIZE);
+    packet[0] = REQUEST_SD_INIT;
+    if (!send_receive_tagged(handle, packet, 5 * 1000)) {
+        printf("Could not initialize the SD card.\n");
+        return false;
+    }
+    uint32_t blocks = read_word(packet + 3);
+    printf("SD card has %u blocks (%u MB).\n", blocks, blocks / 2048);
+    return true;
+}
+
+static const int SD_BLOCK_SIZE = 512;
+static const int SD_SLICE_SIZE = PACKET_SIZE - 3;
+
+// Asks for one slice of a block without waiting for the answer.
+bool send_sd_read(hid_device *handle, uint32_t block, int slice,
+                  uint8_t *tag) {
+    int offset = slice * SD_SLICE_SIZE;
+    int length = SD_BLOCK_SIZE - offset;
+    if (length > SD_SLICE_SIZE) length = SD_SLICE_SIZE;
+    uint8_t buf[PACKET_SIZE + 1];
+    memset(buf, 0, sizeof(buf));
+    *tag = next_tag();
+    buf[1] = REQUEST_SD_READ;
+    buf[2] = *tag;
+    write_word(buf + 3, block);
+    buf[7] = offset & 0xFF;
+    buf[8] = offset >> 8;
+    buf[9] = length;
+    if (hid_write(handle, buf, PACKET_SIZE + 1) < 0) {
+        printf("Failed to send.\n");
+        return false;
+    }
+    return true;
+}
+
+// A block doesn't fit in a packet so it is read in slices. Up to batch slice
+// requests are kept queued on the device so it can work on the next one while
+// the previous answer is on its way back.
+bool sd_read_block(hid_device *handle, uint32_t block, uint8_t *data,
+                   uint8_t batch) {
+    static const int SLICES = (SD_BLOCK_SIZE + SD_SLICE_SIZE - 1) /
+                              SD_SLICE_SIZE;
+    uint8_t tags[SLICES];
+    bool done[SLICES];
+    memset(done, 0, sizeof(done));
+    int next = 0;
+    int in_flight = 0;
+    int finished = 0;
+    uint8_t packet[PACKET_SIZE];
+    while (finished < SLICES) {
+        while (next < SLICES && in_flight < batch) {
+            if (!send_sd_read(handle, block, next, &tags[next])) return false;
+            ++next;
+            ++in_flight;
+        }
+        if (receive(handle, packet, 5 * 1000) <= 0) {
+            printf("failed to receive.\n");
+            return false;
+        }
+        if (packet[1] != REQUEST_SD_READ) continue;
+        int slice = 0;
+        while (slice < next && (done[slice] || tags[slice] != packet[2])) {
+            ++slice;
+        }
+        if (slice == next) continue;
+
+        if (packet[0] == RESPONSE_OK) {
+            int offset = slice * SD_SLICE_SIZE;
+            int length = SD_BLOCK_SIZE - offset;
+            if (length > SD_SLICE_SIZE) length = SD_SLICE_SIZE;
+            memcpy(data + offset, packet + 3, length);
+            done[slice] = true;
+            ++finished;
+            --in_flight;
+        } else if (packet[0] == RESPONSE_BUSY) {
+            // Something else is using the queue. Give it a moment.
+            sleep(10);
+            if (!send_sd_read(handle, block, slice, &tags[slice])) {
+                return false;
+            }
+        } else if (packet[0] != RESPONSE_PENDING) {
+            printf("Could not read block %u at offset %d.\n", block,
+                   slice * SD_SLICE_SIZE);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The event types in unsolicited reports. See the firmware's events.h.
+static const uint8_t EVENT_STROKE = 1;
+static const uint8_t EVENT_SD_INSERTED = 2;
+static const uint8_t EVENT_SD_REMOVED = 3;
+static const uint8_t EVENT_OVERFLOW = 4;
+// The buffers in EVENT_OVERFLOW, from 1. See the firmware's events.h.
+static const char *OVERFLOW_BUFFERS[] = {"command queue", "serial port",
+                                         "key events", "strokes",
+                                         "Plover HID"};
+static const uint8_t EVENT_THRESHOLD = 5;
+static const uint8_t EVENT_STROKE_PRESS = 6;
+static const uint8_t EVENT_STROKE_RELEASE = 7;
+
+// Prints the events in an unsolicited report, which is laid out as
+// [RESPONSE_UNSOLICITED] [count] [dropped] [type, argument (4 bytes)]...
+void print_events(const uint8_t *report) {
+    static const int MAX_EVENTS = (PACKET_SIZE - 3) / 5;
+    int count = report[1];
+    if (count > MAX_EVENTS) count = MAX_EVENTS;
+    unsigned long long ms = now_ms();
+    // The press time of the last stroke, for how long it was held.
+    static uint32_t press_cycles;
+    if (report[2] != 0) {
+        printf("%llu: %u events were dropped\n", ms, report[2]);
+    }
+    for (int i = 0; i < count; ++i) {
+        const uint8_t *event = report + 3 + i * 5;
+        uint32_t argument = read_word(event + 1);
+        if (event[0] == EVENT_STROKE) {
+            printf("%llu: stroke %06x\n", ms, argument);
+        } else if (event[0] == EVENT_SD_INSERTED) {
+            printf("%llu: SD card inserted\n", ms);
+        } else if (event[0] == EVENT_SD_REMOVED) {
+            printf("%llu: SD card removed\n", ms);
+        } else if (event[0] == EVENT_OVERFLOW) {
+            uint32_t buffers =
+                sizeof(OVERFLOW_BUFFERS) / sizeof(OVERFLOW_BUFFERS[0]);
+            if (argument >= 1 && argument <= buffers) {
+                printf("%llu: the %s buffer overflowed\n", ms,
+                       OVERFLOW_BUFFERS[argument - 1]);
+            } else {
+                printf("%llu: buffer %u overflowed\n", ms, argument);
+            }
+        } else if (event[0] == EVENT_THRESHOLD) {
+            printf("%llu: counter %u crossed its threshold\n", ms, argument);
+        } else if (event[0] == EVENT_STROKE_PRESS) {
+            press_cycles = argument;
+            printf("%llu: first key down at cycle %u\n", ms, argument);
+        } else if (event[0] == EVENT_STROKE_RELEASE) {
+            printf("%llu: sent at cycle %u, %.1f us after the first key\n", ms,
+                   argument,
+                   (uint32_t)(argument - press_cycles) / CYCLES_PER_US);
+        } else {
+            printf("%llu: unknown event %u (%u)\n", ms, event[0], argument);
+        }
+    }
+    fflush(stdout);
+}
+
+// Prints events as they arrive for the given number of seconds, or forever if
+// it's zero.
+bool watch_events(int seconds) {
+    hid_device *handle = enter_device_mode(false);
+    if (handle == 0) return false;
+    set_event_handler(print_events);
+    uint64_t end = now_ms() + seconds * 1000ULL;
+    while (seconds == 0 || now_ms() < end) {
+        sleep(100);
+    }
+    set_event_handler(0);
+    disconnect(handle);
+    return true;
+}
+
+void print_hex_dump(const uint8_t *data, int length) {
+    for (int i = 0; i < length; i += 16) {
+        printf("%04x:", i);
+        for (int j = i; j < i + 16 && j < length; ++j) {
+            printf(" %02x", data[j]);
+        }
+        printf("\n");
+    }
+}
+
 int main(int argc, char* argv[])
 {
     UNUSED(argc);
@@ -410,8 +2498,115 @@ int main(int argc, char* argv[])
                 printf("Debug command failed.\n");
             }
         }
+    } else if (argc == 2 && strcmp(argv[1], "sd-init") == 0) {
+        hid_device *handle = enter_device_mode(false);
+        if (handle != 0) {
+            result = sd_init(handle) ? 0 : -1;
+            disconnect(handle);
+        }
+    } else if (argc == 3 && strcmp(argv[1], "sd-read") == 0) {
+        hid_device *handle = enter_device_mode(false);
+        if (handle != 0) {
+            capabilities caps;
+            uint8_t data[SD_BLOCK_SIZE];
+            if (query_capabilities(handle, &caps) &&
+                    sd_read_block(handle, strtoul(argv[2], NULL, 0), data,
+                                  choose_transport(caps).batch)) {
+                print_hex_dump(data, sizeof(data));
+                result = 0;
+            }
+            disconnect(handle);
+        }
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "events") == 0) {
+        result = watch_events(argc == 3 ? atoi(argv[2]) : 0) ? 0 : -1;
+    } else if ((argc == 2 || (argc == 3 && strcmp(argv[2], "--watch") == 0)) &&
+               strcmp(argv[1], "stats") == 0) {
+        result = show_stats(argc == 3) ? 0 : -1;
+    } else if ((argc == 2 || (argc == 3 && strcmp(argv[2], "--reset") == 0)) &&
+               strcmp(argv[1], "latency") == 0) {
+        result = show_latency(argc == 3) ? 0 : -1;
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "trace") == 0) {
+        int seconds = argc == 4 ? atoi(argv[3]) : 5;
+        result = record_trace(argv[2], seconds) ? 0 : -1;
+    } else if (argc >= 3 && argc <= 6 && strcmp(argv[1], "profile") == 0) {
+        bool folded = strcmp(argv[argc - 1], "--folded") == 0;
+        int args = folded ? argc - 1 : argc;
+        int seconds = args > 3 ? atoi(argv[3]) : 10;
+        uint32_t rate = args > 4 ? strtoul(argv[4], NULL, 0) : 1000;
+        result = run_profile(argv[2], seconds, rate, folded) ? 0 : -1;
+    } else if (argc == 2 && strcmp(argv[1], "memory") == 0) {
+        result = show_memory() ? 0 : -1;
+    } else if (argc == 2 && strcmp(argv[1], "chatter") == 0) {
+        result = show_chatter() ? 0 : -1;
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "log") == 0) {
+        result = show_log(argv[2], argc == 4 ? atoi(argv[3]) : 0) ? 0 : -1;
+    } else if ((argc == 3 || argc == 4) &&
+               strcmp(argv[1], "serial-benchmark") == 0) {
+        uint32_t kilobytes = argc == 4 ? strtoul(argv[3], NULL, 0) : 1024;
+        result = serial_benchmark(argv[2], kilobytes * 1024) ? 0 : -1;
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "matrix") == 0) {
+        uint32_t rate = argc == 3 ? strtoul(argv[2], NULL, 0) : 0;
+        result = show_matrix(rate) ? 0 : -1;
+    } else if ((argc == 3 || (argc == 4 && strcmp(argv[3], "repeat") == 0)) &&
+               strcmp(argv[1], "chord-mode") == 0) {
+        result = set_chord_mode(argv[2], argc == 4) ? 0 : -1;
+    } else if (argc == 3 && strcmp(argv[1], "stroke-outputs") == 0) {
+        result = set_stroke_outputs(argv[2]) ? 0 : -1;
+    } else if (argc == 3 && strcmp(argv[1], "serial-protocol") == 0) {
+        result = set_serial_protocol(argv[2]) ? 0 : -1;
+    } else if (argc == 3 && strcmp(argv[1], "serial-flush") == 0) {
+        result = set_serial_flush(strtoul(argv[2], NULL, 0)) ? 0 : -1;
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "strokes") == 0) {
+        result = show_strokes(argv[2], argc == 4 ? argv[3] : "txbolt") ? 0 : -1;
+    } else if ((argc == 3 || argc == 4) &&
+               strcmp(argv[1], "steno-latency") == 0) {
+        int strokes = argc == 4 ? atoi(argv[3]) : 20;
+        if (strokes < 1) strokes = 1;
+        result = steno_latency(argv[2], strokes) ? 0 : -1;
+    } else if (argc == 4 && strcmp(argv[1], "threshold") == 0) {
+        result = set_threshold(argv[2], strtoul(argv[3], NULL, 0)) ? 0 : -1;
+    } else if (argc == 2 && strcmp(argv[1], "info") == 0) {
+        hid_device *handle = enter_device_mode(false);
+        if (handle != 0) {
+            capabilities caps;
+            if (query_capabilities(handle, &caps)) {
+                print_capabilities(caps);
+                result = 0;
+            }
+            disconnect(handle);
+        }
+    } else if (argc == 4 && strcmp(argv[1], "read-stream") == 0) {
+        result = read_stream_to_file(argv[2], argv[3]) ? 0 : -1;
+    } else if ((argc == 4 || argc == 5) &&
+               strcmp(argv[1], "write-stream") == 0) {
+        uint32_t offset = argc == 5 ? strtoul(argv[4], NULL, 0) : 0;
+        result = write_stream_from_file(argv[2], argv[3], offset) ? 0 : -1;
     } else {
         printf("Usage: %s flash <path/to/program.bin>\n", argv[0]);
+        printf("       %s info\n", argv[0]);
+        printf("       %s events [seconds]\n", argv[0]);
+        printf("       %s stats [--watch]\n", argv[0]);
+        printf("       %s threshold <counter> <value>\n", argv[0]);
+        printf("       %s latency [--reset]\n", argv[0]);
+        printf("       %s trace <file.json> [seconds]\n", argv[0]);
+        printf("       %s memory\n", argv[0]);
+        printf("       %s log <firmware.elf> [seconds]\n", argv[0]);
+        printf("       %s serial-benchmark <tty> [kilobytes]\n", argv[0]);
+        printf("       %s matrix [scans per second]\n", argv[0]);
+        printf("       %s chatter\n", argv[0]);
+        printf("       %s chord-mode <all-up|first-up> [repeat]\n", argv[0]);
+        printf("       %s stroke-outputs <keyboard,serial,plover-hid,events|"
+               "none>\n", argv[0]);
+        printf("       %s serial-protocol <txbolt|gemini>\n", argv[0]);
+        printf("       %s serial-flush <milliseconds>\n", argv[0]);
+        printf("       %s strokes <tty|hid> [txbolt|gemini]\n", argv[0]);
+        printf("       %s steno-latency <tty> [strokes]\n", argv[0]);
+        printf("       %s profile <firmware.elf> [seconds [rate]] [--folded]\n",
+               argv[0]);
+        printf("       %s sd-init\n", argv[0]);
+        printf("       %s sd-read <block>\n", argv[0]);
+        printf("       %s read-stream <stream> <file>\n", argv[0]);
+        printf("       %s write-stream <stream> <file> [offset]\n", argv[0]);
         result = -1;
     }
 
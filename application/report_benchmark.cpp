@@ -0,0 +1,162 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This program measures what it costs to go from a key change to a boot
+// protocol report ready to send, with the firmware's key_report.c against the
+// bitmap scan that it replaced. It also checks that every boot report it makes
+// has the keys that are down.
+//
+// Usage: report-benchmark [events]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+#include "../firmware/key_report.h"
+}
+
+// The old way: only the bitmap is kept and the boot report is made from it on
+// every send. This is the old scan with its rollover bug fixed so that the
+// results can be compared.
+static uint8_t scan_bitmap[32];
+static boot_report scan_report;
+
+static void scan_key(uint8_t keycode, bool down) {
+    uint8_t *byte = keycode >= 0xE0 && keycode <= 0xE7 ?
+        &scan_bitmap[0] : &scan_bitmap[keycode / 8 + 1];
+    uint8_t mask = 1 << (keycode % 8);
+    *byte = down ? *byte | mask : *byte & ~mask;
+}
+
+static void scan_build(void) {
+    int nkeys = 0;
+    scan_report.modifiers = scan_bitmap[0];
+    memset(scan_report.keys, 0, sizeof(scan_report.keys));
+    for (int i = 1; i < 32; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            if ((scan_bitmap[i] >> j) & 1) {
+                if (nkeys == 6) {
+                    memset(scan_report.keys, 1, sizeof(scan_report.keys));
+                    return;
+                }
+                scan_report.keys[nkeys++] = (i - 1) * 8 + j;
+            }
+        }
+    }
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Events look like steno strokes: a handful of letter keys go down, sometimes
+// with shift, then they all come up.
+struct event {
+    uint8_t keycode;
+    bool down;
+};
+
+static int make_events(event *events, int count) {
+    int n = 0;
+    while (n < count - 20) {
+        int keys = 1 + rand() % 8;
+        uint8_t down[9];
+        int ndown = 0;
+        if (rand() % 4 == 0) down[ndown++] = 0xE1;
+        for (int i = 0; i < keys; ++i) {
+            uint8_t keycode = 4 + rand() % 26;
+            bool seen = false;
+            for (int j = 0; j < ndown; ++j) seen |= down[j] == keycode;
+            if (!seen) down[ndown++] = keycode;
+        }
+        for (int i = 0; i < ndown; ++i) events[n++] = {down[i], true};
+        for (int i = 0; i < ndown; ++i) events[n++] = {down[i], false};
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (count < 100) count = 100;
+    event *events = new event[count];
+    count = make_events(events, count);
+
+    // Check the boot reports before timing anything.
+    key_report_clear();
+    for (int i = 0; i < count; ++i) {
+        if (events[i].down) {
+            key_report_down(events[i].keycode);
+        } else {
+            key_report_up(events[i].keycode);
+        }
+        scan_key(events[i].keycode, events[i].down);
+        scan_build();
+        uint8_t a[6], b[6];
+        memcpy(a, boot_key_report.keys, 6);
+        memcpy(b, scan_report.keys, 6);
+        // The scan gives keys in keycode order and key_report.c in the order
+        // they were pressed, so compare them sorted.
+        for (int x = 0; x < 6; ++x) {
+            for (int y = x + 1; y < 6; ++y) {
+                if (a[y] < a[x]) { uint8_t t = a[x]; a[x] = a[y]; a[y] = t; }
+                if (b[y] < b[x]) { uint8_t t = b[x]; b[x] = b[y]; b[y] = t; }
+            }
+        }
+        if (memcmp(a, b, 6) != 0 ||
+            boot_key_report.modifiers != scan_report.modifiers ||
+            memcmp(nkro_key_report + 1, scan_bitmap + 1, 31) != 0) {
+            fprintf(stderr, "Reports differ after event %d\n", i);
+            return 1;
+        }
+    }
+
+    uint8_t sink[8];
+    uint32_t check = 0;
+    double start = seconds();
+    for (int i = 0; i < count; ++i) {
+        scan_key(events[i].keycode, events[i].down);
+        scan_build();
+        memcpy(sink, &scan_report, sizeof(sink));
+        check += sink[2];
+    }
+    double scan_time = seconds() - start;
+
+    start = seconds();
+    for (int i = 0; i < count; ++i) {
+        if (events[i].down) {
+            key_report_down(events[i].keycode);
+        } else {
+            key_report_up(events[i].keycode);
+        }
+        memcpy(sink, &boot_key_report, sizeof(sink));
+        check += sink[2];
+    }
+    double incremental_time = seconds() - start;
+
+    printf("%d events\n", count);
+    printf("bitmap scan:  %6.1f ns per event\n", scan_time * 1e9 / count);
+    printf("incremental:  %6.1f ns per event\n",
+           incremental_time * 1e9 / count);
+    // Keeps the loops from being optimized away.
+    if (check == 1) printf("\n");
+    delete[] events;
+    return 0;
+}
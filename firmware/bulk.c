@@ -0,0 +1,356 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the bulk channel. See the header file for interface
+// documentation to this code.
+//
+// Each frame is a payload followed by the crc32.h CRC of the payload (4 bytes,
+// little endian), all encoded with Consistent Overhead Byte Stuffing and
+// between zero bytes. COBS removes every zero from the encoded bytes, so a
+// receiver that loses its place only has to wait for the next zero. The zero
+// at the start also separates frames from any TX Bolt output before them.
+// Frames with a bad CRC or that are too long are dropped.
+//
+// The payloads are [type] [tag] [...]. The tag is chosen by the host and
+// copied into everything sent back for that transfer. Numbers are little
+// endian and statuses are the RESPONSE_* values from protocol.c.
+//
+// Reading (device to host):
+// Host:   [BULK_READ] [tag] [stream] [offset (4 bytes)] [max length (4 bytes)]
+// Device: [BULK_READ] [tag] [status] [length (4 bytes)]
+// Then:   [BULK_DATA] [tag] [offset from the start (4 bytes)] [data...]
+//         as many times as needed, each with up to BULK_DATA_SIZE bytes.
+// Then:   [BULK_END] [tag] [status] [crc (4 bytes)] [length (4 bytes)]
+//         [time taken on the device in ms (4 bytes)]
+// The crc is of all of the data, as in segmented transfers.
+//
+// Writing (host to device):
+// Host:   [BULK_WRITE] [tag] [stream] [offset (4 bytes)] [length (4 bytes)]
+//         [crc (4 bytes)]
+// Device: [BULK_WRITE] [tag] [status]
+// Then:   [BULK_DATA] [tag] [offset from the start (4 bytes)] [data...]
+//         from the host, in order, without waiting for anything.
+// Then:   [BULK_END] [tag] from the host once all the data has been sent.
+// Device: [BULK_END] [tag] [status] [crc (4 bytes)] [length (4 bytes)]
+//         [time taken on the device in ms (4 bytes)]
+//
+// There are no acknowledgements for data. The host can send as fast as it
+// likes since the OUT endpoint NAKs while a packet is being worked through.
+// The streams are the ones in stream.h, and a stream shouldn't be moved over
+// raw HID and the bulk channel at the same time.
+
+#include "bulk.h"
+
+#include "clock.h"
+#include "crc32.h"
+#include "protocol.h"
+#include "usb.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    BULK_READ = 1,
+    BULK_WRITE = 2,
+    BULK_DATA = 3,
+    BULK_END = 4,
+};
+
+static const uint8_t RESPONSE_OK = 1;
+static const uint8_t RESPONSE_ERROR = 2;
+static const uint8_t RESPONSE_BUSY = 4;
+
+// The most data in one BULK_DATA frame.
+#define BULK_DATA_SIZE 256
+// The longest payload and its CRC.
+#define BULK_MAX_FRAME (6 + BULK_DATA_SIZE + 4)
+// COBS adds a byte for every 254, and there is a zero at each end.
+#define BULK_MAX_ENCODED (BULK_MAX_FRAME + BULK_MAX_FRAME / 254 + 3)
+
+// The frame being received and the COBS decoder's place in it. cobs_left is
+// the number of bytes left in the current block and cobs_code is the block's
+// code byte, which is zero at the start of a frame.
+static uint8_t rx_frame[BULK_MAX_FRAME];
+static uint32_t rx_length;
+static bool rx_overflow;
+static uint8_t cobs_code;
+static uint8_t cobs_left;
+
+static uint8_t tx_payload[BULK_MAX_FRAME];
+static uint8_t tx_frame[BULK_MAX_ENCODED];
+
+static struct {
+    const stream *stream;
+    bool active;
+    uint8_t tag;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t sent;
+    uint32_t crc;
+    uint32_t start_millis;
+} read_transfer;
+
+static struct {
+    const stream *stream;
+    bool active;
+    bool failed;
+    uint8_t tag;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t received;
+    uint32_t expected_crc;
+    uint32_t crc;
+    uint32_t start_millis;
+} write_transfer;
+
+// Encodes tx_payload and queues it for the serial port. The caller must have
+// checked that there is room for it.
+static void send_frame(uint32_t length) {
+    write_word(tx_payload + length, crc32_update(CRC32_INITIAL, tx_payload,
+                                                 length));
+    length += 4;
+    tx_frame[0] = 0;
+    uint32_t code_at = 1;
+    uint32_t out = 2;
+    uint8_t code = 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (tx_payload[i] != 0) {
+            tx_frame[out++] = tx_payload[i];
+            ++code;
+        }
+        if (tx_payload[i] == 0 || code == 0xFF) {
+            tx_frame[code_at] = code;
+            code_at = out++;
+            code = 1;
+        }
+    }
+    tx_frame[code_at] = code;
+    tx_frame[out++] = 0;
+    usb_send_serial_data(tx_frame, out);
+}
+
+// Fills in the status response that ends a transfer and sends it.
+static void send_end(uint8_t tag, uint8_t status, uint32_t crc,
+                     uint32_t length, uint32_t start_millis) {
+    tx_payload[0] = BULK_END;
+    tx_payload[1] = tag;
+    tx_payload[2] = status;
+    write_word(tx_payload + 3, crc);
+    write_word(tx_payload + 7, length);
+    write_word(tx_payload + 11, system_millis - start_millis);
+    send_frame(15);
+}
+
+static void send_status(uint8_t type, uint8_t tag, uint8_t status) {
+    tx_payload[0] = type;
+    tx_payload[1] = tag;
+    tx_payload[2] = status;
+    send_frame(3);
+}
+
+static void start_read(uint8_t *frame) {
+    uint8_t tag = frame[1];
+    const stream *s = protocol_stream(frame[2]);
+    uint32_t offset = read_word(frame + 3);
+    uint32_t max_length = read_word(frame + 7);
+    if (read_transfer.active) {
+        send_status(BULK_READ, tag, RESPONSE_BUSY);
+        return;
+    }
+    if (s == NULL || s->read == NULL) {
+        send_status(BULK_READ, tag, RESPONSE_ERROR);
+        return;
+    }
+    uint32_t available = s->read_begin ? s->read_begin() : 0;
+    if (offset > available) {
+        offset = available;
+    }
+    uint32_t length = available - offset;
+    if (length > max_length) {
+        length = max_length;
+    }
+
+    read_transfer.stream = s;
+    read_transfer.tag = tag;
+    read_transfer.offset = offset;
+    read_transfer.length = length;
+    read_transfer.sent = 0;
+    read_transfer.crc = CRC32_INITIAL;
+    read_transfer.start_millis = system_millis;
+    read_transfer.active = true;
+
+    tx_payload[0] = BULK_READ;
+    tx_payload[1] = tag;
+    tx_payload[2] = RESPONSE_OK;
+    write_word(tx_payload + 3, length);
+    send_frame(7);
+}
+
+// Sends the next frame of the read in progress.
+static void continue_read(void) {
+    uint32_t remaining = read_transfer.length - read_transfer.sent;
+    if (remaining == 0) {
+        send_end(read_transfer.tag, RESPONSE_OK, read_transfer.crc,
+                 read_transfer.length, read_transfer.start_millis);
+        if (read_transfer.stream->read_end) {
+            read_transfer.stream->read_end(read_transfer.length);
+        }
+        read_transfer.active = false;
+        return;
+    }
+
+    uint32_t size = remaining < BULK_DATA_SIZE ? remaining : BULK_DATA_SIZE;
+    tx_payload[0] = BULK_DATA;
+    tx_payload[1] = read_transfer.tag;
+    write_word(tx_payload + 2, read_transfer.sent);
+    read_transfer.stream->read(read_transfer.offset + read_transfer.sent,
+                               tx_payload + 6, size);
+    read_transfer.crc = crc32_update(read_transfer.crc, tx_payload + 6, size);
+    read_transfer.sent += size;
+    send_frame(6 + size);
+}
+
+static void start_write(uint8_t *frame) {
+    uint8_t tag = frame[1];
+    const stream *s = protocol_stream(frame[2]);
+    uint32_t offset = read_word(frame + 3);
+    uint32_t length = read_word(frame + 7);
+    if (write_transfer.active) {
+        send_status(BULK_WRITE, tag, RESPONSE_BUSY);
+        return;
+    }
+    if (s == NULL || s->write == NULL || length == 0 ||
+            (s->write_begin && !s->write_begin(offset, length))) {
+        send_status(BULK_WRITE, tag, RESPONSE_ERROR);
+        return;
+    }
+
+    write_transfer.stream = s;
+    write_transfer.tag = tag;
+    write_transfer.offset = offset;
+    write_transfer.length = length;
+    write_transfer.received = 0;
+    write_transfer.expected_crc = read_word(frame + 11);
+    write_transfer.crc = CRC32_INITIAL;
+    write_transfer.start_millis = system_millis;
+    write_transfer.failed = false;
+    write_transfer.active = true;
+    send_status(BULK_WRITE, tag, RESPONSE_OK);
+}
+
+// Data that is out of order or past the end fails the write, but the host
+// only finds out at the end.
+static void write_data(uint8_t *frame, uint32_t length) {
+    if (!write_transfer.active || frame[1] != write_transfer.tag ||
+            write_transfer.failed) {
+        return;
+    }
+    uint32_t size = length - 6;
+    if (read_word(frame + 2) != write_transfer.received ||
+            size > write_transfer.length - write_transfer.received) {
+        write_transfer.failed = true;
+        return;
+    }
+    write_transfer.stream->write(
+        write_transfer.offset + write_transfer.received, frame + 6, size);
+    write_transfer.crc = crc32_update(write_transfer.crc, frame + 6, size);
+    write_transfer.received += size;
+}
+
+static void end_write(uint8_t tag) {
+    if (!write_transfer.active || tag != write_transfer.tag) {
+        send_end(tag, RESPONSE_ERROR, 0, 0, system_millis);
+        return;
+    }
+    bool success = !write_transfer.failed &&
+        write_transfer.received == write_transfer.length &&
+        write_transfer.crc == write_transfer.expected_crc;
+    if (write_transfer.stream->write_end) {
+        write_transfer.stream->write_end(success);
+    }
+    write_transfer.active = false;
+    send_end(tag, success ? RESPONSE_OK : RESPONSE_ERROR, write_transfer.crc,
+             write_transfer.received, write_transfer.start_millis);
+}
+
+// Carries out a whole frame in rx_frame. Its CRC hasn't been checked yet.
+static void handle_frame(void) {
+    if (rx_overflow || rx_length < 6) return;
+    uint32_t length = rx_length - 4;
+    if (crc32_update(CRC32_INITIAL, rx_frame, length) !=
+            read_word(rx_frame + length)) {
+        // Data is lost, so the write can't succeed.
+        if (write_transfer.active) write_transfer.failed = true;
+        return;
+    }
+    uint8_t type = rx_frame[0];
+    if (type == BULK_READ && length >= 11) {
+        start_read(rx_frame);
+    } else if (type == BULK_WRITE && length >= 15) {
+        start_write(rx_frame);
+    } else if (type == BULK_DATA && length >= 6) {
+        write_data(rx_frame, length);
+    } else if (type == BULK_END) {
+        end_write(rx_frame[1]);
+    }
+}
+
+static void append_byte(uint8_t b) {
+    if (rx_length < BULK_MAX_FRAME) {
+        rx_frame[rx_length++] = b;
+    } else {
+        rx_overflow = true;
+    }
+}
+
+// Runs one received byte through the COBS decoder.
+static void receive_byte(uint8_t b) {
+    if (b == 0) {
+        handle_frame();
+        rx_length = 0;
+        rx_overflow = false;
+        cobs_code = 0;
+        cobs_left = 0;
+    } else if (cobs_left == 0) {
+        // A code byte. The block before it stood for its bytes and a zero,
+        // unless it was a full block.
+        if (cobs_code != 0 && cobs_code != 0xFF) {
+            append_byte(0);
+        }
+        cobs_code = b;
+        cobs_left = b - 1;
+    } else {
+        append_byte(b);
+        --cobs_left;
+    }
+}
+
+void bulk_poll(void) {
+    // Only take more from the host when any response will fit, so nothing
+    // has to wait here.
+    uint8_t buffer[64];
+    while (usb_serial_space() >= BULK_MAX_ENCODED) {
+        if (read_transfer.active) {
+            continue_read();
+            continue;
+        }
+        uint32_t length = usb_receive_serial_data(buffer, sizeof(buffer));
+        if (length == 0) break;
+        for (uint32_t i = 0; i < length; ++i) {
+            receive_byte(buffer[i]);
+        }
+    }
+}
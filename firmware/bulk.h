@@ -0,0 +1,31 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the bulk channel: framed stream transfers over the CDC
+// data endpoints, which move data much faster than the one raw HID report per
+// interval that segmented transfers get.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_BULK_H
+#define STENOSAURUS_FIRMWARE_BULK_H
+
+// Reads frames from the serial port, carries out the transfers they ask for
+// and sends the responses. Call this from the main loop.
+void bulk_poll(void);
+
+#endif // STENOSAURUS_FIRMWARE_BULK_H
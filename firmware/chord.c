@@ -0,0 +1,188 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the chord engine. See the header file for interface
+// documentation to this code.
+//
+// chord_scan() runs in the matrix scanner's interrupt after debouncing. It maps
+// the keys that are down to stroke bits and keeps the union of every bit
+// pressed since the chord started. When the chord ends, which depends on the
+// mode, the union is queued as a stroke along with when the chord started and
+// ended. Every output reads the same queue, so all of them see the same strokes
+// in the same order, but each has its own read index and takes strokes at its
+// own pace. An output that the host isn't reading, like a keyboard interface
+// that nothing has open, doesn't hold up the others.
+//
+// Repeating only happens while no key of the chord has been released, so
+// letting go of part of a chord never repeats what is left.
+//
+// The queue has a single producer, the interrupt, which never waits for the
+// readers: it writes over the oldest stroke. A reader that has fallen a whole
+// queue behind skips to the oldest stroke still there and counts the ones it
+// missed in STAT_STROKES_DROPPED. Readers copy a stroke out and then check
+// that the interrupt didn't write over it while they did.
+//
+// An output that is turned off is kept at the head of the queue, so it starts
+// with the next stroke when it is turned back on.
+
+#include "chord.h"
+
+#include "clock.h"
+#include "events.h"
+#include "latency.h"
+#include "matrix.h"
+#include "stats.h"
+#include "stroke.h"
+#include "trace.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// The stroke bits for each key of the matrix. Key n is wired as stroke bit n,
+// so the matrix is in the same order as the layout in stroke.h. The user button
+// types a whole stroke for testing without a matrix.
+static const uint32_t KEY_STROKES[32] = {
+#define MATRIX_KEY(name, label, bit, ...) [bit] = name##_STROKE,
+    STENO_LAYOUT(MATRIX_KEY)
+#undef MATRIX_KEY
+    [MATRIX_USER_BUTTON] = INITIAL_S_STROKE | INITIAL_T_STROKE |
+                           INITIAL_P_STROKE | INITIAL_H_STROKE |
+                           FINAL_F_STROKE | FINAL_P_STROKE | FINAL_L_STROKE |
+                           FINAL_T_STROKE,
+};
+
+#define CYCLES_PER_MS (CLOCK_CYCLES_PER_US * 1000)
+
+#define QUEUE_SIZE 16
+static chord_stroke queue[QUEUE_SIZE];
+static uint32_t queue_head;
+// The read index of each output. Only the main loop touches these.
+static uint32_t queue_tails[CHORD_OUTPUTS];
+
+static volatile uint8_t mode;
+static volatile uint8_t outputs = (1 << CHORD_OUTPUTS) - 1;
+
+static uint32_t last_keys;
+// The raw key state at the last scan, and when it last changed. A debounced
+// change comes from the last raw change, since debouncing waits for the raw
+// state to settle.
+static uint32_t last_raw;
+static uint32_t raw_change_cycles;
+// The stroke bits that are down, and every one that has been down since the
+// chord started.
+static uint32_t held;
+static uint32_t chord;
+static uint32_t press_cycles;
+// Set once the chord has been sent, until another key goes down.
+static bool sent;
+// Set while no key has been released since the last one went down.
+static bool intact;
+static uint32_t repeat_cycles;
+
+void chord_set_mode(uint8_t new_mode) {
+    mode = new_mode;
+}
+
+void chord_set_outputs(uint8_t new_outputs) {
+    outputs = new_outputs & ((1 << CHORD_OUTPUTS) - 1);
+}
+
+static void send(uint32_t now) {
+    chord_stroke *s = &queue[queue_head % QUEUE_SIZE];
+    s->keys = chord;
+    s->press_cycles = press_cycles;
+    s->release_cycles = now;
+    __atomic_store_n(&queue_head, queue_head + 1, __ATOMIC_RELEASE);
+    sent = true;
+}
+
+static uint32_t to_stroke(uint32_t keys) {
+    uint32_t stroke = 0;
+    while (keys) {
+        int key = __builtin_ctz(keys);
+        keys &= keys - 1;
+        stroke |= KEY_STROKES[key];
+    }
+    return stroke;
+}
+
+void chord_scan(uint32_t raw, uint32_t keys, uint32_t now) {
+    if (raw != last_raw) {
+        last_raw = raw;
+        raw_change_cycles = now;
+    }
+    if (keys != last_keys) {
+        last_keys = keys;
+        TRACE(TRACE_KEY_CHANGE, keys);
+        // The latency of a stroke runs from the key change that completes it,
+        // including the time spent debouncing it.
+        latency_mark_at(LATENCY_KEY_CHANGE, raw_change_cycles);
+        uint32_t now_held = to_stroke(keys);
+        uint32_t pressed = now_held & ~held;
+        uint32_t released = held & ~now_held;
+        held = now_held;
+        if (pressed) {
+            if (chord == 0 || sent) press_cycles = now;
+            chord |= pressed;
+            sent = false;
+            intact = true;
+            repeat_cycles = now + CHORD_REPEAT_DELAY_MS * CYCLES_PER_MS;
+        }
+        if (released) {
+            intact = false;
+            if (mode & CHORD_FIRST_UP) {
+                if (!sent) send(now);
+                chord = held;
+            } else if (held == 0) {
+                if (!sent) send(now);
+                chord = 0;
+            }
+        }
+    }
+    if ((mode & CHORD_REPEAT) && intact && held != 0 &&
+        (int32_t)(now - repeat_cycles) >= 0) {
+        send(now);
+        repeat_cycles = now + CHORD_REPEAT_INTERVAL_MS * CYCLES_PER_MS;
+    }
+}
+
+bool chord_peek(chord_output output, chord_stroke *stroke) {
+    uint32_t *tail = &queue_tails[output];
+    for (;;) {
+        uint32_t head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+        if (!(outputs & (1 << output))) {
+            *tail = head;
+            return false;
+        }
+        if (head - *tail > QUEUE_SIZE) {
+            stats_add(STAT_STROKES_DROPPED, head - *tail - QUEUE_SIZE);
+            events_post(EVENT_OVERFLOW, OVERFLOW_STROKES);
+            *tail = head - QUEUE_SIZE;
+        }
+        if (*tail == head) return false;
+        *stroke = queue[*tail % QUEUE_SIZE];
+        // The interrupt writes a slot before it moves the head past it, and
+        // it runs to completion, so the copy is good unless the head has since
+        // moved a whole queue past the tail.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE);
+        if (head - *tail <= QUEUE_SIZE) return true;
+    }
+}
+
+void chord_pop(chord_output output) {
+    ++queue_tails[output];
+}
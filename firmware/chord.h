@@ -0,0 +1,86 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the chord engine, which turns the debounced keys into
+// strokes.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_CHORD_H
+#define STENOSAURUS_FIRMWARE_CHORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Mode bits for chord_set_mode(). The default, zero, sends a stroke once every
+// key in it has been released.
+enum {
+    // Send the stroke as soon as any of its keys is released. Keys that are
+    // still held carry into the next stroke if another key is pressed.
+    CHORD_FIRST_UP = 1,
+    // Send the stroke again and again while all of its keys are held.
+    CHORD_REPEAT = 2,
+};
+
+// How long a chord must be held before it starts repeating, and how often it
+// repeats after that.
+#define CHORD_REPEAT_DELAY_MS 500
+#define CHORD_REPEAT_INTERVAL_MS 100
+
+typedef struct {
+    // The stroke's bits, as in stroke.h.
+    uint32_t keys;
+    // clock_cycles() when the first key of the stroke went down and when the
+    // stroke was sent, which is usually the last key up. The host gets both
+    // as events, see events.h.
+    uint32_t press_cycles;
+    uint32_t release_cycles;
+} chord_stroke;
+
+void chord_set_mode(uint8_t mode);
+
+// The outputs that read strokes from the chord engine, each at its own pace.
+typedef enum {
+    // Plover's QWERTY keys on the keyboard interface.
+    CHORD_OUTPUT_KEYBOARD = 0,
+    // TX Bolt or Gemini PR on the serial port.
+    CHORD_OUTPUT_SERIAL = 1,
+    // The Plover HID interface.
+    CHORD_OUTPUT_PLOVER_HID = 2,
+    // EVENT_STROKE and the events after it, the stroke stats and the LED.
+    CHORD_OUTPUT_EVENTS = 3,
+    CHORD_OUTPUTS
+} chord_output;
+
+// Turns outputs on and off, with bit n of the mask for output n. All of them
+// are on by default. An output that is off skips the strokes made meanwhile.
+void chord_set_outputs(uint8_t outputs);
+
+// Takes the raw and debounced key state, in the matrix layout, from the matrix
+// scanner's interrupt. now is clock_cycles() at the scan. The raw state is only
+// used to time key changes from before debouncing.
+void chord_scan(uint32_t raw, uint32_t keys, uint32_t now);
+
+// Copies the oldest stroke that output hasn't taken yet into stroke and returns
+// true, or returns false if there isn't one. It stays in the queue until
+// chord_pop(), so an output that can't deal with it yet can leave it there,
+// though an output that falls a whole queue behind loses its oldest strokes.
+// Only the main loop may take strokes.
+bool chord_peek(chord_output output, chord_stroke *stroke);
+void chord_pop(chord_output output);
+
+#endif // STENOSAURUS_FIRMWARE_CHORD_H
@@ -20,6 +20,8 @@
 
 #include "clock.h"
 
+#include "trace.h"
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/rcc.h>
@@ -42,12 +44,17 @@ void clock_init(void) {
     systick_set_clocksource(STK_CTRL_CLKSOURCE_AHB);
     systick_counter_enable();
     systick_interrupt_enable();
+
+    // The DWT cycle counter gives timestamps with a resolution of one clock
+    // cycle for clock_cycles().
+    dwt_enable_cycle_counter();
 }
 
 // Implementing a function with this name makes it the handler for the systick
 // interrupt.
 void sys_tick_handler(void) {
     ++system_millis;
+    TRACE(TRACE_SYS_TICK, system_millis);
     if (system_millis == 0) {
         scb_reset_system();
     }
@@ -22,10 +22,20 @@
 #ifndef STENOSAURUS_FIRMWARE_CLOCK_H
 #define STENOSAURUS_FIRMWARE_CLOCK_H
 
+#include <libopencm3/cm3/dwt.h>
 #include <stdint.h>
 
+// The core clock runs at 48Mhz.
+#define CLOCK_CYCLES_PER_US 48
+
 extern volatile uint32_t system_millis;
 
 void clock_init(void);
 
+// The number of core clock cycles since clock_init. This wraps every ~89
+// seconds so it's only good for measuring short intervals, by subtracting.
+static inline uint32_t clock_cycles(void) {
+    return DWT_CYCCNT;
+}
+
 #endif // STENOSAURUS_FIRMWARE_CLOCK_H
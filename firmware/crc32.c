@@ -0,0 +1,46 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements a CRC-32 over bytes. See the header file for interface
+// documentation to this code.
+//
+// This uses the same polynomial (0x04C11DB7), initial value and bit order as
+// the STM32 CRC unit, which the bootloader uses, but it works a byte at a time
+// so lengths don't need to be a multiple of four. Bytes are fed in most
+// significant bit first with no reflection and no final XOR. The table only
+// has 16 entries to keep the flash cost down.
+
+#include "crc32.h"
+
+#include <stdint.h>
+
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9,
+    0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+    0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61,
+    0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD,
+};
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint32_t length) {
+    const uint8_t *end = buf + length;
+    while (buf != end) {
+        crc ^= (uint32_t)*buf++ << 24;
+        crc = (crc << 4) ^ crc_table[crc >> 28];
+        crc = (crc << 4) ^ crc_table[crc >> 28];
+    }
+    return crc;
+}
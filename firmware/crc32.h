@@ -0,0 +1,35 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines a CRC-32 that can be computed incrementally over a byte
+// stream.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_CRC32_H
+#define STENOSAURUS_FIRMWARE_CRC32_H
+
+#include <stdint.h>
+
+// The value to start a new CRC with.
+#define CRC32_INITIAL 0xFFFFFFFF
+
+// Returns the CRC of the bytes seen so far, given by crc, followed by the
+// length bytes in buf.
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, uint32_t length);
+
+#endif // STENOSAURUS_FIRMWARE_CRC32_H
@@ -0,0 +1,114 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements debouncing for all keys at once. See the header file for
+// interface documentation to this code.
+//
+// Each key has a two bit counter of how many samples in a row it has differed
+// from its debounced state. The counters are kept vertically: bit n of count0
+// and count1 are the low and high bits of key n's counter, so all of the keys
+// are counted with a few word-wide operations. When a key has differed for
+// DEBOUNCE_SAMPLES samples its debounced state flips. Any sample that agrees
+// with the debounced state clears the key's counter.
+//
+// The samples are taken from the matrix scans, which are timed by TIM2, rather
+// than from the main loop. At high scan rates only every nth scan is used, so
+// that DEBOUNCE_SAMPLES samples span at least DEBOUNCE_US. n is rounded up, so
+// at 1kHz, where one in 1.25 scans would be exact, every other scan is used.
+//
+// A key that starts counting and is cleared before it gets to the end has
+// chattered. The chatter counts are kept vertically too, as 16 bit planes that
+// are added to with a ripple carry, so a sample costs the same however many
+// keys are down or bouncing.
+//
+// STREAM_CHATTER is a little endian 4 byte chatter count for each of the 32
+// keys.
+
+#include "debounce.h"
+
+#include <stdint.h>
+
+#define DEBOUNCE_SAMPLES 4
+#define CHATTER_BITS 16
+#define KEYS 32
+
+static volatile uint32_t state;
+static uint32_t count0;
+static uint32_t count1;
+// Keys that were part way through counting after the last sample.
+static uint32_t counting;
+
+static uint32_t chatter[CHATTER_BITS];
+
+static volatile uint32_t decimation = 1;
+static uint32_t countdown = 1;
+
+void debounce_set_rate(uint32_t rate_hz) {
+    uint32_t n =
+        (rate_hz * (DEBOUNCE_US / DEBOUNCE_SAMPLES) + 1000000 - 1) / 1000000;
+    decimation = n > 0 ? n : 1;
+}
+
+void debounce_scan(uint32_t raw) {
+    if (--countdown != 0) return;
+    countdown = decimation;
+
+    uint32_t changed = raw ^ state;
+    // Step the counters of keys that differ and clear the rest. The counters
+    // count 0, 1, 2, 3 and then wrap to 0, which is when the key flips.
+    uint32_t carry = count0 & changed;
+    count0 = ~count0 & changed;
+    count1 = (count1 ^ carry) & changed;
+    uint32_t flipped = changed & ~count0 & ~count1;
+    state ^= flipped;
+
+    uint32_t bounced = counting & ~changed;
+    counting = changed & ~flipped;
+    for (int i = 0; i < CHATTER_BITS; ++i) {
+        uint32_t next = chatter[i] & bounced;
+        chatter[i] ^= bounced;
+        bounced = next;
+    }
+}
+
+uint32_t debounce_read(void) {
+    return state;
+}
+
+uint32_t debounce_chatter(int key) {
+    uint32_t count = 0;
+    for (int i = 0; i < CHATTER_BITS; ++i) {
+        count |= ((chatter[i] >> key) & 1) << i;
+    }
+    return count;
+}
+
+static uint32_t chatter_read_begin(void) {
+    return KEYS * 4;
+}
+
+static void chatter_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    for (uint32_t i = 0; i < length; ++i) {
+        uint32_t count = debounce_chatter((offset + i) / 4);
+        buffer[i] = count >> (8 * ((offset + i) % 4));
+    }
+}
+
+const stream chatter_stream = {
+    .read_begin = chatter_read_begin,
+    .read = chatter_read,
+};
@@ -0,0 +1,50 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the debouncing of the key matrix.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_DEBOUNCE_H
+#define STENOSAURUS_FIRMWARE_DEBOUNCE_H
+
+#include "stream.h"
+#include <stdint.h>
+
+// How long a key must stay in a new state before it counts, in microseconds.
+#define DEBOUNCE_US 5000
+
+// Sets the rate that debounce_scan() is called at, in scans per second, so that
+// debouncing takes at least DEBOUNCE_US whatever the scan rate.
+void debounce_set_rate(uint32_t rate_hz);
+
+// Takes a scan of the raw key state, one bit per key. Called from the matrix
+// scanner's interrupt.
+void debounce_scan(uint32_t raw);
+
+// The debounced key state, in the same layout as the scans.
+uint32_t debounce_read(void);
+
+// The number of times that key started to change and then bounced back before
+// DEBOUNCE_US was up. This wraps at 65536.
+uint32_t debounce_chatter(int key);
+
+// The chatter counts as a stream that the host can read. See the .c file for
+// the layout.
+extern const stream chatter_stream;
+
+#endif // STENOSAURUS_FIRMWARE_DEBOUNCE_H
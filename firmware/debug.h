@@ -22,13 +22,19 @@
 #ifndef STENOSAURUS_FIRMWARE_DEBUG
 #define STENOSAURUS_FIRMWARE_DEBUG
 
-// Print a string to the USB emulated serial port.
-void print(char* str);
+#include <stdint.h>
 
-// Print a 32 bit int as a hex string using print.
+// Log a string. Only the pointer is kept and the string is formatted later,
+// when the log is drained, so it must stay valid for the life of the program:
+// a string literal or other static constant, never a buffer on the stack. See
+// log.h.
+void print(const char *str);
+
+// Log a 32 bit int in hex.
 void print_word(uint32_t word);
 
-// Print a string and a 32 bit word as above.
-void print_arg1(char *str, uint32_t word);
+// Log a format string followed by a 32 bit word. The same lifetime rule as
+// print applies to str.
+void print_arg1(const char *str, uint32_t word);
 
 #endif // STENOSAURUS_FIRMWARE_DEBUG
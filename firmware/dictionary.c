@@ -0,0 +1,89 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements dictionary storage for the Stenosaurus. See the header
+// file for interface documentation to this code.
+//
+// The dictionary is kept in RAM. The host writes it in chunks. Each chunk must
+// start at or before the end of the data already loaded so there are no gaps,
+// and the length is the end of the furthest chunk written successfully. The
+// format of the data is up to the host for now.
+
+#include "dictionary.h"
+
+#include "memory.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static uint8_t dictionary[DICTIONARY_SIZE];
+static uint32_t length;
+// The end of the chunk being written, which becomes the length if the write
+// succeeds.
+static uint32_t write_end_offset;
+
+void dictionary_init(void) {
+    memory_watch(MEMORY_DICTIONARY, dictionary, sizeof(dictionary));
+}
+
+uint32_t dictionary_length(void) {
+    return length;
+}
+
+const uint8_t *dictionary_data(void) {
+    return dictionary;
+}
+
+static uint32_t dictionary_read_begin(void) {
+    return length;
+}
+
+static void dictionary_read(uint32_t offset, uint8_t *buffer, uint32_t len) {
+    const uint8_t *b = dictionary + offset;
+    const uint8_t *end = b + len;
+    while (b != end) *buffer++ = *b++;
+}
+
+static bool dictionary_write_begin(uint32_t offset, uint32_t len) {
+    if (offset > length || len > DICTIONARY_SIZE - offset) {
+        return false;
+    }
+    write_end_offset = offset + len;
+    return true;
+}
+
+static void dictionary_write(uint32_t offset, const uint8_t *buffer,
+                             uint32_t len) {
+    uint8_t *b = dictionary + offset;
+    uint8_t *end = b + len;
+    while (b != end) *b++ = *buffer++;
+}
+
+static void dictionary_write_end(bool success) {
+    if (success && write_end_offset > length) {
+        length = write_end_offset;
+    }
+}
+
+const stream dictionary_stream = {
+    .read_begin = dictionary_read_begin,
+    .read = dictionary_read,
+    .read_end = NULL,
+    .write_begin = dictionary_write_begin,
+    .write = dictionary_write,
+    .write_end = dictionary_write_end,
+};
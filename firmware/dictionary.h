@@ -0,0 +1,45 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the storage for dictionaries that the host loads onto the
+// device.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_DICTIONARY_H
+#define STENOSAURUS_FIRMWARE_DICTIONARY_H
+
+#include "stream.h"
+#include <stdint.h>
+
+// The number of bytes of dictionary data that fit on the device.
+#define DICTIONARY_SIZE 4096
+
+// Sets up the dictionary store. Call this once at start up.
+void dictionary_init(void);
+
+// The dictionary as a stream so that the host can load and read it back in
+// chunks.
+extern const stream dictionary_stream;
+
+// The number of bytes of dictionary data that the host has loaded.
+uint32_t dictionary_length(void);
+
+// The dictionary data. Only the first dictionary_length() bytes are valid.
+const uint8_t *dictionary_data(void);
+
+#endif // STENOSAURUS_FIRMWARE_DICTIONARY_H
@@ -0,0 +1,192 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2013 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the serial steno protocol encoders. See the header file
+// for interface documentation to this code.
+//
+// In the TX Bolt protocol, there are four sets of keys grouped in order from
+// left to right. Each byte represents all the keys that were pressed in that
+// set. The first two bits indicate which set this byte represents. The next
+// bits are set if the corresponding key was pressed for the stroke.
+//
+// 00XXXXXX 01XXXXXX 10XXXXXX 110XXXXX
+//   HWPKTS   UE*OAR   GLBPRF    #ZDST
+//
+// The protocol uses variable length packets of one, two, three or four bytes.
+// Only those bytes for which keys were pressed will be transmitted. The bytes
+// arrive in order of the sets so it is clear when a new stroke starts. Also, if
+// a key is pressed in an earlier set in one stroke and then a key is pressed
+// only in a later set then there will be a zero byte to indicate that this is a
+// new stroke. So, it is reliable to assume that a stroke ended when a lower set
+// is seen. Additionally, if there is no activity then the machine will send a
+// zero byte every few seconds.
+//
+// In this implementation of the protocol we send a zero byte after each stroke
+// regardless of it being necessary. It is believed by the implementor that this
+// should be compatible with any software that is prepared to receive  this
+// protocol. The benefit is that it makes the protocol implementation  stateless
+// and reduces delay issues for the final stroke.
+//
+// Gemini PR packets are always six bytes. The first byte has its top bit set
+// and the others don't, so the start of a stroke is always clear. The other
+// seven bits of each byte are keys, from bit 6 down:
+//
+// 1 Fn #1 #2 #3 #4 #5 #6
+// 0 S1 S2 T- K- P- W- H-
+// 0 R- A- O- *1 *2 r1 r2
+// 0 pwr *3 *4 -E -U -F -R
+// 0 -P -B -L -G -T -S -D
+// 0 #7 #8 #9 #A #B #C -Z
+//
+// Our keyboard has one S- and one * and the # is sent as #1. The r bits are
+// reserved and never set.
+//
+// Both encoders look a stroke up a byte at a time. For each protocol there is a
+// table for each byte of the stroke word, indexed by the byte, whose entries
+// have the keys in that byte already in their places in the packet. ORing the
+// three entries together gives the whole packet, or for TX Bolt the four sets
+// before the empty ones are dropped, with no work per key. The tables are
+// generated from the layout in stroke.h when the firmware is compiled, so the
+// layout stays the one place that says where each key goes, and they are const
+// so their 9K is in flash rather than RAM.
+
+#include "encoder.h"
+
+#include "stroke.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// The tables below cover three bytes of stroke word.
+_Static_assert(STENO_ALL_KEYS < 1 << 24, "stroke words must fit in 24 bits");
+
+// TABLE_ENTRIES expands to the 256 entries of table TABLE with each key put in
+// its place by PLACE. TABLE and PLACE are defined around each table below.
+//
+// IN_BIT_i is a layout callback that gives the place of the key, if there is
+// one, whose bit in the stroke word is bit i of the table's byte, and
+// PLACE_IF(v, i) is that place if bit i of the index v is set.
+#define IN_BYTE(i, bit, ...) \
+    | ((bit) == TABLE * 8 + (i) ? PLACE(__VA_ARGS__) : 0)
+#define IN_BIT_0(name, label, bit, ...) IN_BYTE(0, bit, __VA_ARGS__)
+#define IN_BIT_1(name, label, bit, ...) IN_BYTE(1, bit, __VA_ARGS__)
+#define IN_BIT_2(name, label, bit, ...) IN_BYTE(2, bit, __VA_ARGS__)
+#define IN_BIT_3(name, label, bit, ...) IN_BYTE(3, bit, __VA_ARGS__)
+#define IN_BIT_4(name, label, bit, ...) IN_BYTE(4, bit, __VA_ARGS__)
+#define IN_BIT_5(name, label, bit, ...) IN_BYTE(5, bit, __VA_ARGS__)
+#define IN_BIT_6(name, label, bit, ...) IN_BYTE(6, bit, __VA_ARGS__)
+#define IN_BIT_7(name, label, bit, ...) IN_BYTE(7, bit, __VA_ARGS__)
+#define PLACE_IF(v, i) ((v) >> (i) & 1 ? (0 STENO_LAYOUT(IN_BIT_##i)) : 0)
+#define ENTRY(v) \
+    (PLACE_IF(v, 0) | PLACE_IF(v, 1) | PLACE_IF(v, 2) | PLACE_IF(v, 3) | \
+     PLACE_IF(v, 4) | PLACE_IF(v, 5) | PLACE_IF(v, 6) | PLACE_IF(v, 7))
+#define ROW(v) \
+    ENTRY(v), ENTRY(v + 1), ENTRY(v + 2), ENTRY(v + 3), ENTRY(v + 4), \
+    ENTRY(v + 5), ENTRY(v + 6), ENTRY(v + 7), ENTRY(v + 8), ENTRY(v + 9), \
+    ENTRY(v + 10), ENTRY(v + 11), ENTRY(v + 12), ENTRY(v + 13), \
+    ENTRY(v + 14), ENTRY(v + 15)
+#define TABLE_ENTRIES \
+    ROW(0x00), ROW(0x10), ROW(0x20), ROW(0x30), ROW(0x40), ROW(0x50), \
+    ROW(0x60), ROW(0x70), ROW(0x80), ROW(0x90), ROW(0xA0), ROW(0xB0), \
+    ROW(0xC0), ROW(0xD0), ROW(0xE0), ROW(0xF0)
+
+// The four TX Bolt sets, one to a byte from the lowest, without their prefix
+// bits.
+#define PLACE(txbolt_byte, txbolt_bit, ...) \
+    ((txbolt_byte) < 4 ? (uint32_t)1 << ((txbolt_byte) * 8 + (txbolt_bit)) : 0)
+static const uint32_t txbolt_table[3][256] = {
+#define TABLE 0
+    {TABLE_ENTRIES},
+#undef TABLE
+#define TABLE 1
+    {TABLE_ENTRIES},
+#undef TABLE
+#define TABLE 2
+    {TABLE_ENTRIES},
+#undef TABLE
+};
+#undef PLACE
+
+// The six Gemini PR bytes, from the lowest, without the first byte's top bit.
+#define PLACE(txbolt_byte, txbolt_bit, gemini_byte, gemini_bit, ...) \
+    ((uint64_t)1 << ((gemini_byte) * 8 + (gemini_bit)))
+static const uint64_t gemini_table[3][256] = {
+#define TABLE 0
+    {TABLE_ENTRIES},
+#undef TABLE
+#define TABLE 1
+    {TABLE_ENTRIES},
+#undef TABLE
+#define TABLE 2
+    {TABLE_ENTRIES},
+#undef TABLE
+};
+#undef PLACE
+
+static volatile uint8_t protocol = ENCODER_TXBOLT;
+
+bool encoder_set_protocol(uint8_t new_protocol) {
+    if (new_protocol >= ENCODER_PROTOCOLS) return false;
+    protocol = new_protocol;
+    return true;
+}
+
+encoder_protocol encoder_get_protocol(void) {
+    return protocol;
+}
+
+static uint32_t encode_txbolt(const uint32_t *strokes, uint32_t count,
+                              uint8_t *out) {
+    uint8_t *p = out;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t s = strokes[i];
+        uint32_t sets = txbolt_table[0][s & 0xFF] |
+                        txbolt_table[1][(s >> 8) & 0xFF] |
+                        txbolt_table[2][(s >> 16) & 0xFF];
+        // Every set is written but p only moves past the ones with keys, so
+        // there are no branches to mispredict.
+        for (int set = 0; set < 4; ++set) {
+            uint8_t keys = sets >> (set * 8);
+            *p = keys | set << 6;
+            p += keys != 0;
+        }
+        *p++ = 0;
+    }
+    return p - out;
+}
+
+static uint32_t encode_gemini_pr(const uint32_t *strokes, uint32_t count,
+                                 uint8_t *out) {
+    uint8_t *p = out;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t s = strokes[i];
+        uint64_t bytes = 0x80 | gemini_table[0][s & 0xFF] |
+                         gemini_table[1][(s >> 8) & 0xFF] |
+                         gemini_table[2][(s >> 16) & 0xFF];
+        for (int byte = 0; byte < 6; ++byte) {
+            *p++ = bytes >> (byte * 8);
+        }
+    }
+    return p - out;
+}
+
+uint32_t encoder_encode(const uint32_t *strokes, uint32_t count, uint8_t *out) {
+    if (protocol == ENCODER_GEMINI_PR) {
+        return encode_gemini_pr(strokes, count, out);
+    } else {
+        return encode_txbolt(strokes, count, out);
+    }
+}
@@ -0,0 +1,51 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2013 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option) any
+// later version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the encoders for the serial steno protocols, which send
+// strokes to Plover and other steno software over the CDC serial port.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_ENCODER_H
+#define STENOSAURUS_FIRMWARE_ENCODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    // The serial transmit, or TX, protocol from the Baron Online Transcriptor.
+    // Two to five bytes a stroke.
+    ENCODER_TXBOLT = 0,
+    // The Gemini PR protocol. Six bytes a stroke.
+    ENCODER_GEMINI_PR = 1,
+    ENCODER_PROTOCOLS
+} encoder_protocol;
+
+// The most bytes that one stroke can take in any protocol.
+#define ENCODER_MAX_BYTES 6
+
+// Chooses the protocol that strokes are encoded in. TX Bolt is the default.
+// Returns false, and leaves the protocol alone, if it isn't one of the above.
+bool encoder_set_protocol(uint8_t protocol);
+encoder_protocol encoder_get_protocol(void);
+
+// Encodes count strokes, as in stroke.h, one after another into out and
+// returns the number of bytes written. out must have room for
+// count * ENCODER_MAX_BYTES bytes.
+uint32_t encoder_encode(const uint32_t *strokes, uint32_t count, uint8_t *out);
+
+#endif // #ifndef STENOSAURUS_FIRMWARE_ENCODER_H
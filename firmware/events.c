@@ -0,0 +1,100 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the unsolicited event reports. See the header file for
+// interface documentation to this code.
+//
+// Events are sent in the raw HID IN reports with a status of
+// RESPONSE_UNSOLICITED. The rest of the report is laid out as:
+// [count] [dropped] then count events each laid out as [type] [argument (4
+// bytes)]. dropped is the number of events lost since the last report because
+// this one was full, stopping at 255.
+//
+// Events that happen close together share a report. The first event waits up
+// to a poll interval of the raw HID endpoint for others to join it, which
+// doesn't delay it any more than waiting for the host to poll would.
+
+#include "events.h"
+
+#include "clock.h"
+#include <libopencm3/cm3/cortex.h>
+
+// How long the first event in a report waits for company. This is the
+// bInterval of the raw HID IN endpoint.
+static const uint32_t EVENT_DELAY_MS = 10;
+
+#define EVENTS_PER_REPORT 12
+static struct {
+    uint8_t type;
+    uint32_t argument;
+} events[EVENTS_PER_REPORT];
+static uint8_t event_count;
+static uint8_t events_dropped;
+static uint32_t first_event_millis;
+
+// Events can be posted from interrupts of any priority, so everything that
+// touches the list is done with interrupts masked. It's only a few
+// instructions each time.
+void events_post(event_type type, uint32_t argument) {
+    uint32_t mask = cm_mask_interrupts(1);
+    if (event_count == EVENTS_PER_REPORT) {
+        if (events_dropped != 255) {
+            ++events_dropped;
+        }
+    } else {
+        if (event_count == 0) {
+            first_event_millis = system_millis;
+        }
+        events[event_count].type = type;
+        events[event_count].argument = argument;
+        ++event_count;
+    }
+    cm_mask_interrupts(mask);
+}
+
+bool events_ready(void) {
+    return event_count == EVENTS_PER_REPORT ||
+           (event_count != 0 &&
+            system_millis - first_event_millis >= EVENT_DELAY_MS);
+}
+
+bool events_make_report(uint8_t *body) {
+    uint32_t mask = cm_mask_interrupts(1);
+    bool ready = events_ready();
+    if (ready) {
+        *body++ = event_count;
+        *body++ = events_dropped;
+        for (int i = 0; i < event_count; ++i) {
+            uint32_t argument = events[i].argument;
+            *body++ = events[i].type;
+            *body++ = argument & 0xFF;
+            *body++ = (argument >> 8) & 0xFF;
+            *body++ = (argument >> 16) & 0xFF;
+            *body++ = (argument >> 24) & 0xFF;
+        }
+        for (int i = event_count; i < EVENTS_PER_REPORT; ++i) {
+            for (int j = 0; j < 5; ++j) {
+                *body++ = 0;
+            }
+        }
+        *body = 0;
+        event_count = 0;
+        events_dropped = 0;
+    }
+    cm_mask_interrupts(mask);
+    return ready;
+}
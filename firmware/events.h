@@ -0,0 +1,78 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines events that the device reports to the host without being
+// asked.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_EVENTS_H
+#define STENOSAURUS_FIRMWARE_EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The kinds of events. Each one comes with a 4 byte argument.
+typedef enum {
+    // A stroke was produced. The argument is the stroke's bits.
+    EVENT_STROKE = 1,
+    // An SD card was inserted. The argument is unused.
+    EVENT_SD_INSERTED = 2,
+    // The SD card was removed. The argument is unused.
+    EVENT_SD_REMOVED = 3,
+    // Data was lost because a buffer was full. The argument is one of the
+    // OVERFLOW_* values below.
+    EVENT_OVERFLOW = 4,
+    // A counter crossed the threshold the host set for it. The argument is the
+    // counter.
+    EVENT_THRESHOLD = 5,
+    // Posted right after each EVENT_STROKE with clock_cycles() when the first
+    // key of the stroke went down and when the stroke was sent, which is
+    // usually the last key up.
+    EVENT_STROKE_PRESS = 6,
+    EVENT_STROKE_RELEASE = 7,
+} event_type;
+
+// The buffers that can overflow.
+enum {
+    // The queue of slow protocol requests.
+    OVERFLOW_COMMAND_QUEUE = 1,
+    // The ring of bytes for the USB serial port, see STAT_CDC_BYTES_DROPPED.
+    OVERFLOW_SERIAL_TX = 2,
+    // keyboard.c's queue of key events, see STAT_KEY_EVENTS_REFUSED.
+    OVERFLOW_KEY_EVENTS = 3,
+    // The chord engine's stroke queue, for an output that fell behind. See
+    // STAT_STROKES_DROPPED.
+    OVERFLOW_STROKES = 4,
+    // The Plover HID report queue, see STAT_STENO_REPORTS_DROPPED.
+    OVERFLOW_PLOVER_HID = 5,
+};
+
+// Records an event to be sent to the host. This may be called from interrupts.
+// Events are dropped, and the number dropped is reported, if they come faster
+// than the host picks them up.
+void events_post(event_type type, uint32_t argument);
+
+// Whether a report of events should be sent now. That is once the report is
+// full or the oldest event in it has waited a poll interval.
+bool events_ready(void);
+
+// Fills in the body of an unsolicited report, everything after the status byte,
+// if events_ready(). Returns whether it did.
+bool events_make_report(uint8_t *body);
+
+#endif // STENOSAURUS_FIRMWARE_EVENTS_H
@@ -0,0 +1,118 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the keyboard reports. See the header file for
+// interface documentation to this code.
+//
+// Both reports are updated on every key change so sending either one is just a
+// copy. The boot report needs the keys in the order they were pressed, so the
+// pressed keys are kept in a list in that order. A release removes its key
+// from the list, which costs as much as the number of keys down rather than a
+// scan of the whole bitmap.
+
+#include "key_report.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The usage that fills every key slot of a boot report when too many keys are
+// down.
+#define ERROR_ROLL_OVER 0x01
+
+#define FIRST_MODIFIER 0xE0
+#define LAST_MODIFIER 0xE7
+// The highest key in nkro_key_report.
+#define LAST_KEY 247
+
+uint8_t nkro_key_report[32];
+
+boot_report boot_key_report;
+
+// The keys down in the order they were pressed.
+static uint8_t pressed[LAST_KEY + 1];
+static uint8_t pressed_count;
+
+// Refills the key slots of the boot report from the start of the list.
+static void update_boot_keys(void) {
+    if (pressed_count > sizeof(boot_key_report.keys)) {
+        for (uint8_t i = 0; i < sizeof(boot_key_report.keys); ++i) {
+            boot_key_report.keys[i] = ERROR_ROLL_OVER;
+        }
+        return;
+    }
+    for (uint8_t i = 0; i < sizeof(boot_key_report.keys); ++i) {
+        boot_key_report.keys[i] = i < pressed_count ? pressed[i] : 0;
+    }
+}
+
+void key_report_clear(void) {
+    for (uint8_t i = 0; i < sizeof(nkro_key_report); ++i) {
+        nkro_key_report[i] = 0;
+    }
+    boot_key_report.modifiers = 0;
+    pressed_count = 0;
+    update_boot_keys();
+}
+
+bool key_report_down(uint8_t usb_keycode) {
+    if (usb_keycode >= FIRST_MODIFIER && usb_keycode <= LAST_MODIFIER) {
+        uint8_t mask = 1 << (usb_keycode - FIRST_MODIFIER);
+        if (nkro_key_report[0] & mask) return false;
+        nkro_key_report[0] |= mask;
+        boot_key_report.modifiers = nkro_key_report[0];
+        return true;
+    }
+    if (usb_keycode > LAST_KEY) return false;
+    uint8_t *byte = &nkro_key_report[usb_keycode / 8 + 1];
+    uint8_t mask = 1 << (usb_keycode % 8);
+    if (*byte & mask) return false;
+    *byte |= mask;
+    pressed[pressed_count++] = usb_keycode;
+    // Only the first six keys and the switch to rollover show in the boot
+    // report.
+    if (pressed_count <= sizeof(boot_key_report.keys)) {
+        boot_key_report.keys[pressed_count - 1] = usb_keycode;
+    } else if (pressed_count == sizeof(boot_key_report.keys) + 1) {
+        update_boot_keys();
+    }
+    return true;
+}
+
+bool key_report_up(uint8_t usb_keycode) {
+    if (usb_keycode >= FIRST_MODIFIER && usb_keycode <= LAST_MODIFIER) {
+        uint8_t mask = 1 << (usb_keycode - FIRST_MODIFIER);
+        if (!(nkro_key_report[0] & mask)) return false;
+        nkro_key_report[0] &= ~mask;
+        boot_key_report.modifiers = nkro_key_report[0];
+        return true;
+    }
+    if (usb_keycode > LAST_KEY) return false;
+    uint8_t *byte = &nkro_key_report[usb_keycode / 8 + 1];
+    uint8_t mask = 1 << (usb_keycode % 8);
+    if (!(*byte & mask)) return false;
+    *byte &= ~mask;
+    uint8_t i = 0;
+    while (pressed[i] != usb_keycode) ++i;
+    --pressed_count;
+    for (; i < pressed_count; ++i) {
+        pressed[i] = pressed[i + 1];
+    }
+    if (pressed_count <= sizeof(boot_key_report.keys)) {
+        update_boot_keys();
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the keyboard reports for both HID protocols, which are
+// kept up to date as keys go up and down.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_KEY_REPORT_H
+#define STENOSAURUS_FIRMWARE_KEY_REPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The report used with the boot protocol. keys has the first six keys pressed
+// in the order that they were pressed, or all ErrorRollOver if more than six
+// are down.
+typedef struct {
+    uint8_t modifiers;
+    uint8_t reserved;
+    uint8_t keys[6];
+} boot_report;
+
+// The report used with the report protocol, as described by the keyboard
+// report descriptor in usb.c: a byte of modifiers then a bitmap of keys 0 to
+// 247.
+extern uint8_t nkro_key_report[32];
+
+extern boot_report boot_key_report;
+
+// Releases every key.
+void key_report_clear(void);
+
+// Presses or releases a key. Keys 0xE0 to 0xE7 are the modifiers. Returns
+// true if the reports changed.
+bool key_report_down(uint8_t usb_keycode);
+bool key_report_up(uint8_t usb_keycode);
+
+#endif // STENOSAURUS_FIRMWARE_KEY_REPORT_H
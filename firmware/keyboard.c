@@ -20,32 +20,201 @@
 
 #include "keyboard.h"
 
+#include "events.h"
+#include "stats.h"
+#include "stroke.h"
+#include "usb.h"
 #include <stdint.h>
 
-
-/*
+// Key events wait in a single producer, single consumer ring. The producer
+// only writes head and the consumer only writes tail, so neither needs to
+// mask interrupts as long as there is only one of each. head and tail count
+// forever and wrap, which is fine since the size is a power of two.
+//
+// When the ring is full new events are refused rather than old ones dropped.
+// Dropping an old key up would leave a key held down on the host, while a
+// refused event is the producer's to retry, and keyboard_type() only ever
+// queues whole characters.
 #define FIFO_SIZE 256
-static struct {
-	uint32_t front;
-	uint32_t count;
-	keyboard_event data[FIFO_SIZE];
-} key_fifo;
-*/
-
-/*
-void keyboard_add_event(keyboard_event event) {
-	uint32_t write_index = (key_fifo.front + key_fifo.count) % FIFO_SIZE;
-	key_fifo[write_index] = event;
-	// If we reached the end then throw away the oldest element.
-	if (count == FIFO_SIZE) {
-
-	}
-	// If we've circled around then drop the oldest entry.
-	if (write_index == front) {
-		front = ()
-	}
-	key_fifo[write] = event;
-	write = (write + 1) % FIFO_SIZE;
-	if (write > BUFFER_SIZE)
-}
-*/
+static keyboard_event fifo[FIFO_SIZE];
+static uint32_t fifo_head;
+static uint32_t fifo_tail;
+
+uint32_t keyboard_space(void) {
+    uint32_t tail = __atomic_load_n(&fifo_tail, __ATOMIC_ACQUIRE);
+    return FIFO_SIZE - (fifo_head - tail);
+}
+
+bool keyboard_add_event(keyboard_event event) {
+    uint32_t space = keyboard_space();
+    if (space == 0) {
+        stats_increment(STAT_KEY_EVENTS_REFUSED);
+        events_post(EVENT_OVERFLOW, OVERFLOW_KEY_EVENTS);
+        return false;
+    }
+    fifo[fifo_head % FIFO_SIZE] = event;
+    __atomic_store_n(&fifo_head, fifo_head + 1, __ATOMIC_RELEASE);
+    stats_increment(STAT_KEY_EVENTS);
+    stats_max(STAT_KEY_FIFO_HIGH_WATER, FIFO_SIZE - space + 1);
+    return true;
+}
+
+// The key for each printable ASCII character from space to tilde on a US
+// layout, with SHIFTED set if shift must be held. Letters and digits are
+// worked out in ascii_to_key().
+#define SHIFTED 0x80
+static const uint8_t PUNCTUATION_KEYS['~' - ' ' + 1] = {
+    [' ' - ' '] = KEY_SPACE,
+    ['!' - ' '] = SHIFTED | KEY_1,
+    ['"' - ' '] = SHIFTED | KEY_QUOTE,
+    ['#' - ' '] = SHIFTED | KEY_3,
+    ['$' - ' '] = SHIFTED | KEY_4,
+    ['%' - ' '] = SHIFTED | KEY_5,
+    ['&' - ' '] = SHIFTED | KEY_7,
+    ['\'' - ' '] = KEY_QUOTE,
+    ['(' - ' '] = SHIFTED | KEY_9,
+    [')' - ' '] = SHIFTED | KEY_0,
+    ['*' - ' '] = SHIFTED | KEY_8,
+    ['+' - ' '] = SHIFTED | KEY_EQUALS,
+    [',' - ' '] = KEY_COMMA,
+    ['-' - ' '] = KEY_MINUS,
+    ['.' - ' '] = KEY_PERIOD,
+    ['/' - ' '] = KEY_SLASH,
+    [':' - ' '] = SHIFTED | KEY_SEMICOLON,
+    [';' - ' '] = KEY_SEMICOLON,
+    ['<' - ' '] = SHIFTED | KEY_COMMA,
+    ['=' - ' '] = KEY_EQUALS,
+    ['>' - ' '] = SHIFTED | KEY_PERIOD,
+    ['?' - ' '] = SHIFTED | KEY_SLASH,
+    ['@' - ' '] = SHIFTED | KEY_2,
+    ['[' - ' '] = KEY_LEFT_BRACE,
+    ['\\' - ' '] = KEY_BACKSLASH,
+    [']' - ' '] = KEY_RIGHT_BRACE,
+    ['^' - ' '] = SHIFTED | KEY_6,
+    ['_' - ' '] = SHIFTED | KEY_MINUS,
+    ['`' - ' '] = KEY_BACKQUOTE,
+    ['{' - ' '] = SHIFTED | KEY_LEFT_BRACE,
+    ['|' - ' '] = SHIFTED | KEY_BACKSLASH,
+    ['}' - ' '] = SHIFTED | KEY_RIGHT_BRACE,
+    ['~' - ' '] = SHIFTED | KEY_BACKQUOTE,
+};
+
+// Returns the key for c with SHIFTED set if it needs shift, or zero if it
+// can't be typed.
+static uint8_t ascii_to_key(char c) {
+    if (c >= 'a' && c <= 'z') {
+        return KEY_A + (c - 'a');
+    } else if (c >= 'A' && c <= 'Z') {
+        return SHIFTED | (KEY_A + (c - 'A'));
+    } else if (c >= '1' && c <= '9') {
+        return KEY_1 + (c - '1');
+    } else if (c == '0') {
+        return KEY_0;
+    } else if (c == '\n') {
+        return KEY_ENTER;
+    } else if (c == '\t') {
+        return KEY_TAB;
+    } else if (c >= ' ' && c <= '~') {
+        return PUNCTUATION_KEYS[c - ' '];
+    }
+    return 0;
+}
+
+uint32_t keyboard_type(const char *text) {
+    uint32_t typed = 0;
+    for (; *text; ++text, ++typed) {
+        uint8_t key = ascii_to_key(*text);
+        if (key == 0) continue;
+        bool shift = key & SHIFTED;
+        if (keyboard_space() < (shift ? 4u : 2u)) break;
+        if (shift) {
+            keyboard_add_event((keyboard_event){KEY_LEFT_SHIFT, true});
+        }
+        keyboard_add_event((keyboard_event){key & ~SHIFTED, true});
+        keyboard_add_event((keyboard_event){key & ~SHIFTED, false});
+        if (shift) {
+            keyboard_add_event((keyboard_event){KEY_LEFT_SHIFT, false});
+        }
+    }
+    return typed;
+}
+
+// The key for each stroke bit on Plover's QWERTY layout, from stroke.h.
+static const uint8_t STROKE_KEYS[STENO_KEY_COUNT] = {
+#define QWERTY_KEY(name, label, bit, txbolt_byte, txbolt_bit, gemini_byte, \
+                   gemini_bit, plover_key, key) \
+    [bit] = key,
+    STENO_LAYOUT(QWERTY_KEY)
+#undef QWERTY_KEY
+};
+
+bool keyboard_stroke(uint32_t stroke) {
+    stroke &= STENO_ALL_KEYS;
+    if (keyboard_space() < 2u * __builtin_popcount(stroke)) return false;
+    for (uint32_t s = stroke; s; s &= s - 1) {
+        keyboard_add_event(
+            (keyboard_event){STROKE_KEYS[__builtin_ctz(s)], true});
+    }
+    for (uint32_t s = stroke; s; s &= s - 1) {
+        keyboard_add_event(
+            (keyboard_event){STROKE_KEYS[__builtin_ctz(s)], false});
+    }
+    return true;
+}
+
+static bool overlap = true;
+
+void keyboard_set_overlap(bool enable) {
+    overlap = enable;
+}
+
+static bool is_modifier(uint8_t keycode) {
+    return keycode >= KEY_LEFT_CONTROL && keycode <= KEY_RIGHT_GUI;
+}
+
+// Events are gathered into one report for as long as the host will still
+// see the same thing as if each had its own report. So a key can only change
+// once per report, and a key can't be pressed in the same report as a
+// modifier changes since the host might apply either modifier state to it.
+// Releases go with anything. This puts the next key down in the same report
+// as the last key up, which nearly halves the reports for ordinary text.
+//
+// usb.c sets the pace, which is the host's polling rate. Once it knows when
+// the host polls it only asks for a report just before, so that the report has
+// every event that arrived in time.
+void keyboard_poll(void) {
+    while (usb_keyboard_report_due()) {
+        uint8_t changed[32] = {0};
+        bool modifier_changed = false;
+        bool key_pressed = false;
+        uint32_t events = 0;
+        for (;;) {
+            uint32_t head = __atomic_load_n(&fifo_head, __ATOMIC_ACQUIRE);
+            if (fifo_tail == head) break;
+            keyboard_event event = fifo[fifo_tail % FIFO_SIZE];
+            uint8_t byte = event.keycode / 8;
+            uint8_t bit = 1 << (event.keycode % 8);
+            bool modifier = is_modifier(event.keycode);
+            if (events > 0 && (!overlap || (changed[byte] & bit) ||
+                               (modifier && key_pressed) ||
+                               (!modifier && event.down && modifier_changed))) {
+                break;
+            }
+            // The event stays in the ring if usb.c has no room for it.
+            if (!(event.down ? usb_keyboard_key_down(event.keycode)
+                             : usb_keyboard_key_up(event.keycode))) {
+                break;
+            }
+            __atomic_store_n(&fifo_tail, fifo_tail + 1, __ATOMIC_RELEASE);
+            changed[byte] |= bit;
+            if (modifier) {
+                modifier_changed = true;
+            } else if (event.down) {
+                key_pressed = true;
+            }
+            ++events;
+        }
+        if (events == 0) break;
+        usb_send_keys_if_changed();
+    }
+}
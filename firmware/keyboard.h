@@ -30,6 +30,40 @@ typedef struct {
 	bool down;
 } keyboard_event;
 
+// Key events are queued here and turned into USB keyboard reports as fast as
+// the host takes them, so the code producing them never waits. Only one
+// context, such as the main loop, may add events.
+
+// Queues an event. Returns false if the queue is full, in which case the event
+// is counted in STAT_KEY_EVENTS_REFUSED and the caller should try again
+// later.
+bool keyboard_add_event(keyboard_event event);
+
+// Returns the number of events that can be queued right now. Callers adding a
+// sequence that must not be cut short, like a key down and its key up, should
+// check this first.
+uint32_t keyboard_space(void);
+
+// Queues the key presses that type text on a US layout. Characters that have
+// no key are skipped. Returns the number of characters dealt with, which is
+// less than the length of text if the queue filled up. Only whole characters
+// are queued so no key is left down.
+uint32_t keyboard_type(const char *text);
+
+// Queues a stroke, as in stroke.h, as the QWERTY keys that Plover's keyboard
+// machine reads: every key of the stroke goes down and then they all come up.
+// Returns false, and queues nothing, if there isn't room for all of it.
+bool keyboard_stroke(uint32_t stroke);
+
+// Turns queued events into keyboard reports while the USB side has room for
+// them. Events are overlapped into shared reports where the host can't tell
+// the difference. Call this from the main loop.
+void keyboard_poll(void);
+
+// Turns overlapping on or off. It is on by default. Off gives every event its
+// own report.
+void keyboard_set_overlap(bool enable);
+
 // From HID Usage tables chapter 10 (page 53):
 // http://www.usb.org/developers/devclass_docs/Hut1_11.pdf
 enum {
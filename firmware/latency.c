@@ -0,0 +1,117 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the latency histograms. See the header file for
+// interface documentation to this code.
+//
+// Times are taken from the DWT cycle counter so they have a resolution of one
+// clock cycle. Each stage keeps a count, the smallest and largest time and a
+// histogram where bucket 0 counts times of 0 cycles and bucket n counts times
+// from 2^(n-1) up to 2^n - 1 cycles. That's enough to read off percentiles to
+// within a factor of two, which is what matters for finding the tail, in a few
+// hundred bytes.
+//
+// STREAM_LATENCY is the histograms for each stage in latency_stage order, laid
+// out as little endian 4 byte values: [count] [min] [max] [buckets (33)]. The
+// stream reads the live histograms so a read that races with a keystroke can
+// see part of its update.
+
+#include "latency.h"
+
+#include "clock.h"
+#include <libopencm3/cm3/cortex.h>
+
+#define LATENCY_BUCKETS 33
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} histogram;
+
+static histogram histograms[LATENCY_STAGES];
+
+// When each point was last reached, when the key change that led to it
+// happened, and whether the stage starting at it is waiting to be measured.
+static uint32_t point_cycles[LATENCY_SENT + 1];
+static uint32_t origin_cycles[LATENCY_SENT + 1];
+static bool armed[LATENCY_SENT + 1];
+
+static void record(latency_stage stage, uint32_t cycles) {
+    histogram *h = &histograms[stage];
+    if (h->count == 0 || cycles < h->min) h->min = cycles;
+    if (cycles > h->max) h->max = cycles;
+    ++h->count;
+    int bucket = cycles == 0 ? 0 : 32 - __builtin_clz(cycles);
+    ++h->buckets[bucket];
+}
+
+void latency_mark(latency_point point) {
+    latency_mark_at(point, clock_cycles());
+}
+
+// Points are marked from the matrix interrupt, the USB interrupt and the main
+// loop, and any of them can interrupt another in the middle of handing a point
+// on, so the hand over is done with interrupts masked. It's a few dozen
+// instructions.
+void latency_mark_at(latency_point point, uint32_t now) {
+    uint32_t mask = cm_mask_interrupts(1);
+    if (point == LATENCY_KEY_CHANGE) {
+        origin_cycles[point] = now;
+    } else {
+        latency_point previous = point - 1;
+        if (!armed[previous]) {
+            cm_mask_interrupts(mask);
+            return;
+        }
+        armed[previous] = false;
+        record((latency_stage)previous, now - point_cycles[previous]);
+        origin_cycles[point] = origin_cycles[previous];
+        if (point == LATENCY_SENT) {
+            record(LATENCY_KEY_TO_SENT, now - origin_cycles[point]);
+            cm_mask_interrupts(mask);
+            return;
+        }
+    }
+    point_cycles[point] = now;
+    armed[point] = true;
+    cm_mask_interrupts(mask);
+}
+
+void latency_reset(void) {
+    uint32_t *p = (uint32_t *)histograms;
+    for (uint32_t i = 0; i < sizeof(histograms) / 4; ++i) {
+        p[i] = 0;
+    }
+}
+
+static uint32_t latency_read_begin(void) {
+    return sizeof(histograms);
+}
+
+static void latency_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    const uint8_t *data = (const uint8_t *)histograms + offset;
+    for (uint32_t i = 0; i < length; ++i) {
+        buffer[i] = data[i];
+    }
+}
+
+const stream latency_stream = {
+    .read_begin = latency_read_begin,
+    .read = latency_read,
+};
@@ -0,0 +1,70 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines latency measurements for keystrokes on their way through
+// the firmware to the host.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_LATENCY_H
+#define STENOSAURUS_FIRMWARE_LATENCY_H
+
+#include "stream.h"
+
+// The points that a keystroke passes on its way to the host, in order.
+typedef enum {
+    // A key was pressed or released, timed from the first scan that saw it
+    // before debouncing.
+    LATENCY_KEY_CHANGE,
+    // A stroke was completed.
+    LATENCY_STROKE,
+    // The keyboard report with the stroke was handed to the USB peripheral.
+    LATENCY_QUEUED,
+    // The host read the keyboard report.
+    LATENCY_SENT,
+} latency_point;
+
+// The stages that are measured. Each one is the time between two points, and
+// the last is the total from the key change to the host.
+typedef enum {
+    LATENCY_KEY_TO_STROKE,
+    LATENCY_STROKE_TO_QUEUED,
+    LATENCY_QUEUED_TO_SENT,
+    LATENCY_KEY_TO_SENT,
+    LATENCY_STAGES
+} latency_stage;
+
+// Records that a keystroke reached a point. The stage ending at this point is
+// measured if the point before it was reached since it was last measured.
+// Points may be recorded from any context: LATENCY_KEY_CHANGE comes from the
+// matrix scanner's interrupt, LATENCY_STROKE from the main loop,
+// LATENCY_QUEUED from either the main loop or the USB interrupt and
+// LATENCY_SENT from the USB interrupt.
+void latency_mark(latency_point point);
+
+// Records that a keystroke reached a point at an earlier time, given as
+// clock_cycles().
+void latency_mark_at(latency_point point, uint32_t cycles);
+
+// Clears all of the histograms.
+void latency_reset(void);
+
+// The histograms as a stream that the host can read. See the .c file for the
+// layout.
+extern const stream latency_stream;
+
+#endif // STENOSAURUS_FIRMWARE_LATENCY_H
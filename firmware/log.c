@@ -0,0 +1,125 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements deferred logging. See the header file for interface
+// documentation to this code.
+//
+// Messages are kept in a ring of words. Each one is a header word, a
+// timestamp and then its arguments. The header is the format string's offset
+// from the start of flash shifted left by two with the argument count in the
+// low two bits. Flash is 256K so the offset fits with room to spare. A message
+// is written with interrupts masked, which is a dozen instructions, so that
+// messages from interrupts don't get mixed into each other.
+//
+// STREAM_LOG reads [messages dropped since the last read] followed by the
+// messages that are waiting, all as little endian 4 byte words, with each
+// message laid out as [header] [system_millis] [arguments...]. The messages
+// are dropped from the ring once they have been read.
+
+#include "log.h"
+
+#include "clock.h"
+#include <libopencm3/cm3/cortex.h>
+
+static const uint32_t FLASH_START = 0x08000000;
+
+// The number of words in the ring. It must be a power of two.
+#define LOG_WORDS 512
+
+static uint32_t ring[LOG_WORDS];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t dropped;
+
+static void write_message(const char *format, uint32_t count,
+                          uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t header = (((uint32_t)format - FLASH_START) << 2) | count;
+    uint32_t mask = cm_mask_interrupts(1);
+    if (LOG_WORDS - (head - tail) < 2 + count) {
+        ++dropped;
+    } else {
+        ring[head++ % LOG_WORDS] = header;
+        ring[head++ % LOG_WORDS] = system_millis;
+        if (count > 0) ring[head++ % LOG_WORDS] = a;
+        if (count > 1) ring[head++ % LOG_WORDS] = b;
+        if (count > 2) ring[head++ % LOG_WORDS] = c;
+    }
+    cm_mask_interrupts(mask);
+}
+
+void log_0(const char *format) {
+    write_message(format, 0, 0, 0, 0);
+}
+
+void log_1(const char *format, uint32_t a) {
+    write_message(format, 1, a, 0, 0);
+}
+
+void log_2(const char *format, uint32_t a, uint32_t b) {
+    write_message(format, 2, a, b, 0);
+}
+
+void log_3(const char *format, uint32_t a, uint32_t b, uint32_t c) {
+    write_message(format, 3, a, b, c);
+}
+
+// What the current read covers: the dropped count at the start and the
+// messages in [read_start, read_start + read_words).
+static uint32_t read_dropped;
+static uint32_t read_start;
+static uint32_t read_words;
+
+static uint32_t log_read_begin(void) {
+    uint32_t mask = cm_mask_interrupts(1);
+    read_dropped = dropped;
+    read_start = tail;
+    read_words = head - tail;
+    cm_mask_interrupts(mask);
+    return (1 + read_words) * 4;
+}
+
+static void log_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    for (uint32_t i = offset; i < offset + length; ++i) {
+        uint32_t word = i < 4 ? read_dropped
+                              : ring[(read_start + i / 4 - 1) % LOG_WORDS];
+        *buffer++ = word >> (8 * (i % 4));
+    }
+}
+
+// Only whole messages are dropped from the ring, so a read that was cut short
+// leaves the rest to be read again.
+static void log_read_end(uint32_t length) {
+    uint32_t mask = cm_mask_interrupts(1);
+    if (length >= 4) {
+        dropped -= read_dropped;
+    }
+    uint32_t words = length / 4 > 0 ? length / 4 - 1 : 0;
+    uint32_t consumed = 0;
+    while (consumed < read_words) {
+        uint32_t size = 2 + (ring[(read_start + consumed) % LOG_WORDS] & 3);
+        if (consumed + size > words) break;
+        consumed += size;
+    }
+    tail = read_start + consumed;
+    cm_mask_interrupts(mask);
+}
+
+const stream log_stream = {
+    .read_begin = log_read_begin,
+    .read = log_read,
+    .read_end = log_read_end,
+};
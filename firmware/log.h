@@ -0,0 +1,45 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines deferred logging. Log calls only record the address of the
+// format string and the raw arguments, and the host does the formatting later,
+// so they're cheap enough to leave in everywhere.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_LOG_H
+#define STENOSAURUS_FIRMWARE_LOG_H
+
+#include "stream.h"
+#include <stdint.h>
+
+// Records a message. The format must be a string literal since the host reads
+// it from firmware.elf by its address. It uses printf conventions with each
+// argument passed as a 32 bit word; %s arguments must also be string literals.
+// If the format has no conversions then the arguments are printed after it in
+// hex. These never block and may be called from interrupts. Messages that
+// don't fit in the buffer are counted and dropped.
+void log_0(const char *format);
+void log_1(const char *format, uint32_t a);
+void log_2(const char *format, uint32_t a, uint32_t b);
+void log_3(const char *format, uint32_t a, uint32_t b, uint32_t c);
+
+// The messages as a stream that the host drains. See the .c file for the
+// layout.
+extern const stream log_stream;
+
+#endif // STENOSAURUS_FIRMWARE_LOG_H
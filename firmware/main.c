@@ -18,12 +18,20 @@
 // This file is the main entry point for the stenosaurus firmware.
 
 #include "../common/user_button.h"
+#include "bulk.h"
+#include "chord.h"
 #include "clock.h"
 #include "debug.h"
+#include "dictionary.h"
+#include "encoder.h"
+#include "events.h"
+#include "latency.h"
+#include "matrix.h"
+#include "memory.h"
 #include "protocol.h"
 #include "sdio.h"
-#include "stroke.h"
-#include "txbolt.h"
+#include "stats.h"
+#include "trace.h"
 #include "usb.h"
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/crc.h>
@@ -34,49 +42,87 @@
 
 #include "../common/leds.h"
 
+// The most strokes that are taken from the chord engine and encoded for the
+// serial port at once.
+#define SERIAL_BATCH 8
+
+// Hands new strokes to each output that is ready for them. Each output takes
+// them from the chord engine on its own, so one that the host isn't reading
+// doesn't hold up the others.
+static void send_strokes(void) {
+    chord_stroke stroke;
+    while (chord_peek(CHORD_OUTPUT_KEYBOARD, &stroke) &&
+           keyboard_stroke(stroke.keys)) {
+        latency_mark(LATENCY_STROKE);
+        chord_pop(CHORD_OUTPUT_KEYBOARD);
+    }
+
+    // Strokes that come in together, like a burst of repeats, are encoded in
+    // one go and written to the serial port in one go.
+    uint32_t serial_strokes[SERIAL_BATCH];
+    uint32_t serial_count = 0;
+    while (serial_count < SERIAL_BATCH &&
+           usb_serial_space() >= (serial_count + 1) * ENCODER_MAX_BYTES &&
+           chord_peek(CHORD_OUTPUT_SERIAL, &stroke)) {
+        serial_strokes[serial_count++] = stroke.keys;
+        chord_pop(CHORD_OUTPUT_SERIAL);
+    }
+    if (serial_count != 0) {
+        uint8_t serial[SERIAL_BATCH * ENCODER_MAX_BYTES];
+        usb_send_serial_data(
+            serial, encoder_encode(serial_strokes, serial_count, serial));
+    }
+
+    // The Plover HID interface has its own queue, which drops strokes that
+    // nobody reads.
+    while (chord_peek(CHORD_OUTPUT_PLOVER_HID, &stroke)) {
+        usb_send_plover_stroke(stroke.keys);
+        chord_pop(CHORD_OUTPUT_PLOVER_HID);
+    }
+
+    while (chord_peek(CHORD_OUTPUT_EVENTS, &stroke)) {
+        TRACE(TRACE_STROKE, stroke.keys);
+        led_toggle(0);
+        stats_stroke(stroke.keys);
+        events_post(EVENT_STROKE, stroke.keys);
+        events_post(EVENT_STROKE_PRESS, stroke.press_cycles);
+        events_post(EVENT_STROKE_RELEASE, stroke.release_cycles);
+        chord_pop(CHORD_OUTPUT_EVENTS);
+    }
+}
+
 int main(void) {
+    memory_init();
     clock_init();
 
     setup_user_button();
 
     setup_leds();
 
-    usb_init(packet_handler);
-    //sdio_init();
+    dictionary_init();
+    protocol_init();
+    usb_init(packet_handler, packet_source);
+    sdio_card_detect_init();
+    matrix_init();
 
     //bool card_initialized = false;
 
-    bool pressed = false;
+    bool card_present = sdio_card_present();
 
     while (true) {
-        if (is_user_button_pressed()) {
-            if (!pressed) {
-                led_toggle(0);
-                usb_keyboard_key_down(KEY_Q);
-                usb_keyboard_key_down(KEY_W);
-                usb_keyboard_key_down(KEY_E);
-                usb_keyboard_key_down(KEY_R);
-                usb_keyboard_key_down(KEY_U);
-                usb_keyboard_key_down(KEY_I);
-                usb_keyboard_key_down(KEY_O);
-                usb_keyboard_key_down(KEY_P);
-                pressed = true;                
-            }
-        } else {
-            if (pressed) {
-                usb_keyboard_key_up(KEY_Q);
-                usb_keyboard_key_up(KEY_W);
-                usb_keyboard_key_up(KEY_E);
-                usb_keyboard_key_up(KEY_R);
-                usb_keyboard_key_up(KEY_U);
-                usb_keyboard_key_up(KEY_I);
-                usb_keyboard_key_up(KEY_O);
-                usb_keyboard_key_up(KEY_P);
-                led_toggle(0);
-                pressed = false;                
-            }
+        send_strokes();
+        if (sdio_card_present() != card_present) {
+            card_present = !card_present;
+            events_post(card_present ? EVENT_SD_INSERTED : EVENT_SD_REMOVED,
+                        0);
         }
+
+        keyboard_poll();
         usb_send_keys_if_changed();
+        protocol_poll();
+        bulk_poll();
+        usb_serial_poll();
+        stats_poll();
 
 #if 0
         if (sdio_card_present() && !card_initialized) {
@@ -96,14 +142,5 @@ int main(void) {
             card_initialized = false;
         }
 #endif
-
-#if 0
-        if (is_user_button_pressed()) {
-            packet txbolt_packet;
-            uint32_t stroke = string_to_stroke("PHRO*FR");
-            make_packet(stroke, &txbolt_packet);
-            serial_usb_send_data(&txbolt_packet.byte[0], txbolt_packet.length);
-        }
-#endif
     }
 }
@@ -0,0 +1,180 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the key matrix scanner. See the header file for
+// interface documentation to this code.
+//
+// The rows are on PB12-PB15 as open drain outputs and the columns are on
+// PB5-PB11 as inputs with pull-ups. A row is scanned by pulling it low and
+// reading which columns follow it down. Each key needs a diode, with its
+// cathode towards the row, so that keys held in other rows don't show through.
+//
+// The CPU doesn't take part in a scan. TIM2 ticks once per row. Its update
+// event has DMA1 channel 2 copy the next word of the drive table to GPIOB_BSRR,
+// which releases the last row and pulls the next one low in one write. Half a
+// tick later, once the columns have settled, capture compare 1 has DMA1
+// channel 5 copy GPIOB_IDR into the sample buffer. Both channels run in
+// circular mode.
+//
+// The sample buffer holds two scans. DMA raises the half transfer interrupt
+// when the first is complete and the transfer complete interrupt for the
+// second, so the interrupt handler always has a whole scan that isn't being
+// written to. That interrupt, once per scan, is all of the CPU time that the
+// scanner needs.
+//
+// The timer's period and compare value are preloaded so a rate change takes
+// effect at the next update event without a sample landing on the wrong row.
+
+#include "matrix.h"
+
+#include "chord.h"
+#include "clock.h"
+#include "debounce.h"
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <stdint.h>
+
+#define ROW_SHIFT 12
+#define ROW_PINS (GPIO12 | GPIO13 | GPIO14 | GPIO15)
+#define COLUMN_SHIFT 5
+#define COLUMN_PINS (GPIO5 | GPIO6 | GPIO7 | GPIO8 | GPIO9 | GPIO10 | GPIO11)
+
+// TIM2 is clocked at 48Mhz.
+#define TIMER_HZ 48000000
+
+// The BSRR words that drive each row. Entry n releases every row and pulls row
+// n + 1 low, since row 0 is pulled low before the timer starts and the first
+// update event comes after the first sample.
+static uint32_t drive[MATRIX_ROWS];
+
+static volatile uint16_t samples[2 * MATRIX_ROWS];
+
+static volatile uint32_t latest;
+static volatile uint32_t scans;
+static volatile uint32_t cycles;
+static uint32_t rate;
+
+void matrix_init(void) {
+    rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_IOPBEN);
+    rcc_peripheral_enable_clock(&RCC_APB1ENR, RCC_APB1ENR_TIM2EN);
+    rcc_peripheral_enable_clock(&RCC_AHBENR, RCC_AHBENR_DMA1EN);
+
+    gpio_set_mode(GPIOB, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN,
+                  COLUMN_PINS);
+    // Setting the output register selects the pull-ups.
+    gpio_set(GPIOB, COLUMN_PINS);
+    gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_10_MHZ, GPIO_CNF_OUTPUT_OPENDRAIN,
+                  ROW_PINS);
+
+    for (int i = 0; i < MATRIX_ROWS; ++i) {
+        uint32_t row = 1 << (ROW_SHIFT + (i + 1) % MATRIX_ROWS);
+        drive[i] = (ROW_PINS & ~row) | (row << 16);
+    }
+    GPIOB_BSRR = drive[MATRIX_ROWS - 1];
+
+    dma_channel_reset(DMA1, DMA_CHANNEL2);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL2, (uint32_t)&GPIOB_BSRR);
+    dma_set_memory_address(DMA1, DMA_CHANNEL2, (uint32_t)drive);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL2, MATRIX_ROWS);
+    dma_set_read_from_memory(DMA1, DMA_CHANNEL2);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL2);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL2, DMA_CCR_PSIZE_32BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL2, DMA_CCR_MSIZE_32BIT);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL2);
+    dma_set_priority(DMA1, DMA_CHANNEL2, DMA_CCR_PL_HIGH);
+    dma_enable_channel(DMA1, DMA_CHANNEL2);
+
+    dma_channel_reset(DMA1, DMA_CHANNEL5);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL5, (uint32_t)&GPIOB_IDR);
+    dma_set_memory_address(DMA1, DMA_CHANNEL5, (uint32_t)samples);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL5, 2 * MATRIX_ROWS);
+    dma_set_read_from_peripheral(DMA1, DMA_CHANNEL5);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_16BIT);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL5);
+    dma_set_priority(DMA1, DMA_CHANNEL5, DMA_CCR_PL_HIGH);
+    dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL5);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+    nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+    dma_enable_channel(DMA1, DMA_CHANNEL5);
+
+    timer_reset(TIM2);
+    timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_enable_preload(TIM2);
+    timer_enable_oc_preload(TIM2, TIM_OC1);
+    matrix_set_rate(MATRIX_DEFAULT_RATE);
+    // Load the preloaded period and compare value now rather than at the
+    // first update event, which would also start a DMA transfer.
+    timer_generate_event(TIM2, TIM_EGR_UG);
+    timer_clear_flag(TIM2, TIM_SR_UIF);
+    // These enable DMA requests rather than interrupts.
+    timer_enable_irq(TIM2, TIM_DIER_UDE | TIM_DIER_CC1DE);
+    timer_enable_counter(TIM2);
+}
+
+void matrix_set_rate(uint32_t rate_hz) {
+    uint32_t ticks = TIMER_HZ / (rate_hz * MATRIX_ROWS);
+    timer_set_period(TIM2, ticks - 1);
+    timer_set_oc_value(TIM2, TIM_OC1, ticks / 2);
+    debounce_set_rate(rate_hz);
+    rate = rate_hz;
+}
+
+uint32_t matrix_rate(void) {
+    return rate;
+}
+
+uint32_t matrix_read(void) {
+    return latest;
+}
+
+uint32_t matrix_scans(void) {
+    return scans;
+}
+
+uint32_t matrix_cycles(void) {
+    return cycles;
+}
+
+// Called when DMA has filled either half of the sample buffer.
+void dma1_channel5_isr(void) {
+    uint32_t start = clock_cycles();
+    const volatile uint16_t *scan = samples;
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL5, DMA_TCIF)) {
+        scan += MATRIX_ROWS;
+    }
+    dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_HTIF | DMA_TCIF);
+
+    uint32_t keys = 0;
+    for (int row = 0; row < MATRIX_ROWS; ++row) {
+        uint32_t columns = (~scan[row] & COLUMN_PINS) >> COLUMN_SHIFT;
+        keys |= columns << (row * MATRIX_COLUMNS);
+    }
+    // The user button pulls PA9 low.
+    if (!(GPIOA_IDR & GPIO9)) {
+        keys |= 1u << MATRIX_USER_BUTTON;
+    }
+    latest = keys;
+    debounce_scan(keys);
+    chord_scan(keys, debounce_read(), start);
+    ++scans;
+    cycles += clock_cycles() - start;
+}
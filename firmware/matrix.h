@@ -0,0 +1,59 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the key matrix scanner.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_MATRIX_H
+#define STENOSAURUS_FIRMWARE_MATRIX_H
+
+#include <stdint.h>
+
+#define MATRIX_ROWS 4
+#define MATRIX_COLUMNS 7
+// The bit for the user button on PA9, which is sampled with the matrix so
+// that it is debounced the same way.
+#define MATRIX_USER_BUTTON 31
+
+// The range of scan rates, in whole matrix scans a second.
+#define MATRIX_MIN_RATE 1000
+#define MATRIX_MAX_RATE 10000
+#define MATRIX_DEFAULT_RATE 1000
+
+// Starts scanning at MATRIX_DEFAULT_RATE.
+void matrix_init(void);
+
+// Changes the scan rate. rate_hz must be between MATRIX_MIN_RATE and
+// MATRIX_MAX_RATE.
+void matrix_set_rate(uint32_t rate_hz);
+
+uint32_t matrix_rate(void);
+
+// The most recent scan, with bit (row * MATRIX_COLUMNS + column) set for each
+// key that was down. This is the raw switch state. Each scan is also passed to
+// debounce_scan(), and debounce_read() has the debounced state.
+uint32_t matrix_read(void);
+
+// The number of scans since matrix_init.
+uint32_t matrix_scans(void);
+
+// The clock cycles spent in the scanner's interrupt handler since
+// matrix_init. This is all of the CPU time the scanner takes.
+uint32_t matrix_cycles(void);
+
+#endif // STENOSAURUS_FIRMWARE_MATRIX_H
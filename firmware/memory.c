@@ -0,0 +1,123 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the RAM measurements. See the header file for interface
+// documentation to this code.
+//
+// RAM is laid out by the linker script as .data, then .bss, then free space
+// that the stack grows down into from the top. Unused memory is painted with
+// a pattern and the high-water mark is where the pattern was first
+// overwritten. Painting can only show the deepest the stack has been since it
+// was painted, and a buffer whose data happens to end with the pattern reads a
+// little short, but it costs nothing while running.
+//
+// STREAM_MEMORY is laid out as little endian 4 byte values: [RAM size] [.data
+// size] [.bss size] [stack space, from the end of .bss to the top of RAM]
+// [deepest stack use] [buffer count] then for each watched buffer: [id]
+// [size] [high-water mark]. Reading it scans the stack, which takes about a
+// millisecond.
+
+#include "memory.h"
+
+#include <stdbool.h>
+
+// From the linker script.
+extern uint32_t _data;
+extern uint32_t _edata;
+extern uint32_t _ebss;
+extern uint32_t _stack;
+
+static const uint32_t PAINT_WORD = 0xA5A5A5A5;
+static const uint8_t PAINT_BYTE = 0xA5;
+
+// How much of the stack above the current stack pointer memory_init leaves
+// alone for its own frame.
+static const uint32_t PAINT_MARGIN = 64;
+
+#define MAX_WATCHED 8
+static struct {
+    uint32_t id;
+    uint8_t *buffer;
+    uint32_t size;
+} watched[MAX_WATCHED];
+static uint32_t watched_count;
+
+void memory_init(void) {
+    uint32_t sp;
+    __asm__ volatile ("mov %0, sp" : "=r" (sp));
+    uint32_t *end = (uint32_t *)((sp - PAINT_MARGIN) & ~3);
+    for (uint32_t *p = &_ebss; p < end; ++p) {
+        *p = PAINT_WORD;
+    }
+}
+
+void memory_watch(memory_buffer id, void *buffer, uint32_t size) {
+    if (watched_count == MAX_WATCHED) {
+        return;
+    }
+    uint8_t *b = buffer;
+    for (uint32_t i = 0; i < size; ++i) {
+        b[i] = PAINT_BYTE;
+    }
+    watched[watched_count].id = id;
+    watched[watched_count].buffer = b;
+    watched[watched_count].size = size;
+    ++watched_count;
+}
+
+#define REPORT_WORDS (6 + 3 * MAX_WATCHED)
+static uint32_t report[REPORT_WORDS];
+
+static uint32_t memory_read_begin(void) {
+    uint32_t ram_size = (uint32_t)&_stack - (uint32_t)&_data;
+    uint32_t stack_space = (uint32_t)&_stack - (uint32_t)&_ebss;
+
+    const uint32_t *p = &_ebss;
+    while (p < &_stack && *p == PAINT_WORD) {
+        ++p;
+    }
+
+    uint32_t *r = report;
+    *r++ = ram_size;
+    *r++ = (uint32_t)&_edata - (uint32_t)&_data;
+    *r++ = (uint32_t)&_ebss - (uint32_t)&_edata;
+    *r++ = stack_space;
+    *r++ = (uint32_t)&_stack - (uint32_t)p;
+    *r++ = watched_count;
+    for (uint32_t i = 0; i < watched_count; ++i) {
+        uint32_t used = watched[i].size;
+        while (used != 0 && watched[i].buffer[used - 1] == PAINT_BYTE) {
+            --used;
+        }
+        *r++ = watched[i].id;
+        *r++ = watched[i].size;
+        *r++ = used;
+    }
+    return (r - report) * 4;
+}
+
+static void memory_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    const uint8_t *data = (const uint8_t *)report + offset;
+    for (uint32_t i = 0; i < length; ++i) {
+        buffer[i] = data[i];
+    }
+}
+
+const stream memory_stream = {
+    .read_begin = memory_read_begin,
+    .read = memory_read,
+};
@@ -0,0 +1,49 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines measurements of how much RAM the firmware really uses.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_MEMORY_H
+#define STENOSAURUS_FIRMWARE_MEMORY_H
+
+#include "stream.h"
+#include <stdint.h>
+
+// The buffers that can be watched. The host names them by these numbers so
+// only add to the end.
+typedef enum {
+    MEMORY_DICTIONARY = 1,
+    MEMORY_COMMAND_QUEUE = 2,
+    MEMORY_SD_BLOCK = 3,
+} memory_buffer;
+
+// Paints the unused part of the stack. Call this first thing in main so that
+// as much of the stack as possible is painted.
+void memory_init(void);
+
+// Paints a static buffer that starts out unused so that the host can see how
+// much of it is ever written. Buffers are expected to be filled from the
+// front.
+void memory_watch(memory_buffer id, void *buffer, uint32_t size);
+
+// The RAM use as a stream that the host can read. See the .c file for the
+// layout.
+extern const stream memory_stream;
+
+#endif // STENOSAURUS_FIRMWARE_MEMORY_H
@@ -0,0 +1,161 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the sampling profiler. See the header file for interface
+// documentation to this code.
+//
+// TIM3 interrupts at the sampling rate. The interrupt handler finds the
+// exception frame that the processor pushed on entry and takes the PC and LR
+// of the code it interrupted from it. LR is the return address of the
+// interrupted function if it hasn't saved it and called something else yet, so
+// a (PC, LR) pair is usually the function and its caller, which is enough for
+// a two level flame graph.
+//
+// Samples are counted in a hash table of (PC, LR) pairs. Typing load spends
+// its time in a few hundred places at most so the table is small. Samples that
+// don't fit are counted as dropped.
+//
+// TIM3 has the highest priority so that it can sample the other interrupt
+// handlers too. Every interrupt is at priority 0 out of reset and an interrupt
+// can't preempt one at the same priority, so starting the profiler moves the
+// USB, SysTick and matrix DMA interrupts down to priority 1. The STM32F1 only
+// implements the top four bits of each priority.
+//
+// STREAM_PROFILE is laid out as little endian 4 byte values: [samples]
+// [dropped] [rate] [entries] then the table, with each entry as [pc] [lr]
+// [count]. Empty entries have a count of zero. Sampling is paused while the
+// host reads the profile.
+
+#include "profiler.h"
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t pc;
+    uint32_t lr;
+    uint32_t count;
+} profile_entry;
+
+// The number of entries in the table. It must be a power of two.
+#define PROFILE_ENTRIES 256
+
+static struct {
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t rate;
+    uint32_t entries;
+    profile_entry table[PROFILE_ENTRIES];
+} profile = { .entries = PROFILE_ENTRIES };
+
+static volatile bool paused;
+
+void profiler_start(uint32_t rate_hz) {
+    rcc_peripheral_enable_clock(&RCC_APB1ENR, RCC_APB1ENR_TIM3EN);
+    timer_disable_counter(TIM3);
+    if (rate_hz == 0) {
+        return;
+    }
+
+    uint32_t *p = (uint32_t *)profile.table;
+    for (uint32_t i = 0; i < sizeof(profile.table) / 4; ++i) {
+        p[i] = 0;
+    }
+    profile.samples = 0;
+    profile.dropped = 0;
+    profile.rate = rate_hz;
+    paused = false;
+
+    // TIM3 is clocked at 48Mhz. Count microseconds.
+    timer_reset(TIM3);
+    timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(TIM3, 48 - 1);
+    timer_set_period(TIM3, 1000000 / rate_hz - 1);
+    timer_enable_irq(TIM3, TIM_DIER_UIE);
+    nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, 1 << 4);
+    nvic_set_priority(NVIC_SYSTICK_IRQ, 1 << 4);
+    nvic_set_priority(NVIC_DMA1_CHANNEL5_IRQ, 1 << 4);
+    nvic_set_priority(NVIC_TIM3_IRQ, 0);
+    nvic_enable_irq(NVIC_TIM3_IRQ);
+    timer_enable_counter(TIM3);
+}
+
+// Called by tim3_isr with the exception frame of the interrupted code, which
+// holds r0-r3, r12, lr, pc and xpsr in that order.
+void profiler_sample(const uint32_t *frame);
+void profiler_sample(const uint32_t *frame) {
+    timer_clear_flag(TIM3, TIM_SR_UIF);
+    if (paused) {
+        return;
+    }
+    uint32_t lr = frame[5];
+    uint32_t pc = frame[6];
+    ++profile.samples;
+
+    uint32_t hash = (pc ^ (lr * 31)) >> 1;
+    for (uint32_t i = 0; i < PROFILE_ENTRIES; ++i) {
+        profile_entry *entry = &profile.table[(hash + i) % PROFILE_ENTRIES];
+        if (entry->count == 0) {
+            entry->pc = pc;
+            entry->lr = lr;
+        }
+        if (entry->pc == pc && entry->lr == lr) {
+            ++entry->count;
+            return;
+        }
+    }
+    ++profile.dropped;
+}
+
+// The frame is on the main stack unless the interrupted code was using the
+// process stack, which bit 2 of the exception return value in LR says. This
+// has to be naked so that nothing is pushed before the stack pointer is read.
+void tim3_isr(void) __attribute__((naked));
+void tim3_isr(void) {
+    __asm__ volatile (
+        "tst lr, #4\n"
+        "ite eq\n"
+        "mrseq r0, msp\n"
+        "mrsne r0, psp\n"
+        "b profiler_sample\n"
+    );
+}
+
+static uint32_t profiler_read_begin(void) {
+    paused = true;
+    return sizeof(profile);
+}
+
+static void profiler_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    const uint8_t *data = (const uint8_t *)&profile + offset;
+    for (uint32_t i = 0; i < length; ++i) {
+        buffer[i] = data[i];
+    }
+}
+
+static void profiler_read_end(uint32_t length) {
+    (void)length;
+    paused = false;
+}
+
+const stream profiler_stream = {
+    .read_begin = profiler_read_begin,
+    .read = profiler_read,
+    .read_end = profiler_read_end,
+};
@@ -0,0 +1,42 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines a sampling profiler for the firmware.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_PROFILER_H
+#define STENOSAURUS_FIRMWARE_PROFILER_H
+
+#include "stream.h"
+#include <stdint.h>
+
+// Clears the profile and starts sampling rate_hz times a second. A rate of
+// zero stops sampling and keeps the profile. Any other rate must be between
+// PROFILER_MIN_RATE and PROFILER_MAX_RATE.
+void profiler_start(uint32_t rate_hz);
+
+// TIM3 counts microseconds in a 16 bit register, so the slowest rate is one
+// sample every 65536us.
+#define PROFILER_MIN_RATE 16
+#define PROFILER_MAX_RATE 20000
+
+// The profile as a stream that the host can read. See the .c file for the
+// layout.
+extern const stream profiler_stream;
+
+#endif // STENOSAURUS_FIRMWARE_PROFILER_H
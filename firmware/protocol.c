@@ -25,7 +25,24 @@
 #include "protocol.h"
 
 #include "../common/leds.h"
+#include "chord.h"
+#include "clock.h"
+#include "crc32.h"
+#include "debounce.h"
 #include "debug.h"
+#include "dictionary.h"
+#include "encoder.h"
+#include "events.h"
+#include "latency.h"
+#include "log.h"
+#include "matrix.h"
+#include "memory.h"
+#include "profiler.h"
+#include "sdio.h"
+#include "stats.h"
+#include "stream.h"
+#include "trace.h"
+#include "usb.h"
 #include <libopencm3/stm32/f1/bkp.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/pwr.h>
@@ -42,10 +59,45 @@ static const int REQUEST_VERIFY_PROGRAM = 4;
 static const int REQUEST_BOOTLOADER = 5;
 static const int REQUEST_RESET = 6;
 static const int REQUEST_DEBUG = 9;
+static const int REQUEST_SD_INIT = 10;
+static const int REQUEST_SD_READ = 11;
+static const int REQUEST_READ_STREAM = 12;
+static const int REQUEST_WRITE_STREAM = 13;
+static const int REQUEST_SEGMENT = 14;
+static const int REQUEST_SET_THRESHOLD = 15;
+static const int REQUEST_RESET_LATENCY = 16;
+static const int REQUEST_TRACE = 17;
+static const int REQUEST_PROFILE = 18;
+static const int REQUEST_SERIAL_BENCHMARK = 19;
+static const int REQUEST_MATRIX = 20;
+static const int REQUEST_CHORD_MODE = 21;
+static const int REQUEST_SERIAL_PROTOCOL = 22;
+static const int REQUEST_SERIAL_FLUSH = 23;
+static const int REQUEST_STROKE_OUTPUTS = 24;
 
 static const uint8_t RESPONSE_UNSOLICITED = 0;
 static const uint8_t RESPONSE_OK = 1;
 static const uint8_t RESPONSE_ERROR = 2;
+static const uint8_t RESPONSE_PENDING = 3;
+static const uint8_t RESPONSE_BUSY = 4;
+static const uint8_t RESPONSE_SEGMENT = 5;
+
+// Requests numbered REQUEST_SD_INIT and above are tagged. The host picks a tag
+// for each one and the device echoes it back so that responses can be matched
+// with requests even when they arrive out of order:
+//
+// Request:  [request] [tag] [arguments...]
+// Response: [status] [request] [tag] [results...]
+//
+// Fast requests are answered right away with RESPONSE_OK or RESPONSE_ERROR.
+// Slow requests are answered right away with RESPONSE_PENDING and are then run
+// from the main loop. When they finish the final response is sent as a separate
+// IN report with the same request and tag. If too many slow requests are
+// already waiting then the response is RESPONSE_BUSY and the host should try
+// again later.
+//
+// IN reports with a status of RESPONSE_UNSOLICITED aren't answers to anything.
+// They carry events the host may want to know about. See events.c.
 
 void fill(uint8_t *buf, uint8_t size, uint8_t value) {
     uint8_t *end = buf + size;
@@ -68,6 +120,17 @@ void make_error(uint8_t *packet, uint8_t request) {
     zero(packet + 2, PACKET_SIZE - 2);
 }
 
+// Turns the tagged request in the packet into a response with the given status.
+// This overwrites the arguments so they must be read before calling this.
+static void make_tagged_response(uint8_t *packet, uint8_t status) {
+    uint8_t request = packet[0];
+    uint8_t tag = packet[1];
+    packet[0] = status;
+    packet[1] = request;
+    packet[2] = tag;
+    zero(packet + 3, PACKET_SIZE - 3);
+}
+
 uint32_t read_word(uint8_t *b) {
     return b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
 }
@@ -79,22 +142,611 @@ void write_word(uint8_t *packet, uint32_t word) {
     packet[3] = (word >> 24) & 0xFF;
 }
 
-// Must be less than or equal to 61 characters.
-static const char *device_info = "Stenosaurus has no info yet.";
+uint16_t read_half_word(uint8_t *b) {
+    return b[0] | (b[1] << 8);
+}
+
+// Slow requests wait in this queue until protocol_poll() runs them. Each slot
+// holds the request and is then overwritten with its response. The indices
+// only ever increase and wrap naturally:
+// - command_end is advanced by the USB interrupt when a request is queued.
+// - command_run is advanced by the main loop when a request has been run.
+// - command_sent is advanced by packet_source() when a response has been sent.
+// Slots in [command_sent, command_run) hold finished responses and slots in
+// [command_run, command_end) hold requests that still need to run. Since each
+// index has a single writer no locking is needed.
+#define COMMAND_QUEUE_SIZE 4
+static uint8_t command_queue[COMMAND_QUEUE_SIZE][64];
+static volatile uint8_t command_end;
+static volatile uint8_t command_run;
+static volatile uint8_t command_sent;
+
+static bool is_slow_request(int action) {
+    return action == REQUEST_SD_INIT || action == REQUEST_SD_READ;
+}
+
+static bool queue_command(uint8_t *packet) {
+    if ((uint8_t)(command_end - command_sent) == COMMAND_QUEUE_SIZE) {
+        events_post(EVENT_OVERFLOW, OVERFLOW_COMMAND_QUEUE);
+        return false;
+    }
+    uint8_t *slot = command_queue[command_end % COMMAND_QUEUE_SIZE];
+    for (int i = 0; i < PACKET_SIZE; ++i) {
+        slot[i] = packet[i];
+    }
+    ++command_end;
+    return true;
+}
+
+// The last block read from the SD card. Reads usually come in runs of slices
+// from the same block so this saves going to the card for each one.
+static uint32_t sd_block[128];
+static uint32_t sd_block_address;
+static bool sd_block_valid;
 
-bool packet_handler(uint8_t *packet) {
+// Request: [REQUEST_SD_INIT] [tag]
+// Response: [status] [REQUEST_SD_INIT] [tag] [size in blocks (4 bytes)]
+static void sd_init(uint8_t *packet) {
+    sd_block_valid = false;
+    sdio_init();
+    if (!sdio_card_present() || !sdio_card_init()) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    make_tagged_response(packet, RESPONSE_OK);
+    write_word(packet + 3, sdio_card_size());
+}
+
+// Request: [REQUEST_SD_READ] [tag] [block (4 bytes)] [offset (2 bytes)]
+//          [length]
+// Response: [status] [REQUEST_SD_READ] [tag] [data...]
+static void sd_read(uint8_t *packet) {
+    uint32_t address = read_word(packet + 2);
+    uint16_t offset = read_half_word(packet + 6);
+    uint8_t length = packet[8];
+    if (length > PACKET_SIZE - 3 || offset + length > sizeof(sd_block)) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    if (!sd_block_valid || sd_block_address != address) {
+        sd_block_valid = sdio_read_block(address, sd_block);
+        sd_block_address = address;
+        if (!sd_block_valid) {
+            make_tagged_response(packet, RESPONSE_ERROR);
+            return;
+        }
+    }
+    make_tagged_response(packet, RESPONSE_OK);
+    uint8_t *data = (uint8_t *)sd_block + offset;
+    for (int i = 0; i < length; ++i) {
+        packet[3 + i] = data[i];
+    }
+}
+
+void protocol_init(void) {
+    memory_watch(MEMORY_COMMAND_QUEUE, command_queue, sizeof(command_queue));
+    memory_watch(MEMORY_SD_BLOCK, sd_block, sizeof(sd_block));
+}
+
+// Request: [REQUEST_SERIAL_BENCHMARK] [tag] [length (4 bytes)]
+// Response: [status] [REQUEST_SERIAL_BENCHMARK] [tag]
+//
+// Then length bytes go out over the serial port as fast as it takes them. Byte
+// i is i modulo 256 so the host can check that nothing was lost.
+// The request is handled in the USB interrupt and only sets the length and
+// start, and the main loop does the rest.
+static uint32_t serial_benchmark_sent;
+static volatile uint32_t serial_benchmark_length;
+static volatile bool serial_benchmark_start;
+
+static void serial_benchmark_poll(void) {
+    if (serial_benchmark_start) {
+        serial_benchmark_start = false;
+        serial_benchmark_sent = 0;
+    }
+    uint32_t left = serial_benchmark_length - serial_benchmark_sent;
+    if (left == 0) return;
+    uint8_t chunk[64];
+    uint32_t length = usb_serial_space();
+    if (length > sizeof(chunk)) length = sizeof(chunk);
+    if (length > left) length = left;
+    for (uint32_t i = 0; i < length; ++i) {
+        chunk[i] = serial_benchmark_sent + i;
+    }
+    serial_benchmark_sent += usb_send_serial_data(chunk, length);
+}
+
+void protocol_poll(void) {
+    if (command_run != command_end) {
+        uint8_t *packet = command_queue[command_run % COMMAND_QUEUE_SIZE];
+        int action = packet[0];
+        TRACE(TRACE_COMMAND_BEGIN, action);
+        if (action == REQUEST_SD_INIT) {
+            sd_init(packet);
+        } else if (action == REQUEST_SD_READ) {
+            sd_read(packet);
+        } else {
+            make_tagged_response(packet, RESPONSE_ERROR);
+        }
+        TRACE(TRACE_COMMAND_END, action);
+        ++command_run;
+    }
+    if (command_sent != command_run || events_ready()) {
+        usb_raw_hid_flush();
+    }
+    serial_benchmark_poll();
+}
+
+// Segmented transfers move a block of data larger than one packet to or from
+// one of the streams below. Data goes straight between the packets and the
+// stream without being copied anywhere else first.
+//
+// Reading (device to host):
+// Request:  [REQUEST_READ_STREAM] [tag] [stream] [offset (4 bytes)]
+//           [maximum length (4 bytes)]
+// Response: [RESPONSE_PENDING] [REQUEST_READ_STREAM] [tag] [length (4 bytes)]
+// Then one packet per SEGMENT_READ_SIZE bytes:
+//           [RESPONSE_SEGMENT] [REQUEST_READ_STREAM] [tag]
+//           [sequence (2 bytes)] [data...]
+// Then:     [RESPONSE_OK] [REQUEST_READ_STREAM] [tag] [crc (4 bytes)]
+//           [length (4 bytes)] [milliseconds taken (4 bytes)]
+//
+// Writing (host to device):
+// Request:  [REQUEST_WRITE_STREAM] [tag] [stream] [offset (4 bytes)]
+//           [length (4 bytes)] [crc (4 bytes)] [window]
+// Response: [status] [REQUEST_WRITE_STREAM] [tag] [window]
+// Then the host sends one packet per SEGMENT_WRITE_SIZE bytes:
+//           [REQUEST_SEGMENT] [tag] [sequence (2 bytes)] [data...]
+// The device only answers every window segments, and the last one:
+//           [status] [REQUEST_SEGMENT] [tag] [sequence (2 bytes)]
+// The answer to the last segment also has [crc (4 bytes)] and [milliseconds
+// taken (4 bytes)] and its status says whether the crc matched. A segment out
+// of sequence ends the transfer with an error.
+//
+// The crc is the one in crc32.h over all of the data. One read and one write
+// can be in progress at the same time.
+static const uint32_t SEGMENT_READ_SIZE = 64 - 5;
+static const uint32_t SEGMENT_WRITE_SIZE = 64 - 4;
+static const uint8_t MAX_WINDOW = 8;
+
+const stream *protocol_stream(uint8_t id) {
+    if (id == STREAM_DICTIONARY) {
+        return &dictionary_stream;
+    } else if (id == STREAM_STATS) {
+        return &stats_stream;
+    } else if (id == STREAM_LATENCY) {
+        return &latency_stream;
+    } else if (id == STREAM_TRACE && ENABLE_TRACE) {
+        return &trace_stream;
+    } else if (id == STREAM_PROFILE) {
+        return &profiler_stream;
+    } else if (id == STREAM_MEMORY) {
+        return &memory_stream;
+    } else if (id == STREAM_LOG) {
+        return &log_stream;
+    } else if (id == STREAM_CHATTER) {
+        return &chatter_stream;
+    }
+    return NULL;
+}
+
+static struct {
+    const stream *stream;
+    bool active;
+    uint8_t tag;
+    uint16_t sequence;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t sent;
+    uint32_t crc;
+    uint32_t start_millis;
+} read_transfer;
+
+static struct {
+    const stream *stream;
+    bool active;
+    uint8_t tag;
+    uint8_t window;
+    uint16_t sequence;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t received;
+    uint32_t expected_crc;
+    uint32_t crc;
+    uint32_t start_millis;
+} write_transfer;
+
+static void read_stream(uint8_t *packet) {
+    const stream *s = protocol_stream(packet[2]);
+    uint32_t offset = read_word(packet + 3);
+    uint32_t max_length = read_word(packet + 7);
+    if (read_transfer.active) {
+        make_tagged_response(packet, RESPONSE_BUSY);
+        return;
+    }
+    if (s == NULL || s->read == NULL) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    uint32_t available = s->read_begin ? s->read_begin() : 0;
+    if (offset > available) {
+        offset = available;
+    }
+    uint32_t length = available - offset;
+    if (length > max_length) {
+        length = max_length;
+    }
+
+    read_transfer.stream = s;
+    read_transfer.tag = packet[1];
+    read_transfer.sequence = 0;
+    read_transfer.offset = offset;
+    read_transfer.length = length;
+    read_transfer.sent = 0;
+    read_transfer.crc = CRC32_INITIAL;
+    read_transfer.start_millis = system_millis;
+    read_transfer.active = true;
+
+    make_tagged_response(packet, RESPONSE_PENDING);
+    write_word(packet + 3, length);
+}
+
+// Fills in the next packet of the read in progress.
+static void next_read_segment(uint8_t *packet) {
+    packet[1] = REQUEST_READ_STREAM;
+    packet[2] = read_transfer.tag;
+    uint32_t remaining = read_transfer.length - read_transfer.sent;
+    if (remaining == 0) {
+        packet[0] = RESPONSE_OK;
+        zero(packet + 3, PACKET_SIZE - 3);
+        write_word(packet + 3, read_transfer.crc);
+        write_word(packet + 7, read_transfer.length);
+        write_word(packet + 11, system_millis - read_transfer.start_millis);
+        if (read_transfer.stream->read_end) {
+            read_transfer.stream->read_end(read_transfer.length);
+        }
+        read_transfer.active = false;
+        return;
+    }
+
+    uint8_t size = remaining < SEGMENT_READ_SIZE ? remaining
+                                                 : SEGMENT_READ_SIZE;
+    packet[0] = RESPONSE_SEGMENT;
+    packet[3] = read_transfer.sequence & 0xFF;
+    packet[4] = read_transfer.sequence >> 8;
+    read_transfer.stream->read(
+        read_transfer.offset + read_transfer.sent, packet + 5, size);
+    zero(packet + 5 + size, SEGMENT_READ_SIZE - size);
+    read_transfer.crc = crc32_update(read_transfer.crc, packet + 5, size);
+    read_transfer.sent += size;
+    ++read_transfer.sequence;
+}
+
+static void write_stream(uint8_t *packet) {
+    const stream *s = protocol_stream(packet[2]);
+    uint32_t offset = read_word(packet + 3);
+    uint32_t length = read_word(packet + 7);
+    uint32_t crc = read_word(packet + 11);
+    uint8_t window = packet[15];
+    if (write_transfer.active) {
+        make_tagged_response(packet, RESPONSE_BUSY);
+        return;
+    }
+    if (s == NULL || s->write == NULL || length == 0 ||
+            (s->write_begin && !s->write_begin(offset, length))) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    if (window == 0 || window > MAX_WINDOW) {
+        window = MAX_WINDOW;
+    }
+
+    write_transfer.stream = s;
+    write_transfer.tag = packet[1];
+    write_transfer.window = window;
+    write_transfer.sequence = 0;
+    write_transfer.offset = offset;
+    write_transfer.length = length;
+    write_transfer.received = 0;
+    write_transfer.expected_crc = crc;
+    write_transfer.crc = CRC32_INITIAL;
+    write_transfer.start_millis = system_millis;
+    write_transfer.active = true;
+
+    make_tagged_response(packet, RESPONSE_OK);
+    packet[3] = window;
+}
+
+static void end_write(bool success) {
+    if (write_transfer.stream->write_end) {
+        write_transfer.stream->write_end(success);
+    }
+    write_transfer.active = false;
+}
+
+// Returns false if no response should be sent for this segment.
+static bool write_segment(uint8_t *packet) {
+    uint16_t sequence = read_half_word(packet + 2);
+    if (!write_transfer.active || packet[1] != write_transfer.tag ||
+            sequence != write_transfer.sequence) {
+        if (write_transfer.active && packet[1] == write_transfer.tag) {
+            end_write(false);
+        }
+        make_tagged_response(packet, RESPONSE_ERROR);
+        packet[3] = sequence & 0xFF;
+        packet[4] = sequence >> 8;
+        return true;
+    }
+
+    uint32_t remaining = write_transfer.length - write_transfer.received;
+    uint8_t size = remaining < SEGMENT_WRITE_SIZE ? remaining
+                                                  : SEGMENT_WRITE_SIZE;
+    write_transfer.stream->write(
+        write_transfer.offset + write_transfer.received, packet + 4, size);
+    write_transfer.crc = crc32_update(write_transfer.crc, packet + 4, size);
+    write_transfer.received += size;
+    ++write_transfer.sequence;
+
+    if (write_transfer.received == write_transfer.length) {
+        bool success = write_transfer.crc == write_transfer.expected_crc;
+        uint32_t crc = write_transfer.crc;
+        end_write(success);
+        make_tagged_response(packet, success ? RESPONSE_OK : RESPONSE_ERROR);
+        packet[3] = sequence & 0xFF;
+        packet[4] = sequence >> 8;
+        write_word(packet + 5, crc);
+        write_word(packet + 9, system_millis - write_transfer.start_millis);
+        return true;
+    }
+    if (write_transfer.sequence % write_transfer.window == 0) {
+        make_tagged_response(packet, RESPONSE_OK);
+        packet[3] = sequence & 0xFF;
+        packet[4] = sequence >> 8;
+        return true;
+    }
+    return false;
+}
+
+bool packet_source(uint8_t *packet) {
+    if (command_sent != command_run) {
+        uint8_t *slot = command_queue[command_sent % COMMAND_QUEUE_SIZE];
+        for (int i = 0; i < PACKET_SIZE; ++i) {
+            packet[i] = slot[i];
+        }
+        ++command_sent;
+        return true;
+    }
+    if (events_make_report(packet + 1)) {
+        packet[0] = RESPONSE_UNSOLICITED;
+        return true;
+    }
+    if (read_transfer.active) {
+        next_read_segment(packet);
+        return true;
+    }
+    return false;
+}
+
+// The version of the packet layouts described here. Bump it when they change.
+static const uint16_t PROTOCOL_VERSION = 1;
+
+// Identifies the build of the firmware. The makefile sets it to the git commit.
+#ifndef BUILD_ID
+#define BUILD_ID 0
+#endif
+
+static const uint32_t BOOTLOADER_FLASH_SIZE = 8 * 1024;
+static const uint32_t FIRMWARE_FLASH_SIZE = 248 * 1024;
+static const uint32_t RAM_SIZE = 48 * 1024;
+
+// The response to REQUEST_INFO is a list of entries after the status and
+// request bytes, each laid out as [type] [length] [value...], that lets the
+// host decide how to talk to the device. Values are little endian. The host
+// should skip types it doesn't know about using the length. The list ends at
+// the end of the packet or at a type of zero.
+enum {
+    // 2 bytes: PROTOCOL_VERSION.
+    INFO_PROTOCOL_VERSION = 1,
+    // 4 bytes: BUILD_ID.
+    INFO_BUILD_ID = 2,
+    // 4 bytes: bit n is set if request n is supported.
+    INFO_REQUESTS = 3,
+    // 1 byte: the largest window for segmented writes.
+    INFO_MAX_WINDOW = 4,
+    // 1 byte: the number of slow requests that can be waiting at once.
+    INFO_QUEUE_DEPTH = 5,
+    // 1 byte: a bit for each supported compression format. None yet.
+    INFO_COMPRESSION = 6,
+    // 1 byte: INFO_ENDPOINT_* bits for the ways data can be moved.
+    INFO_ENDPOINTS = 7,
+    // 8 bytes: the size of the bootloader and firmware flash partitions.
+    INFO_FLASH_SIZES = 8,
+    // 8 bytes: the size of RAM and of the dictionary store in it.
+    INFO_RAM_SIZES = 9,
+    // 1 byte for each stream that segmented transfers can use.
+    INFO_STREAMS = 10,
+};
+
+enum {
+    // Requests and segmented transfers over the raw HID interface.
+    INFO_ENDPOINT_RAW_HID = 1,
+    // Framed bulk transfers over the CDC data endpoints. See bulk.c.
+    INFO_ENDPOINT_BULK = 2,
+    // Strokes as a serial stream over the CDC data endpoints.
+    INFO_ENDPOINT_CDC_SERIAL = 4,
+};
+
+// Adds an entry header at p and returns where its value goes.
+static uint8_t *put_info(uint8_t *p, uint8_t type, uint8_t length) {
+    p[0] = type;
+    p[1] = length;
+    return p + 2;
+}
+
+static void make_info(uint8_t *packet) {
+    make_success(packet, REQUEST_INFO);
+    uint8_t *p = packet + 2;
+
+    p = put_info(p, INFO_PROTOCOL_VERSION, 2);
+    *p++ = PROTOCOL_VERSION & 0xFF;
+    *p++ = PROTOCOL_VERSION >> 8;
+
+    p = put_info(p, INFO_BUILD_ID, 4);
+    write_word(p, BUILD_ID);
+    p += 4;
+
+    uint32_t requests = 1 << REQUEST_INFO | 1 << REQUEST_BOOTLOADER |
+                        1 << REQUEST_RESET | 1 << REQUEST_DEBUG |
+                        1 << REQUEST_SD_INIT | 1 << REQUEST_SD_READ |
+                        1 << REQUEST_READ_STREAM | 1 << REQUEST_WRITE_STREAM |
+                        1 << REQUEST_SEGMENT | 1 << REQUEST_SET_THRESHOLD |
+                        1 << REQUEST_RESET_LATENCY | 1 << REQUEST_PROFILE |
+                        1 << REQUEST_SERIAL_BENCHMARK | 1 << REQUEST_MATRIX |
+                        1 << REQUEST_CHORD_MODE |
+                        1 << REQUEST_SERIAL_PROTOCOL |
+                        1 << REQUEST_SERIAL_FLUSH |
+                        1 << REQUEST_STROKE_OUTPUTS |
+                        (ENABLE_TRACE ? 1 << REQUEST_TRACE : 0);
+    p = put_info(p, INFO_REQUESTS, 4);
+    write_word(p, requests);
+    p += 4;
+
+    p = put_info(p, INFO_MAX_WINDOW, 1);
+    *p++ = MAX_WINDOW;
+
+    p = put_info(p, INFO_QUEUE_DEPTH, 1);
+    *p++ = COMMAND_QUEUE_SIZE;
+
+    p = put_info(p, INFO_COMPRESSION, 1);
+    *p++ = 0;
+
+    p = put_info(p, INFO_ENDPOINTS, 1);
+    *p++ = INFO_ENDPOINT_RAW_HID | INFO_ENDPOINT_BULK |
+           INFO_ENDPOINT_CDC_SERIAL;
+
+    p = put_info(p, INFO_FLASH_SIZES, 8);
+    write_word(p, BOOTLOADER_FLASH_SIZE);
+    write_word(p + 4, FIRMWARE_FLASH_SIZE);
+    p += 8;
+
+    p = put_info(p, INFO_RAM_SIZES, 8);
+    write_word(p, RAM_SIZE);
+    write_word(p + 4, DICTIONARY_SIZE);
+    p += 8;
+
+    p = put_info(p, INFO_STREAMS, ENABLE_TRACE ? 8 : 7);
+    *p++ = STREAM_DICTIONARY;
+    *p++ = STREAM_STATS;
+    *p++ = STREAM_LATENCY;
+    *p++ = STREAM_PROFILE;
+    *p++ = STREAM_MEMORY;
+    *p++ = STREAM_LOG;
+    *p++ = STREAM_CHATTER;
+    if (ENABLE_TRACE) {
+        *p++ = STREAM_TRACE;
+    }
+}
+
+// Asks for an EVENT_THRESHOLD event when a counter in stats.h reaches a value.
+// Request: [REQUEST_SET_THRESHOLD] [tag] [counter] [value (4 bytes)]
+// Response: [status] [REQUEST_SET_THRESHOLD] [tag]
+static void set_threshold(uint8_t *packet) {
+    uint8_t counter = packet[2];
+    uint32_t value = read_word(packet + 3);
+    if (counter >= STAT_COUNT) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    stats_set_threshold(counter, value);
+    make_tagged_response(packet, RESPONSE_OK);
+}
+
+// Sets the key matrix scan rate and reports how the scanner is doing. The host
+// works out the real scan rate and CPU cost from two responses.
+// Request: [REQUEST_MATRIX] [tag] [scans per second (4 bytes), or zero to leave
+//          it as it is]
+// Response: [status] [REQUEST_MATRIX] [tag] [scans per second (4 bytes)]
+//           [scans (4 bytes)] [interrupt cycles (4 bytes)]
+static void matrix_request(uint8_t *packet) {
+    uint32_t rate = read_word(packet + 2);
+    if (rate != 0 && (rate < MATRIX_MIN_RATE || rate > MATRIX_MAX_RATE)) {
+        make_tagged_response(packet, RESPONSE_ERROR);
+        return;
+    }
+    if (rate != 0) {
+        matrix_set_rate(rate);
+    }
+    make_tagged_response(packet, RESPONSE_OK);
+    write_word(packet + 3, matrix_rate());
+    write_word(packet + 7, matrix_scans());
+    write_word(packet + 11, matrix_cycles());
+}
+
+raw_hid_result packet_handler(uint8_t *packet) {
     int action = packet[0];
 
-    if (action == REQUEST_INFO) {
-        *(packet++) = RESPONSE_OK;
-        *(packet++) = REQUEST_INFO;
-        const char* info = device_info;
-        uint32_t len = 0;
-        while (*info) {
-            *(packet++) = *(info++);
-            ++len;
+    if (is_slow_request(action)) {
+        make_tagged_response(
+            packet, queue_command(packet) ? RESPONSE_PENDING : RESPONSE_BUSY);
+    } else if (action == REQUEST_READ_STREAM) {
+        read_stream(packet);
+    } else if (action == REQUEST_WRITE_STREAM) {
+        write_stream(packet);
+    } else if (action == REQUEST_SEGMENT) {
+        if (!write_segment(packet)) {
+            return RAW_HID_NO_REPLY;
+        }
+    } else if (action == REQUEST_SET_THRESHOLD) {
+        set_threshold(packet);
+    } else if (action == REQUEST_RESET_LATENCY) {
+        // Request: [REQUEST_RESET_LATENCY] [tag]
+        latency_reset();
+        make_tagged_response(packet, RESPONSE_OK);
+    } else if (action == REQUEST_TRACE) {
+        // Request: [REQUEST_TRACE] [tag] [1 to record, 0 to stop]
+        make_tagged_response(
+            packet, trace_enable(packet[2]) ? RESPONSE_OK : RESPONSE_ERROR);
+    } else if (action == REQUEST_PROFILE) {
+        // Request: [REQUEST_PROFILE] [tag] [samples per second (4 bytes), or
+        //          zero to stop]
+        uint32_t rate = read_word(packet + 2);
+        if (rate != 0 &&
+            (rate < PROFILER_MIN_RATE || rate > PROFILER_MAX_RATE)) {
+            make_tagged_response(packet, RESPONSE_ERROR);
+        } else {
+            profiler_start(rate);
+            make_tagged_response(packet, RESPONSE_OK);
         }
-        zero(packet, PACKET_SIZE - 2 - len);
+    } else if (action == REQUEST_SERIAL_BENCHMARK) {
+        serial_benchmark_length = read_word(packet + 2);
+        serial_benchmark_start = true;
+        make_tagged_response(packet, RESPONSE_OK);
+    } else if (action == REQUEST_MATRIX) {
+        matrix_request(packet);
+    } else if (action == REQUEST_CHORD_MODE) {
+        // Request: [REQUEST_CHORD_MODE] [tag] [CHORD_* bits]
+        chord_set_mode(packet[2]);
+        make_tagged_response(packet, RESPONSE_OK);
+    } else if (action == REQUEST_SERIAL_PROTOCOL) {
+        // Request: [REQUEST_SERIAL_PROTOCOL] [tag] [ENCODER_* protocol]
+        make_tagged_response(packet, encoder_set_protocol(packet[2]) ?
+                                         RESPONSE_OK : RESPONSE_ERROR);
+    } else if (action == REQUEST_STROKE_OUTPUTS) {
+        // Request: [REQUEST_STROKE_OUTPUTS] [tag] [bit n for CHORD_OUTPUT n]
+        chord_set_outputs(packet[2]);
+        make_tagged_response(packet, RESPONSE_OK);
+    } else if (action == REQUEST_SERIAL_FLUSH) {
+        // Request: [REQUEST_SERIAL_FLUSH] [tag] [flush delay in milliseconds
+        //          (4 bytes)]
+        uint32_t ms = read_word(packet + 2);
+        if (ms > USB_SERIAL_MAX_FLUSH_MS) {
+            make_tagged_response(packet, RESPONSE_ERROR);
+        } else {
+            usb_serial_set_flush_delay(ms);
+            make_tagged_response(packet, RESPONSE_OK);
+        }
+    } else if (action == REQUEST_INFO) {
+        make_info(packet);
     } else if (action == REQUEST_BOOTLOADER) {
         packet[0] = RESPONSE_OK;
         packet[1] = action;
@@ -118,12 +770,12 @@ bool packet_handler(uint8_t *packet) {
             BKP_DR1 &= 0xFFFE;
         }
 
-        return true;
+        return RAW_HID_REPLY_AND_RESET;
     } else if (action == REQUEST_DEBUG) {
         make_success(packet, action);
     } else {
         make_error(packet, action);
     }
 
-    return false;
+    return RAW_HID_REPLY;
 }
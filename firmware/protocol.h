@@ -22,12 +22,36 @@
 #ifndef STENOSAURUS_FIRMWARE_PROTOCOL_H
 #define STENOSAURUS_FIRMWARE_PROTOCOL_H
 
+#include "stream.h"
+#include "usb.h"
 #include <stdbool.h>
 #include <stdint.h>
 
+// Sets up the protocol state. Call this once at start up before usb_init().
+void protocol_init(void);
+
 // This function is called when there is a packet from the host. It will do
 // whatever is requested and will place the response in the same buffer. The
 // buffer must be at least 64 bytes long.
-bool packet_handler(uint8_t *packet);
+//
+// This is called from the USB interrupt so it must return quickly. Requests
+// that take a long time are queued and answered later by protocol_poll().
+raw_hid_result packet_handler(uint8_t *packet);
+
+// This function is called when the raw HID IN endpoint is free. If there is a
+// packet waiting to be sent to the host then it is copied into the buffer and
+// true is returned. The buffer must be at least 64 bytes long.
+bool packet_source(uint8_t *packet);
+
+// Runs any queued requests. This must be called regularly from the main loop.
+void protocol_poll(void);
+
+// Returns the stream with one of the STREAM_* ids from stream.h, or NULL if
+// there isn't one.
+const stream *protocol_stream(uint8_t id);
+
+// Little endian words as they appear in packets.
+uint32_t read_word(uint8_t *b);
+void write_word(uint8_t *packet, uint32_t word);
 
 #endif // STENOSAURUS_FIRMWARE_PROTOCOL_H
\ No newline at end of file
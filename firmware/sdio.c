@@ -21,6 +21,8 @@
 #include "sdio.h"
 
 #include "clock.h"
+#include "stats.h"
+#include "trace.h"
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
@@ -51,9 +53,7 @@ void sdio_init(void) {
     // Enable the clock for DMA2, which is the one connected to the SDIO.
     rcc_peripheral_enable_clock(&RCC_AHBENR, RCC_AHBENR_DMA2EN);
 
-    // Enable the clock for all the IO ports used by SDIO and the card detect
-    // pin.
-    rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_IOPAEN);
+    // Enable the clock for all the IO ports used by SDIO.
     rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_IOPCEN);
     rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_IOPDEN);
 
@@ -78,6 +78,11 @@ void sdio_init(void) {
                   GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
                   GPIO2);
 
+    sdio_card_detect_init();
+}
+
+void sdio_card_detect_init(void) {
+    rcc_peripheral_enable_clock(&RCC_APB2ENR, RCC_APB2ENR_IOPAEN);
     // PA8 is pulled low on the WaveShare board when a card is present.
     gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, GPIO8);
     // Set the output register for GPIOA pin8, which when configured as input
@@ -193,7 +198,7 @@ bool sdio_card_present(void) {
     return (GPIOA_IDR & GPIO8) == 0;
 }
 
-bool sdio_card_init(void) {
+static bool card_init(void) {
     clear_card_info();
 
     bool card_present = (GPIOA_IDR & GPIO8) == 0;
@@ -306,6 +311,10 @@ bool sdio_card_init(void) {
     return true;
 }
 
+uint32_t sdio_card_size(void) {
+    return sd_card_info.size;
+}
+
 static bool wait_for_data_ready(void) {
     uint32_t timeout = system_millis + 1000;
     while (system_millis < timeout) {
@@ -317,7 +326,7 @@ static bool wait_for_data_ready(void) {
     return false;
 }
 
-bool sdio_read_block(uint32_t address, uint32_t *buffer) {
+static bool read_block(uint32_t address, uint32_t *buffer) {
     if (!wait_for_data_ready()) {
         return false;
     }
@@ -372,7 +381,7 @@ bool sdio_read_block(uint32_t address, uint32_t *buffer) {
     return true;
 }
 
-bool sdio_write_block(uint32_t address, uint32_t *buffer) {
+static bool write_block(uint32_t address, uint32_t *buffer) {
     if (!wait_for_data_ready()) {
         return false;
     }
@@ -425,3 +434,33 @@ bool sdio_write_block(uint32_t address, uint32_t *buffer) {
 
     return true;
 }
+
+// Counts an SD operation and whether it failed.
+static bool count_op(bool success) {
+    stats_increment(STAT_SD_OPS);
+    if (!success) {
+        stats_increment(STAT_SD_ERRORS);
+    }
+    return success;
+}
+
+bool sdio_card_init(void) {
+    TRACE(TRACE_SD_INIT_BEGIN, 0);
+    bool result = count_op(card_init());
+    TRACE(TRACE_SD_INIT_END, 0);
+    return result;
+}
+
+bool sdio_read_block(uint32_t address, uint32_t *buffer) {
+    TRACE(TRACE_SD_READ_BEGIN, address);
+    bool result = count_op(read_block(address, buffer));
+    TRACE(TRACE_SD_READ_END, address);
+    return result;
+}
+
+bool sdio_write_block(uint32_t address, uint32_t *buffer) {
+    TRACE(TRACE_SD_WRITE_BEGIN, address);
+    bool result = count_op(write_block(address, buffer));
+    TRACE(TRACE_SD_WRITE_END, address);
+    return result;
+}
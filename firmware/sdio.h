@@ -33,12 +33,23 @@ typedef enum {
     SDIO_EUNKNOWN = 5,
 } sdio_error_t;
 
+// Takes over PC8 to PC12 and PD2 for the SD bus, which PC9 to PC12 share with
+// the LEDs, so only call this when the card is going to be used. This also
+// does sdio_card_detect_init().
 void sdio_init(void);
 
+// Sets up just the card detect pin, so that sdio_card_present() works without
+// taking over the SD bus.
+void sdio_card_detect_init(void);
+
 bool sdio_card_present(void);
 
 bool sdio_card_init(void);
 
+// The size of the initialized card in 512 byte blocks or zero if there is no
+// initialized card.
+uint32_t sdio_card_size(void);
+
 bool sdio_read_block(uint32_t address, uint32_t *buffer);
 
 bool sdio_write_block(uint32_t address, uint32_t *buffer);
@@ -0,0 +1,125 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the statistics counters. See the header file for
+// interface documentation to this code.
+//
+// The host reads everything at once from STREAM_STATS, which is a snapshot of
+// little endian 4 byte values laid out as:
+// - the STAT_COUNT simple counters in stat_counter order,
+// - the strokes in the last minute,
+// - STATS_KEYS + 1 counts of strokes by the number of keys in them, from zero
+//   keys up,
+// - STATS_KEYS counts of strokes that used each key, by stroke bit from
+//   HASH_BIT up.
+
+#include "stats.h"
+
+#include "clock.h"
+#include "events.h"
+
+volatile uint32_t stats_counters[STAT_COUNT];
+
+// Only stats_stroke() writes these and it is called from the main loop, so
+// they don't need atomic updates.
+static uint32_t keys_per_stroke[STATS_KEYS + 1];
+static uint32_t key_usage[STATS_KEYS];
+
+// Strokes per minute is kept as the strokes in each of the last few ten second
+// periods. A bucket is reused once its period has gone out of the window. This
+// makes the figure lag by up to ten seconds but costs nothing to keep up.
+#define RATE_BUCKETS 6
+static const uint32_t RATE_BUCKET_MS = 10000;
+static uint32_t rate_strokes[RATE_BUCKETS];
+static uint32_t rate_periods[RATE_BUCKETS];
+
+static uint32_t thresholds[STAT_COUNT];
+
+void stats_stroke(uint32_t stroke) {
+    stats_increment(STAT_STROKES);
+
+    int keys = 0;
+    for (int i = 0; i < STATS_KEYS; ++i) {
+        if ((stroke >> i) & 1) {
+            ++key_usage[i];
+            ++keys;
+        }
+    }
+    ++keys_per_stroke[keys];
+
+    uint32_t period = system_millis / RATE_BUCKET_MS;
+    uint32_t bucket = period % RATE_BUCKETS;
+    if (rate_periods[bucket] != period) {
+        rate_periods[bucket] = period;
+        rate_strokes[bucket] = 0;
+    }
+    ++rate_strokes[bucket];
+}
+
+static uint32_t strokes_per_minute(void) {
+    uint32_t period = system_millis / RATE_BUCKET_MS;
+    uint32_t total = 0;
+    for (int i = 0; i < RATE_BUCKETS; ++i) {
+        if (period - rate_periods[i] < RATE_BUCKETS) {
+            total += rate_strokes[i];
+        }
+    }
+    return total;
+}
+
+void stats_set_threshold(stat_counter counter, uint32_t value) {
+    thresholds[counter] = value;
+}
+
+void stats_poll(void) {
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        if (thresholds[i] != 0 && stats_counters[i] >= thresholds[i]) {
+            thresholds[i] = 0;
+            events_post(EVENT_THRESHOLD, i);
+        }
+    }
+}
+
+#define SNAPSHOT_WORDS (STAT_COUNT + 1 + STATS_KEYS + 1 + STATS_KEYS)
+static uint32_t snapshot[SNAPSHOT_WORDS];
+
+static uint32_t stats_read_begin(void) {
+    uint32_t *p = snapshot;
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        *p++ = stats_counters[i];
+    }
+    *p++ = strokes_per_minute();
+    for (int i = 0; i < STATS_KEYS + 1; ++i) {
+        *p++ = keys_per_stroke[i];
+    }
+    for (int i = 0; i < STATS_KEYS; ++i) {
+        *p++ = key_usage[i];
+    }
+    return sizeof(snapshot);
+}
+
+static void stats_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    const uint8_t *data = (const uint8_t *)snapshot + offset;
+    for (uint32_t i = 0; i < length; ++i) {
+        buffer[i] = data[i];
+    }
+}
+
+const stream stats_stream = {
+    .read_begin = stats_read_begin,
+    .read = stats_read,
+};
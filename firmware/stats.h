@@ -0,0 +1,114 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines counters that the firmware keeps about what it is doing so
+// that throughput problems can be tracked down in the field.
+//
+// See the .c file for implementation details.
+
+#ifndef STENOSAURUS_FIRMWARE_STATS_H
+#define STENOSAURUS_FIRMWARE_STATS_H
+
+#include "stream.h"
+#include "stroke.h"
+#include <stdint.h>
+
+// The simple counters. The host refers to them by these numbers so only add to
+// the end.
+typedef enum {
+    // Strokes produced.
+    STAT_STROKES,
+    // Reports that usbd_ep_write_packet accepted, on any endpoint.
+    STAT_USB_REPORTS_SENT,
+    // Reports that usbd_ep_write_packet refused because the endpoint was busy.
+    STAT_USB_REPORTS_DROPPED,
+    // Bytes sent on the CDC data endpoint.
+    STAT_CDC_BYTES,
+    // Entries into the USB interrupt handler.
+    STAT_USB_INTERRUPTS,
+    // SD card commands that moved a block or initialized the card.
+    STAT_SD_OPS,
+    // SD card operations that failed.
+    STAT_SD_ERRORS,
+    // Bytes for the CDC data endpoint that didn't fit in its buffer.
+    STAT_CDC_BYTES_DROPPED,
+    // The most keyboard reports that have been waiting for the host at once.
+    // This is a high-water mark rather than a count.
+    STAT_KEYBOARD_QUEUE_HIGH_WATER,
+    // Keyboard reports refused because the queue was full.
+    STAT_KEYBOARD_REPORTS_REFUSED,
+    // Key events queued in keyboard.c.
+    STAT_KEY_EVENTS,
+    // Key events refused because keyboard.c's queue was full.
+    STAT_KEY_EVENTS_REFUSED,
+    // The most key events that have been waiting at once. This is a high-water
+    // mark rather than a count.
+    STAT_KEY_FIFO_HIGH_WATER,
+    // How often the host polls the keyboard endpoint in milliseconds, or 0
+    // while it isn't known. This is a value rather than a count.
+    STAT_USB_POLL_PERIOD,
+    // Strokes lost because the chord engine's queue was full.
+    STAT_STROKES_DROPPED,
+    // Strokes not queued for the Plover HID interface because its queue was
+    // full, which happens when nothing on the host has it open.
+    STAT_STENO_REPORTS_DROPPED,
+    STAT_COUNT
+} stat_counter;
+
+// The number of keys on the steno layout, which is the size of the heatmap.
+#define STATS_KEYS STENO_KEY_COUNT
+
+extern volatile uint32_t stats_counters[STAT_COUNT];
+
+// Adds to a counter. This is safe to call from interrupts and costs about as
+// much as a plain increment.
+static inline void stats_add(stat_counter counter, uint32_t amount) {
+    __atomic_fetch_add(&stats_counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+static inline void stats_increment(stat_counter counter) {
+    stats_add(counter, 1);
+}
+
+// Raises a counter to value if it is lower, for high-water marks. Calls for
+// the same counter must not interrupt each other.
+static inline void stats_max(stat_counter counter, uint32_t value) {
+    if (value > stats_counters[counter]) {
+        stats_counters[counter] = value;
+    }
+}
+
+// Sets a counter that holds a value rather than a count.
+static inline void stats_set(stat_counter counter, uint32_t value) {
+    stats_counters[counter] = value;
+}
+
+// Records a stroke: counts it, its keys and the strokes per minute.
+void stats_stroke(uint32_t stroke);
+
+// Arms an EVENT_THRESHOLD event for when counter reaches value. A value of
+// zero disarms it. The event fires once and then the threshold is disarmed.
+void stats_set_threshold(stat_counter counter, uint32_t value);
+
+// Checks the thresholds. Call this from the main loop.
+void stats_poll(void);
+
+// A snapshot of all the statistics as a stream that the host can read. See the
+// .c file for the layout.
+extern const stream stats_stream;
+
+#endif // STENOSAURUS_FIRMWARE_STATS_H
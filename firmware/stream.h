@@ -0,0 +1,62 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines the interface that a block of data must provide to be
+// transferred to and from the host with the segmented transfers in
+// protocol.c.
+
+#ifndef STENOSAURUS_FIRMWARE_STREAM_H
+#define STENOSAURUS_FIRMWARE_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The streams that the host can name in a transfer.
+enum {
+    STREAM_DICTIONARY = 1,
+    STREAM_STATS = 2,
+    STREAM_LATENCY = 3,
+    STREAM_TRACE = 4,
+    STREAM_PROFILE = 5,
+    STREAM_MEMORY = 6,
+    STREAM_LOG = 7,
+    STREAM_CHATTER = 8,
+};
+
+// Any of these may be NULL if the stream doesn't support that direction. They
+// are called from the USB interrupt for raw HID transfers, and from the main
+// loop for bulk transfers, so they must be quick.
+typedef struct {
+    // Called when the host starts reading. Returns the number of bytes that
+    // are available. Streams whose contents change can take a snapshot here.
+    uint32_t (*read_begin)(void);
+    // Copies length bytes starting at offset into buffer.
+    void (*read)(uint32_t offset, uint8_t *buffer, uint32_t length);
+    // Called when a read finishes with the number of bytes that were sent.
+    // Streams that are drained, like logs, can discard them here.
+    void (*read_end)(uint32_t length);
+
+    // Called when the host starts writing length bytes at offset. Returns
+    // false if that isn't allowed.
+    bool (*write_begin)(uint32_t offset, uint32_t length);
+    // Copies length bytes from buffer into the stream starting at offset.
+    void (*write)(uint32_t offset, const uint8_t *buffer, uint32_t length);
+    // Called when a write finishes. The data is only good if success is true.
+    void (*write_end)(bool success);
+} stream;
+
+#endif // STENOSAURUS_FIRMWARE_STREAM_H
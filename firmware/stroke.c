@@ -14,118 +14,56 @@
 //
 // You should have received a copy of the GNU Lesser General Public License
 // along with this library.  If not, see <http://www.gnu.org/licenses/>.
-
-// TODO: Comment it up.
+//
+// This file implements the stroke parser. See the header file for interface
+// documentation to this code.
+//
+// The parser walks the layout in steno order. Each letter is matched to the
+// next key with that letter, so the S in "ST" is S- and the one in "AS" is -S.
 
 #include "stroke.h"
 
 #include <inttypes.h>
 #include <stdbool.h>
 
-uint32_t string_to_stroke(const char* s) {
-    bool initial = true;
-    uint32_t stroke = 0;
-    while (*s != 0) {
-        switch (*s) {
-        case 'S':
-        case 's':
-            stroke |= initial ? INITIAL_S_STROKE : FINAL_S_STROKE;
-            break;
-
-        case 'T':
-        case 't':
-            stroke |= initial ? INITIAL_T_STROKE : FINAL_T_STROKE;
-            break;
-
-        case 'K':
-        case 'k':
-            stroke |= INITIAL_K_STROKE;
-            break;
-
-        case 'P':
-        case 'p':
-            stroke |= initial ? INITIAL_P_STROKE : FINAL_P_STROKE;
-            break;
-
-        case 'W':
-        case 'w':
-            stroke |= INITIAL_W_STROKE;
-            break;
-
-        case 'H':
-        case 'h':
-            stroke |= INITIAL_H_STROKE;
-            break;
-
-        case 'R':
-        case 'r':
-            stroke |= initial ? INITIAL_R_STROKE : FINAL_R_STROKE;
-            break;
-
-        case 'A':
-        case 'a':
-            stroke |= A_STROKE;
-            initial = false;
-            break;
-
-        case 'O':
-        case 'o':
-            stroke |= O_STROKE;
-            initial = false;
-            break;
-
-        case '*':
-            stroke |= STAR_STROKE;
-            initial = false;
-            break;
-
-        case 'E':
-        case 'e':
-            stroke |= E_STROKE;
-            initial = false;
-            break;
-
-        case 'U':
-        case 'u':
-            stroke |= U_STROKE;
-            initial = false;
-            break;
-
-        case 'F':
-        case 'f':
-            stroke |= FINAL_F_STROKE;
-            break;
-
-        case 'B':
-        case 'b':
-            stroke |= FINAL_B_STROKE;
-            break;
-
-        case 'L':
-        case 'l':
-            stroke |= FINAL_L_STROKE;
-            break;
-
-        case 'G':
-        case 'g':
-            stroke |= FINAL_G_STROKE;
-            break;
-
-        case 'D':
-        case 'd':
-            stroke |= FINAL_D_STROKE;
-            break;
+static const char *const LABELS[] = {
+#define STENO_LABEL(name, label, ...) label,
+    STENO_LAYOUT(STENO_LABEL)
+#undef STENO_LABEL
+};
+
+static const uint8_t BITS[] = {
+#define STENO_BIT(name, label, bit, ...) bit,
+    STENO_LAYOUT(STENO_BIT)
+#undef STENO_BIT
+};
+
+// The letter a key is written with, which is its label without the dash.
+static char letter(int key) {
+    return LABELS[key][0] == '-' ? LABELS[key][1] : LABELS[key][0];
+}
 
-        case 'Z':
-        case 'z':
-            stroke |= FINAL_Z_STROKE;
-            break;
+uint32_t string_to_stroke(const char* s) {
+    int first_final = 0;
+    while (first_final < STENO_KEY_COUNT && LABELS[first_final][0] != '-') {
+        ++first_final;
+    }
 
-        case '#':
-            stroke |= HASH_STROKE;
-            break;
+    uint32_t stroke = 0;
+    int next = 0;
+    for (; *s != 0; ++s) {
+        char c = *s >= 'a' && *s <= 'z' ? *s - 'a' + 'A' : *s;
+        if (c == '-') {
+            if (next < first_final) next = first_final;
+            continue;
+        }
+        for (int key = next; key < STENO_KEY_COUNT; ++key) {
+            if (letter(key) == c) {
+                stroke |= 1 << BITS[key];
+                next = key + 1;
+                break;
+            }
         }
-        s++;
     }
     return stroke;
 }
@@ -14,279 +14,98 @@
 //
 // You should have received a copy of the GNU Lesser General Public License
 // along with this library.  If not, see <http://www.gnu.org/licenses/>.
-
-// TODO: Comment it up.
+//
+// This file defines the steno layout and the stroke words built from it.
+//
+// A stroke is a word with a bit set for each key in it. The layout below is
+// the only place that says which keys there are, which bit each one has and
+// how each output protocol names it. Everything else, the bit constants here,
+// the parser in stroke.c, the protocol encoders, the Plover HID report and the
+// QWERTY keys in keyboard.c, is generated from it when the firmware is
+// compiled, so there are no run time branches on the layout.
 
 #ifndef STENOSAURUS_FIRMWARE_STROKE_H
 #define STENOSAURUS_FIRMWARE_STROKE_H
 
 #include <inttypes.h>
 
-static const uint8_t INITIAL_S_BIT = (22);
-static const uint8_t INITIAL_T_BIT = (21);
-static const uint8_t INITIAL_K_BIT = (20);
-static const uint8_t INITIAL_P_BIT = (19);
-static const uint8_t INITIAL_W_BIT = (18);
-static const uint8_t INITIAL_H_BIT = (17);
-static const uint8_t INITIAL_R_BIT = (16);
-static const uint8_t A_BIT = (15);
-static const uint8_t O_BIT = (14);
-static const uint8_t STAR_BIT = (13);
-static const uint8_t E_BIT = (12);
-static const uint8_t U_BIT = (11);
-static const uint8_t FINAL_F_BIT = (10);
-static const uint8_t FINAL_R_BIT = (9);
-static const uint8_t FINAL_P_BIT = (8);
-static const uint8_t FINAL_B_BIT = (7);
-static const uint8_t FINAL_L_BIT = (6);
-static const uint8_t FINAL_G_BIT = (5);
-static const uint8_t FINAL_T_BIT = (4);
-static const uint8_t FINAL_S_BIT = (3);
-static const uint8_t FINAL_D_BIT = (2);
-static const uint8_t FINAL_Z_BIT = (1);
-static const uint8_t HASH_BIT = (0);
+// The keys in steno order, which is the order they are written in. Each entry
+// is X(name, label, bit, TX Bolt byte, TX Bolt bit, Gemini PR byte, Gemini PR
+// bit, Plover HID key, QWERTY key) where:
+// - label is how the key is written, with a dash for keys that are on one
+//   side but could be confused with a key on the other;
+// - bit is its bit in a stroke word;
+// - the TX Bolt and Gemini PR bytes and bits are where the key goes in a
+//   packet of each protocol (see encoder.c);
+// - the Plover HID key is the key's number in the Plover HID report (see
+//   usb.c);
+// - the QWERTY key is the one that Plover's keyboard machine reads it from.
+//
+// Another layout, like one with more number bar keys or a Palantype one, can
+// be swapped in by defining STENO_LAYOUT before this file is included, for
+// example from a header given to the compiler with -include. A key that TX
+// Bolt can't carry should be given byte 4, which is never sent, and one that
+// Gemini PR can't carry should be given one of its reserved bits, byte 2 bit 1
+// or 0.
+#ifndef STENO_LAYOUT
+#define STENO_LAYOUT(X) \
+    X(HASH,      "#",  0,  3, 4, 0, 5, 26, KEY_1) \
+    X(INITIAL_S, "S-", 22, 0, 0, 1, 6, 0,  KEY_A) \
+    X(INITIAL_T, "T-", 21, 0, 1, 1, 4, 2,  KEY_W) \
+    X(INITIAL_K, "K-", 20, 0, 2, 1, 3, 3,  KEY_S) \
+    X(INITIAL_P, "P-", 19, 0, 3, 1, 2, 4,  KEY_E) \
+    X(INITIAL_W, "W-", 18, 0, 4, 1, 1, 5,  KEY_D) \
+    X(INITIAL_H, "H-", 17, 0, 5, 1, 0, 6,  KEY_R) \
+    X(INITIAL_R, "R-", 16, 1, 0, 2, 6, 7,  KEY_F) \
+    X(A,         "A",  15, 1, 1, 2, 5, 8,  KEY_C) \
+    X(O,         "O",  14, 1, 2, 2, 4, 9,  KEY_V) \
+    X(STAR,      "*",  13, 1, 3, 2, 3, 10, KEY_T) \
+    X(E,         "E",  12, 1, 4, 3, 3, 14, KEY_N) \
+    X(U,         "U",  11, 1, 5, 3, 2, 15, KEY_M) \
+    X(FINAL_F,   "-F", 10, 2, 0, 3, 1, 16, KEY_U) \
+    X(FINAL_R,   "-R", 9,  2, 1, 3, 0, 17, KEY_J) \
+    X(FINAL_P,   "-P", 8,  2, 2, 4, 6, 18, KEY_I) \
+    X(FINAL_B,   "-B", 7,  2, 3, 4, 5, 19, KEY_K) \
+    X(FINAL_L,   "-L", 6,  2, 4, 4, 4, 20, KEY_O) \
+    X(FINAL_G,   "-G", 5,  2, 5, 4, 3, 21, KEY_L) \
+    X(FINAL_T,   "-T", 4,  3, 0, 4, 2, 22, KEY_P) \
+    X(FINAL_S,   "-S", 3,  3, 1, 4, 1, 23, KEY_SEMICOLON) \
+    X(FINAL_D,   "-D", 2,  3, 2, 4, 0, 24, KEY_LEFT_BRACE) \
+    X(FINAL_Z,   "-Z", 1,  3, 3, 5, 0, 25, KEY_QUOTE)
+#endif
 
-#define INITIAL_S_STROKE (1 << INITIAL_S_BIT)
-#define INITIAL_T_STROKE (1 << INITIAL_T_BIT)
-#define INITIAL_K_STROKE (1 << INITIAL_K_BIT)
-#define INITIAL_P_STROKE (1 << INITIAL_P_BIT)
-#define INITIAL_W_STROKE (1 << INITIAL_W_BIT)
-#define INITIAL_H_STROKE (1 << INITIAL_H_BIT)
-#define INITIAL_R_STROKE (1 << INITIAL_R_BIT)
-#define A_STROKE (1 << A_BIT)
-#define O_STROKE (1 << O_BIT)
-#define STAR_STROKE (1 << STAR_BIT)
-#define E_STROKE (1 << E_BIT)
-#define U_STROKE (1 << U_BIT)
-#define FINAL_F_STROKE (1 << FINAL_F_BIT)
-#define FINAL_R_STROKE (1 << FINAL_R_BIT)
-#define FINAL_P_STROKE (1 << FINAL_P_BIT)
-#define FINAL_B_STROKE (1 << FINAL_B_BIT)
-#define FINAL_L_STROKE (1 << FINAL_L_BIT)
-#define FINAL_G_STROKE (1 << FINAL_G_BIT)
-#define FINAL_T_STROKE (1 << FINAL_T_BIT)
-#define FINAL_S_STROKE (1 << FINAL_S_BIT)
-#define FINAL_D_STROKE (1 << FINAL_D_BIT)
-#define FINAL_Z_STROKE (1 << FINAL_Z_BIT)
-#define HASH_STROKE (1 << HASH_BIT)
+// INITIAL_S_BIT and so on for each key.
+enum {
+#define STENO_BIT(name, label, bit, ...) name##_BIT = (bit),
+    STENO_LAYOUT(STENO_BIT)
+#undef STENO_BIT
+};
 
-// Getters.
-// For convenience, these functions are guaranteed to return 0 for false and 1
-// for true.
-static inline uint32_t get_initial_s_stroke(uint32_t s) {
-    return (s >> INITIAL_S_BIT) & 1;
-}
-static inline uint32_t get_initial_t_stroke(uint32_t s) {
-    return (s >> INITIAL_T_BIT) & 1;
-}
-static inline uint32_t get_initial_k_stroke(uint32_t s) {
-    return (s >> INITIAL_K_BIT) & 1;
-}
-static inline uint32_t get_initial_p_stroke(uint32_t s) {
-    return (s >> INITIAL_P_BIT) & 1;
-}
-static inline uint32_t get_initial_w_stroke(uint32_t s) {
-    return (s >> INITIAL_W_BIT) & 1;
-}
-static inline uint32_t get_initial_h_stroke(uint32_t s) {
-    return (s >> INITIAL_H_BIT) & 1;
-}
-static inline uint32_t get_initial_r_stroke(uint32_t s) {
-    return (s >> INITIAL_R_BIT) & 1;
-}
-static inline uint32_t get_a_stroke(uint32_t s) {
-    return (s >> A_BIT) & 1;
-}
-static inline uint32_t get_o_stroke(uint32_t s) {
-    return (s >> O_BIT) & 1;
-}
-static inline uint32_t get_star_stroke(uint32_t s) {
-    return (s >> STAR_BIT) & 1;
-}
-static inline uint32_t get_e_stroke(uint32_t s) {
-    return (s >> E_BIT) & 1;
-}
-static inline uint32_t get_u_stroke(uint32_t s) {
-    return (s >> U_BIT) & 1;
-}
-static inline uint32_t get_final_f_stroke(uint32_t s) {
-    return (s >> FINAL_F_BIT) & 1;
-}
-static inline uint32_t get_final_r_stroke(uint32_t s) {
-    return (s >> FINAL_R_BIT) & 1;
-}
-static inline uint32_t get_final_p_stroke(uint32_t s) {
-    return (s >> FINAL_P_BIT) & 1;
-}
-static inline uint32_t get_final_b_stroke(uint32_t s) {
-    return (s >> FINAL_B_BIT) & 1;
-}
-static inline uint32_t get_final_l_stroke(uint32_t s) {
-    return (s >> FINAL_L_BIT) & 1;
-}
-static inline uint32_t get_final_g_stroke(uint32_t s) {
-    return (s >> FINAL_G_BIT) & 1;
-}
-static inline uint32_t get_final_t_stroke(uint32_t s) {
-    return (s >> FINAL_T_BIT) & 1;
-}
-static inline uint32_t get_final_s_stroke(uint32_t s) {
-    return (s >> FINAL_S_BIT) & 1;
-}
-static inline uint32_t get_final_d_stroke(uint32_t s) {
-    return (s >> FINAL_D_BIT) & 1;
-}
-static inline uint32_t get_final_z_stroke(uint32_t s) {
-    return (s >> FINAL_Z_BIT) & 1;
-}
-static inline uint32_t get_hash_stroke(uint32_t s) {
-    return (s >> HASH_BIT) & 1;
-}
+// INITIAL_S_STROKE and so on, the stroke word with just that key.
+enum {
+#define STENO_STROKE(name, label, bit, ...) name##_STROKE = 1 << (bit),
+    STENO_LAYOUT(STENO_STROKE)
+#undef STENO_STROKE
+};
 
-// Setters
-static inline void set_initial_s_stroke(uint32_t *s) {
-    *s |= INITIAL_S_STROKE;
-}
-static inline void set_initial_t_stroke(uint32_t *s) {
-    *s |= INITIAL_T_STROKE;
-}
-static inline void set_initial_k_stroke(uint32_t *s) {
-    *s |= INITIAL_K_STROKE;
-}
-static inline void set_initial_p_stroke(uint32_t *s) {
-    *s |= INITIAL_P_STROKE;
-}
-static inline void set_initial_w_stroke(uint32_t *s) {
-    *s |= INITIAL_W_STROKE;
-}
-static inline void set_initial_h_stroke(uint32_t *s) {
-    *s |= INITIAL_H_STROKE;
-}
-static inline void set_initial_r_stroke(uint32_t *s) {
-    *s |= INITIAL_R_STROKE;
-}
-static inline void set_a_stroke(uint32_t *s) {
-    *s |= A_STROKE;
-}
-static inline void set_o_stroke(uint32_t *s) {
-    *s |= O_STROKE;
-}
-static inline void set_star_stroke(uint32_t *s) {
-    *s |= STAR_STROKE;
-}
-static inline void set_e_stroke(uint32_t *s) {
-    *s |= E_STROKE;
-}
-static inline void set_u_stroke(uint32_t *s) {
-    *s |= U_STROKE;
-}
-static inline void set_final_f_stroke(uint32_t *s) {
-    *s |= FINAL_F_STROKE;
-}
-static inline void set_final_r_stroke(uint32_t *s) {
-    *s |= FINAL_R_STROKE;
-}
-static inline void set_final_p_stroke(uint32_t *s) {
-    *s |= FINAL_P_STROKE;
-}
-static inline void set_final_b_stroke(uint32_t *s) {
-    *s |= FINAL_B_STROKE;
-}
-static inline void set_final_l_stroke(uint32_t *s) {
-    *s |= FINAL_L_STROKE;
-}
-static inline void set_final_g_stroke(uint32_t *s) {
-    *s |= FINAL_G_STROKE;
-}
-static inline void set_final_t_stroke(uint32_t *s) {
-    *s |= FINAL_T_STROKE;
-}
-static inline void set_final_s_stroke(uint32_t *s) {
-    *s |= FINAL_S_STROKE;
-}
-static inline void set_final_d_stroke(uint32_t *s) {
-    *s |= FINAL_D_STROKE;
-}
-static inline void set_final_z_stroke(uint32_t *s) {
-    *s |= FINAL_Z_STROKE;
-}
-static inline void set_hash_stroke(uint32_t *s) {
-    *s |= HASH_STROKE;
-}
+// The number of keys, and a stroke word with all of them.
+enum {
+#define STENO_ONE(...) + 1
+    STENO_KEY_COUNT = 0 STENO_LAYOUT(STENO_ONE),
+#undef STENO_ONE
+#define STENO_MASK(name, label, bit, ...) | (1 << (bit))
+    STENO_ALL_KEYS = 0 STENO_LAYOUT(STENO_MASK),
+#undef STENO_MASK
+};
 
-// Unsetters
-static inline void clear_initial_s_stroke(uint32_t *s) {
-    *s &= ~INITIAL_S_STROKE;
-}
-static inline void clear_initial_t_stroke(uint32_t *s) {
-    *s &= ~INITIAL_T_STROKE;
-}
-static inline void clear_initial_k_stroke(uint32_t *s) {
-    *s &= ~INITIAL_K_STROKE;
-}
-static inline void clear_initial_p_stroke(uint32_t *s) {
-    *s &= ~INITIAL_P_STROKE;
-}
-static inline void clear_initial_w_stroke(uint32_t *s) {
-    *s &= ~INITIAL_W_STROKE;
-}
-static inline void clear_initial_h_stroke(uint32_t *s) {
-    *s &= ~INITIAL_H_STROKE;
-}
-static inline void clear_initial_r_stroke(uint32_t *s) {
-    *s &= ~INITIAL_R_STROKE;
-}
-static inline void clear_a_stroke(uint32_t *s) {
-    *s &= ~A_STROKE;
-}
-static inline void clear_o_stroke(uint32_t *s) {
-    *s &= ~O_STROKE;
-}
-static inline void clear_star_stroke(uint32_t *s) {
-    *s &= ~STAR_STROKE;
-}
-static inline void clear_e_stroke(uint32_t *s) {
-    *s &= ~E_STROKE;
-}
-static inline void clear_u_stroke(uint32_t *s) {
-    *s &= ~U_STROKE;
-}
-static inline void clear_final_f_stroke(uint32_t *s) {
-    *s &= ~FINAL_F_STROKE;
-}
-static inline void clear_final_r_stroke(uint32_t *s) {
-    *s &= ~FINAL_R_STROKE;
-}
-static inline void clear_final_p_stroke(uint32_t *s) {
-    *s &= ~FINAL_P_STROKE;
-}
-static inline void clear_final_b_stroke(uint32_t *s) {
-    *s &= ~FINAL_B_STROKE;
-}
-static inline void clear_final_l_stroke(uint32_t *s) {
-    *s &= ~FINAL_L_STROKE;
-}
-static inline void clear_final_g_stroke(uint32_t *s) {
-    *s &= ~FINAL_G_STROKE;
-}
-static inline void clear_final_t_stroke(uint32_t *s) {
-    *s &= ~FINAL_T_STROKE;
-}
-static inline void clear_final_s_stroke(uint32_t *s) {
-    *s &= ~FINAL_S_STROKE;
-}
-static inline void clear_final_d_stroke(uint32_t *s) {
-    *s &= ~FINAL_D_STROKE;
-}
-static inline void clear_final_z_stroke(uint32_t *s) {
-    *s &= ~FINAL_Z_STROKE;
-}
-static inline void clear_hash_stroke(uint32_t *s) {
-    *s &= ~HASH_STROKE;
+// Returns 1 if the stroke has the key with the given bit and 0 if not.
+static inline uint32_t stroke_has(uint32_t s, uint8_t bit) {
+    return (s >> bit) & 1;
 }
 
 // Convert a string representation of a stroke into the internal representation.
-// This is intended for testing and debugging.
+// Keys must be in steno order, and a dash starts the right hand side when no
+// vowel or star does. This is intended for testing and debugging.
 uint32_t string_to_stroke(const char* s);
 
 #endif // #ifndef STENOSAURUS_FIRMWARE_STROKE_H
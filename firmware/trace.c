@@ -0,0 +1,144 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file implements the trace buffer. See the header file for interface
+// documentation to this code.
+//
+// Records go into a ring that overwrites the oldest records when it is full.
+// A writer claims the next slot with an atomic increment of the head so that
+// interrupts can record into the middle of each other's records without locks.
+// The last thing a writer stores is the low half of the slot's index, called
+// the stamp, so a reader can tell a finished record from one that is still
+// being written. The reader runs from the main loop or the USB interrupt, so a
+// writer can interrupt it in the middle of copying a record, and a reader can
+// interrupt a writer. The reader checks the stamp before copying a record, and
+// afterwards checks that no writer has claimed the slot again, since a writer
+// claims the slot before it stores anything in it. A record that fails either
+// check is reported as lost rather than returned torn.
+//
+// STREAM_TRACE reads the records from the oldest that hasn't been read to the
+// newest at the time the read began, and drops them once they have been read.
+// Each record is 12 bytes, all little endian: [cycles (4 bytes)] [argument (4
+// bytes)] [id (2 bytes)] [stamp (2 bytes)]. cycles is clock_cycles() when the
+// record was made. A record whose id is zero was lost and should be skipped.
+
+#include "trace.h"
+
+#include "clock.h"
+
+#if ENABLE_TRACE
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t argument;
+    uint16_t id;
+    uint16_t stamp;
+} trace_entry;
+
+// The number of records in the ring. It must be a power of two.
+#define TRACE_ENTRIES 512
+
+static trace_entry entries[TRACE_ENTRIES];
+static uint32_t head;
+static uint32_t tail;
+
+volatile bool trace_enabled;
+
+void trace_record(trace_id id, uint32_t argument) {
+    uint32_t index = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    trace_entry *entry = &entries[index % TRACE_ENTRIES];
+    __atomic_store_n(&entry->cycles, clock_cycles(), __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->argument, argument, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->id, (uint16_t)id, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->stamp, (uint16_t)index, __ATOMIC_RELEASE);
+}
+
+bool trace_enable(bool enable) {
+    trace_enabled = enable;
+    return true;
+}
+
+// The records being read are [read_start, read_start + read_count).
+static uint32_t read_start;
+static uint32_t read_count;
+
+static uint32_t trace_read_begin(void) {
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    read_start = tail;
+    if (end - read_start > TRACE_ENTRIES) {
+        read_start = end - TRACE_ENTRIES;
+    }
+    read_count = end - read_start;
+    return read_count * sizeof(trace_entry);
+}
+
+static void trace_read(uint32_t offset, uint8_t *buffer, uint32_t length) {
+    uint32_t end = offset + length;
+    while (offset != end) {
+        uint32_t index = read_start + offset / sizeof(trace_entry);
+        trace_entry *slot = &entries[index % TRACE_ENTRIES];
+        trace_entry entry;
+        // The record is lost if it wasn't finished before the copy or if a
+        // writer claimed its slot for a newer record before the copy ended.
+        entry.stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+        entry.cycles = __atomic_load_n(&slot->cycles, __ATOMIC_RELAXED);
+        entry.argument = __atomic_load_n(&slot->argument, __ATOMIC_RELAXED);
+        entry.id = __atomic_load_n(&slot->id, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (entry.stamp != (uint16_t)index ||
+                __atomic_load_n(&head, __ATOMIC_RELAXED) - index >
+                    TRACE_ENTRIES) {
+            entry.id = 0;
+        }
+        uint32_t skip = offset % sizeof(trace_entry);
+        uint32_t size = sizeof(trace_entry) - skip;
+        if (size > end - offset) size = end - offset;
+        const uint8_t *data = (const uint8_t *)&entry + skip;
+        for (uint32_t i = 0; i < size; ++i) {
+            buffer[i] = data[i];
+        }
+        buffer += size;
+        offset += size;
+    }
+}
+
+static void trace_read_end(uint32_t length) {
+    tail = read_start + length / sizeof(trace_entry);
+}
+
+const stream trace_stream = {
+    .read_begin = trace_read_begin,
+    .read = trace_read,
+    .read_end = trace_read_end,
+};
+
+#else
+
+bool trace_enable(bool enable) {
+    (void)enable;
+    return false;
+}
+
+static uint32_t trace_read_begin(void) {
+    return 0;
+}
+
+const stream trace_stream = {
+    .read_begin = trace_read_begin,
+};
+
+#endif
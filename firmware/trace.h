@@ -0,0 +1,85 @@
+// This file is part of the stenosaurus project.
+//
+// Copyright (C) 2014 Hesky Fisher <hesky.fisher@gmail.com>
+//
+// This library is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// This library is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this library.  If not, see <http://www.gnu.org/licenses/>.
+//
+// This file defines a trace of timestamped events that the firmware records in
+// RAM for the host to collect.
+//
+// See the .c file for implementation details.
+//
+// Tracing is compiled in by building with TRACE=1, which sets ENABLE_TRACE.
+// Without it TRACE() compiles to nothing. With it tracing still starts off and
+// the host turns it on with REQUEST_TRACE, so the cost when it's off is one
+// load and branch per trace point.
+
+#ifndef STENOSAURUS_FIRMWARE_TRACE_H
+#define STENOSAURUS_FIRMWARE_TRACE_H
+
+#include "stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+
+// The events that can be traced. The host has a matching table that says how
+// to show each one so only add to the end.
+typedef enum {
+    TRACE_USB_ISR_BEGIN = 1,
+    TRACE_USB_ISR_END = 2,
+    // The argument is system_millis.
+    TRACE_SYS_TICK = 3,
+    // The argument is the block address for these four.
+    TRACE_SD_READ_BEGIN = 4,
+    TRACE_SD_READ_END = 5,
+    TRACE_SD_WRITE_BEGIN = 6,
+    TRACE_SD_WRITE_END = 7,
+    TRACE_SD_INIT_BEGIN = 8,
+    TRACE_SD_INIT_END = 9,
+    // The argument is the request being run.
+    TRACE_COMMAND_BEGIN = 10,
+    TRACE_COMMAND_END = 11,
+    TRACE_KEY_CHANGE = 12,
+    // The argument is the stroke's bits.
+    TRACE_STROKE = 13,
+} trace_id;
+
+#if ENABLE_TRACE
+
+extern volatile bool trace_enabled;
+
+// Adds a record to the trace. This may be called from any interrupt.
+void trace_record(trace_id id, uint32_t argument);
+
+#define TRACE(id, argument) \
+    do { \
+        if (trace_enabled) trace_record((id), (argument)); \
+    } while (0)
+
+#else
+
+#define TRACE(id, argument) do { } while (0)
+
+#endif
+
+// Turns recording on or off. Returns false if tracing isn't compiled in.
+bool trace_enable(bool enable);
+
+// The trace as a stream that the host drains. See the .c file for the layout.
+extern const stream trace_stream;
+
+#endif // STENOSAURUS_FIRMWARE_TRACE_H
@@ -20,10 +20,18 @@
 
 #include "usb.h"
 
+#include "clock.h"
+#include "events.h"
+#include "key_report.h"
+#include "latency.h"
+#include "stats.h"
+#include "stroke.h"
+#include "trace.h"
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usb.h>
 #include <libopencm3/usb/cdc.h>
 #include <libopencm3/usb/hid.h>
 #include <libopencm3/usb/usbd.h>
@@ -39,7 +47,8 @@ enum {
     INTERFACE_CDC_COMM = 1,
     INTERFACE_CDC_DATA = 2,
     INTERFACE_KEYBOARD_HID = 3,
-    INTERFACE_COUNT = 4,
+    INTERFACE_PLOVER_HID = 4,
+    INTERFACE_COUNT = 5,
 };
 
 enum {
@@ -47,8 +56,11 @@ enum {
     ENDPOINT_RAW_HID_OUT = 0x01,
     ENDPOINT_CDC_COMM_IN = 0x83,
     ENDPOINT_CDC_DATA_IN = 0x82,
-    ENDPOINT_CDC_DATA_OUT = 0x02,
+    // The data endpoints have different numbers because the peripheral has
+    // one register per number and a double buffered endpoint uses all of it.
+    ENDPOINT_CDC_DATA_OUT = 0x05,
     ENDPOINT_KEYBOARD_HID_IN = 0x84,
+    ENDPOINT_PLOVER_HID_IN = 0x86,
 };
 
 enum {
@@ -85,8 +97,9 @@ static const struct usb_device_descriptor device_descriptor = {
     .bDeviceClass = 0xEF, // Miscellaneous Device.
     .bDeviceSubClass = 2, // Common Class
     .bDeviceProtocol = 1, // Interface Association
-    // Packet size for endpoint zero in bytes.
-    .bMaxPacketSize0 = 64,
+    // Packet size for endpoint zero in bytes. Control transfers are rare so
+    // this is kept small to leave packet memory for the CDC double buffer.
+    .bMaxPacketSize0 = 32,
     // The id of the vendor (VID) who makes this device. This must be a VID
     // assigned by the USB-IF. The VID/PID combo must be unique to a product.
     // For now, we will use a VID reserved for prototypes and an arbitrary PID.
@@ -307,7 +320,7 @@ static const struct usb_endpoint_descriptor cdc_data_endpoints[] = {
         // Bit 7 indicates direction: 0 for OUT (to device) 1 for IN (to host).
         // Bits 6-4 must be set to 0.
         // Bits 3-0 indicate the endpoint number (zero is not allowed).
-        // Here we define the OUT side of endpoint 2.
+        // Here we define the OUT side of endpoint 5.
         .bEndpointAddress = ENDPOINT_CDC_DATA_OUT,
         // Bit 7-2 are only used in Isochronous mode, otherwise they should be
         // 0.
@@ -517,9 +530,10 @@ static const struct usb_endpoint_descriptor keyboard_hid_interface_endpoint = {
     .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
     // Maximum packet size.
     .wMaxPacketSize = 32,
-    // The frequency, in number of frames, that we're going to be sending
-    // data. Here we're saying we're going to send data every millisecond.
-    .bInterval = 10,
+    // The frequency, in number of frames, that the host polls for reports.
+    // Each report carries at most one new key press, so this caps typing
+    // speed. See KEYBOARD_INTERVAL_MS in usb.h.
+    .bInterval = KEYBOARD_INTERVAL_MS,
 };
 
 // NKRO Keyboard. Uses a 32 byte report.
@@ -621,6 +635,109 @@ const struct usb_interface_descriptor keyboard_hid_interface = {
     .extralen = sizeof(keyboard_hid_function),
 };
 
+// The Plover HID interface sends each stroke as a bitmap of the keys in it, in
+// the format that Plover's HID machine reads (see
+// https://github.com/dnaq/plover-machine-hid). Plover finds the interface by
+// its usage page and usage, which spell "S" and "LV", and reads it through
+// hidraw, so no driver is involved. Compared to TX Bolt over the serial port
+// there's no framing to get wrong, every stroke is one report of the same size
+// and the host polls for it every millisecond.
+
+// The endpoint for the Plover HID interface.
+static const struct usb_endpoint_descriptor plover_hid_interface_endpoint = {
+    // The size of the endpoint descriptor in bytes: 7.
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    // A value of 5 indicates that this describes an endpoint.
+    .bDescriptorType = USB_DT_ENDPOINT,
+    // Bit 7 indicates direction: 0 for OUT (to device) 1 for IN (to host).
+    // Bits 6-4 must be set to 0.
+    // Bits 3-0 indicate the endpoint number (zero is not allowed).
+    // Here we define the IN side of endpoint 6.
+    .bEndpointAddress = ENDPOINT_PLOVER_HID_IN,
+    // Here we're using interrupt.
+    .bmAttributes = USB_ENDPOINT_ATTR_INTERRUPT,
+    // Maximum packet size. The report is 9 bytes.
+    .wMaxPacketSize = 16,
+    // The host polls every frame so a stroke waits at most a millisecond.
+    .bInterval = 1,
+};
+
+// The report ID that Plover expects, 'P'.
+#define PLOVER_HID_REPORT_ID 0x50
+
+// One report of 64 one bit keys, in the order of Plover's key chart: S1- S2-
+// T- K- P- W- H- R- A- O- *1 *2 *3 *4 -E -U -F -R -P -B -L -G -T -S -D -Z,
+// then #1 to #C and X1 to X26. Key n is bit 7 - n % 8 of byte n / 8.
+static const uint8_t plover_hid_report_descriptor[] = {
+    0x06, 0x50, 0xFF, // Usage Page (0xFF50),
+    0x0A, 0x56, 0x4C, // Usage (0x4C56),
+    0xA1, 0x02,       // Collection (Logical),
+    0x85, 0x50,       //   Report ID (80),
+    0x25, 0x01,       //   Logical Maximum (1),
+    0x75, 0x01,       //   Report Size (1),
+    0x95, 0x40,       //   Report Count (64),
+    0x05, 0x0A,       //   Usage Page (Ordinal),
+    0x19, 0x00,       //   Usage Minimum (0),
+    0x29, 0x3F,       //   Usage Maximum (63),
+    0x81, 0x02,       //   Input (Data, Variable, Absolute),
+    0xC0              // End Collection
+};
+
+static const struct {
+    struct usb_hid_descriptor hid_descriptor;
+    struct {
+        uint8_t bReportDescriptorType;
+        uint16_t wDescriptorLength;
+    } __attribute__((packed)) hid_report;
+} __attribute__((packed)) plover_hid_function = {
+    .hid_descriptor = {
+        // The size of this header in bytes: 9.
+        .bLength = sizeof(plover_hid_function),
+        // The type of this descriptor. HID is indicated by the value 33.
+        .bDescriptorType = USB_DT_HID,
+        // The version of the HID spec used in binary coded  decimal. We are
+        // using version 1.11.
+        .bcdHID = 0x0111,
+        // A value of zero means not localized.
+        .bCountryCode = 0,
+        // The number of descriptors that follow.
+        .bNumDescriptors = 1,
+    },
+    // The report descriptor.
+    .hid_report = {
+        // The type of descriptor. A value of 34 indicates a report.
+        .bReportDescriptorType = USB_DT_REPORT,
+        // The size of the descriptor defined above.
+        .wDescriptorLength = sizeof(plover_hid_report_descriptor),
+    },
+};
+
+const struct usb_interface_descriptor plover_hid_interface = {
+    // The size of an interface descriptor: 9
+    .bLength = USB_DT_INTERFACE_SIZE,
+    // A value of 4 specifies that this describes and interface.
+    .bDescriptorType = USB_DT_INTERFACE,
+    // The number for this interface. Starts counting from 0.
+    .bInterfaceNumber = INTERFACE_PLOVER_HID,
+    // The number for this alternate setting for this interface.
+    .bAlternateSetting = 0,
+    // The number of endpoints in this interface.
+    .bNumEndpoints = 1,
+    // The interface class for this interface is HID, defined by 3.
+    .bInterfaceClass = USB_CLASS_HID,
+    .bInterfaceSubClass = 0, // Not a boot mode mouse or keyboard.
+    .bInterfaceProtocol = 0, // Since subclass is zero then this must be too.
+    // A string representing this interface. Zero means not provided.
+    .iInterface = 0,
+
+    // A pointer to the beginning of the array of endpoints.
+    .endpoint = &plover_hid_interface_endpoint,
+
+    // The HID descriptor goes in the extra data.
+    .extra = &plover_hid_function,
+    .extralen = sizeof(plover_hid_function),
+};
+
 const struct usb_interface interfaces[] = {
     {
         .num_altsetting = 1,
@@ -639,6 +756,10 @@ const struct usb_interface interfaces[] = {
         .num_altsetting = 1,
         .altsetting = &keyboard_hid_interface,
     },
+    {
+        .num_altsetting = 1,
+        .altsetting = &plover_hid_interface,
+    },
 };
 
 static const struct usb_config_descriptor config_descriptor = {
@@ -741,14 +862,6 @@ static int cdcacm_control_request_handler(
     return USBD_REQ_NOTSUPP;
 }
 
-static struct {
-    uint8_t modifiers;
-    uint8_t reserved;
-    uint8_t keys[6];
-} boot_key_report;
-
-uint8_t nkro_key_report[32];
-
 static bool key_state_chaged;
 
 static uint8_t keyboard_idle = 0;
@@ -791,8 +904,13 @@ static int keyboard_hid_control_request_handler(
         } else if ((req->bmRequestType & USB_REQ_TYPE_TYPE) == 
                    USB_REQ_TYPE_CLASS) {
             if (req->bRequest == HID_GET_REPORT) {
-                *buf = (uint8_t*)&boot_key_report;
-                *len = sizeof(boot_key_report);
+                if (keyboard_protocol) {
+                    *buf = nkro_key_report;
+                    *len = sizeof(nkro_key_report);
+                } else {
+                    *buf = (uint8_t*)&boot_key_report;
+                    *len = sizeof(boot_key_report);
+                }
                 return USBD_REQ_HANDLED;
             } else if (req->bRequest == HID_GET_IDLE) {
                 *buf = &keyboard_idle;
@@ -828,6 +946,48 @@ static int keyboard_hid_control_request_handler(
     return USBD_REQ_NOTSUPP;
 }
 
+// The report in the Plover HID IN endpoint, or the last one sent, which is
+// also the answer to GET_REPORT.
+static uint8_t plover_hid_report[9] = {PLOVER_HID_REPORT_ID};
+
+static int plover_hid_control_request_handler(
+    usbd_device *dev,
+    struct usb_setup_data *req,
+    uint8_t **buf,
+    uint16_t *len,
+    void (**complete)(usbd_device *, struct usb_setup_data *)) {
+    (void)dev;
+    (void)complete;
+
+    if ((req->bmRequestType & USB_REQ_TYPE_DIRECTION) != USB_REQ_TYPE_IN) {
+        // SET_IDLE is the only one that hosts send, and there's nothing to do
+        // since reports are only sent for strokes anyway.
+        if ((req->bmRequestType & USB_REQ_TYPE_TYPE) == USB_REQ_TYPE_CLASS &&
+            req->bRequest == HID_SET_IDLE) {
+            return USBD_REQ_HANDLED;
+        }
+        return USBD_REQ_NOTSUPP;
+    }
+    if ((req->bmRequestType & USB_REQ_TYPE_TYPE) == USB_REQ_TYPE_STANDARD &&
+        req->bRequest == USB_REQ_GET_DESCRIPTOR) {
+        if (req->wValue == 0x2200) {
+            *buf = (uint8_t *)plover_hid_report_descriptor;
+            *len = sizeof(plover_hid_report_descriptor);
+            return USBD_REQ_HANDLED;
+        } else if (req->wValue == 0x2100) {
+            *buf = (uint8_t *)&plover_hid_function;
+            *len = sizeof(plover_hid_function);
+            return USBD_REQ_HANDLED;
+        }
+    } else if ((req->bmRequestType & USB_REQ_TYPE_TYPE) == USB_REQ_TYPE_CLASS &&
+               req->bRequest == HID_GET_REPORT) {
+        *buf = plover_hid_report;
+        *len = sizeof(plover_hid_report);
+        return USBD_REQ_HANDLED;
+    }
+    return USBD_REQ_NOTSUPP;
+}
+
 // This function is called when the target is an interface.
 static int interface_control_request_handler(
     usbd_device *dev,
@@ -849,28 +1009,489 @@ static int interface_control_request_handler(
             dev, req, buf, len, complete);
     }
 
+    if (req->wIndex == INTERFACE_PLOVER_HID) {
+        return plover_hid_control_request_handler(
+            dev, req, buf, len, complete);
+    }
+
     // This handler didn't handle this command, try the next one.
     return USBD_REQ_NEXT_CALLBACK;
 }
 
-static bool (*packet_handler)(uint8_t*);
+static raw_hid_result (*packet_handler)(uint8_t*);
+static bool (*packet_source)(uint8_t*);
 static uint8_t hid_buffer[64];
+static uint8_t hid_in_buffer[64];
+
+// Set by set_config_handler once the endpoints exist.
+static volatile bool configured;
+// Set while a packet is sitting in the raw HID IN endpoint waiting for the
+// host to read it.
+static volatile bool raw_hid_in_busy;
+// Set when the response in hid_buffer could not be sent because the IN
+// endpoint was busy. While this is set the OUT endpoint NAKs so that the host
+// can't overwrite the response with its next request.
+static volatile bool raw_hid_response_pending;
+// Set along with raw_hid_response_pending when the pending response is the
+// acknowledgement of a reset, which happens once the response has been sent.
+static volatile bool raw_hid_reset_pending;
+
+// Counts a packet as sent or dropped from what usbd_ep_write_packet returned,
+// which is zero if the endpoint was still busy.
+static uint16_t count_write(uint16_t written) {
+    stats_increment(written ? STAT_USB_REPORTS_SENT : STAT_USB_REPORTS_DROPPED);
+    return written;
+}
+
+// Resets the device once the acknowledgement that was just put in the raw HID
+// IN endpoint has had time to go out.
+static void reset_after_reply(void) {
+    // Wait for the ack to be sent.
+    for (volatile int i = 0; i < 800000; ++i);
+    scb_reset_system();
+}
+
+// Sends whatever is next for the raw HID IN endpoint, if anything. The caller
+// must make sure that the endpoint is free and that the USB interrupt can't
+// run.
+static void raw_hid_send_next(usbd_device *dev) {
+    if (raw_hid_response_pending) {
+        count_write(usbd_ep_write_packet(
+            dev, ENDPOINT_RAW_HID_IN, hid_buffer, sizeof(hid_buffer)));
+        raw_hid_response_pending = false;
+        raw_hid_in_busy = true;
+        usbd_ep_nak_set(dev, ENDPOINT_RAW_HID_OUT, 0);
+        if (raw_hid_reset_pending) {
+            reset_after_reply();
+        }
+    } else if (packet_source(hid_in_buffer)) {
+        count_write(usbd_ep_write_packet(
+            dev, ENDPOINT_RAW_HID_IN, hid_in_buffer, sizeof(hid_in_buffer)));
+        raw_hid_in_busy = true;
+    }
+}
 
 static void hid_rx_callback(usbd_device *dev, uint8_t ep) {
+    // Hold off the next request until this one has been answered.
+    usbd_ep_nak_set(dev, ep, 1);
     uint16_t bytes_read = usbd_ep_read_packet(
                               dev, ep, hid_buffer, sizeof(hid_buffer));
     (void)bytes_read;
     // This function reads the packet and replaces it with the response buffer.
-    bool reboot = packet_handler(hid_buffer);
+    raw_hid_result result = packet_handler(hid_buffer);
+    if (result == RAW_HID_NO_REPLY) {
+        usbd_ep_nak_set(dev, ep, 0);
+        return;
+    }
+    if (raw_hid_in_busy) {
+        // The response goes out as soon as the IN endpoint is free, and a
+        // reset waits for it.
+        raw_hid_response_pending = true;
+        raw_hid_reset_pending = result == RAW_HID_REPLY_AND_RESET;
+        return;
+    }
     // If we don't send the whole buffer then hidapi doesn't read the report.
-    usbd_ep_write_packet(dev, 0x81, hid_buffer, sizeof(hid_buffer));
-    if (reboot) {
-        // Wait for the ack to be sent.
-        for (volatile int i = 0; i < 800000; ++i);
-        scb_reset_system();
+    count_write(usbd_ep_write_packet(dev, ENDPOINT_RAW_HID_IN, hid_buffer,
+                                     sizeof(hid_buffer)));
+    raw_hid_in_busy = true;
+    usbd_ep_nak_set(dev, ep, 0);
+    if (result == RAW_HID_REPLY_AND_RESET) {
+        reset_after_reply();
+    }
+}
+
+// Called when the host has read the packet in the raw HID IN endpoint.
+static void hid_tx_callback(usbd_device *dev, uint8_t ep) {
+    (void)ep;
+    raw_hid_in_busy = false;
+    raw_hid_send_next(dev);
+}
+
+// The CDC data IN endpoint is fed from a ring so that callers never wait on the
+// host and small writes, like 4 byte TX Bolt strokes, share packets. A packet
+// goes out when the endpoint is free and either a full packet is waiting or
+// the oldest waiting byte has been held for serial_flush_ms. With a delay of
+// zero this is Nagle's algorithm: a lone write goes straight out and writes
+// made while a packet is in flight are gathered into the next one.
+#define SERIAL_TX_SIZE 512
+static uint8_t serial_tx_ring[SERIAL_TX_SIZE];
+static volatile uint32_t serial_tx_head;
+static volatile uint32_t serial_tx_tail;
+// Set while the CDC data IN endpoint has a packet that the host hasn't read.
+static volatile bool serial_tx_busy;
+// When the oldest byte in the ring must be sent by.
+static volatile uint32_t serial_tx_deadline;
+static uint32_t serial_flush_ms = 0;
+// Where in the ring each millisecond's writes start and when they must be sent
+// by, oldest first, so that the deadline of the oldest byte is still known
+// after a packet has taken some of the bytes. If this fills up then later
+// writes share the last deadline, which only sends them early.
+#define SERIAL_TX_MARKS 8
+static struct {
+    uint32_t position;
+    uint32_t deadline;
+} serial_tx_marks[SERIAL_TX_MARKS];
+static uint8_t serial_tx_mark_head;
+static uint8_t serial_tx_mark_tail;
+
+// Returns the size of the next packet, which is zero if there isn't a full
+// packet and a partial one isn't due yet, unless force is set.
+static uint16_t serial_due(bool force) {
+    uint32_t waiting = serial_tx_head - serial_tx_tail;
+    if (waiting >= 64) return 64;
+    if (waiting == 0) return 0;
+    if (!force && (int32_t)(system_millis - serial_tx_deadline) < 0) return 0;
+    return waiting;
+}
+
+// Drops length bytes from the front of the ring once they have been copied to
+// the endpoint.
+static void serial_consume(uint16_t length) {
+    serial_tx_tail += length;
+    stats_add(STAT_CDC_BYTES, length);
+    // Whatever is left keeps the deadline it was written with, so it doesn't
+    // wait any longer for having been behind this packet.
+    while ((uint8_t)(serial_tx_mark_head - serial_tx_mark_tail) > 1 &&
+           (int32_t)(serial_tx_tail - serial_tx_marks[
+               (serial_tx_mark_tail + 1) % SERIAL_TX_MARKS].position) >= 0) {
+        ++serial_tx_mark_tail;
+    }
+    serial_tx_deadline =
+        serial_tx_marks[serial_tx_mark_tail % SERIAL_TX_MARKS].deadline;
+}
+
+#if ENABLE_CDC_DOUBLE_BUFFER
+// The CDC data IN endpoint is double buffered: the peripheral sends one half
+// of its packet memory while the next packet is copied into the other half,
+// so when the host takes a packet the next one only needs a register write to
+// go. usbd_ep_setup() only knows about single buffers so the endpoint
+// register and buffer table are set up here. See "Double-buffered endpoints"
+// in the STM32F10x reference manual (RM0008).
+//
+// The peripheral sends from the half selected by DTOG_TX and the firmware
+// fills the half selected by SW_BUF, which is the DTOG_RX bit. Toggling
+// SW_BUF hands the filled half over. When the two bits are equal the
+// peripheral NAKs, so a half may only be handed over while the peripheral
+// isn't holding one, which is what serial_tx_busy tracks.
+//
+// Packet memory is 512 bytes. The buffer table and endpoints take 440 of it
+// with a 32 byte control endpoint, so the second half goes at the end.
+static const uint16_t CDC_DATA_IN_SECOND_BUFFER = 512 - 64;
+static const uint8_t CDC_DATA_IN_NUMBER = ENDPOINT_CDC_DATA_IN & 0x7F;
+
+// Set when a packet has been copied to the firmware's half.
+static volatile bool serial_tx_staged;
+// The half that the firmware fills next, which mirrors SW_BUF.
+static uint8_t serial_tx_half;
+
+// Writes the endpoint register without disturbing it, apart from setting the
+// bits in set and toggling the toggle-only bits in toggle. The CTR bits are
+// cleared by writing zero so ones are written to leave them alone.
+static void write_cdc_in_register(uint16_t set, uint16_t toggle) {
+    uint16_t reg = *USB_EP_REG(CDC_DATA_IN_NUMBER);
+    *USB_EP_REG(CDC_DATA_IN_NUMBER) =
+        (reg & (USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR)) | USB_EP_RX_CTR |
+        USB_EP_TX_CTR | set | toggle;
+}
+
+static void serial_double_buffer_setup(void) {
+    uint16_t reg = *USB_EP_REG(CDC_DATA_IN_NUMBER);
+    // Set EP_KIND and clear DTOG_TX and SW_BUF.
+    write_cdc_in_register(USB_EP_KIND,
+                          reg & (USB_EP_TX_DTOG | USB_EP_RX_DTOG));
+    *USB_EP_RX_ADDR(CDC_DATA_IN_NUMBER) = CDC_DATA_IN_SECOND_BUFFER;
+    *USB_EP_RX_COUNT(CDC_DATA_IN_NUMBER) = 0;
+    // The endpoint stays valid from now on and the halves do the flow control.
+    reg = *USB_EP_REG(CDC_DATA_IN_NUMBER);
+    write_cdc_in_register(0, (reg ^ USB_EP_TX_STAT_VALID) & USB_EP_TX_STAT);
+    serial_tx_staged = false;
+    serial_tx_half = 0;
+}
+
+// Copies the next length bytes from the ring into the firmware's half.
+static void serial_stage(uint16_t length) {
+    uint16_t address = serial_tx_half ? CDC_DATA_IN_SECOND_BUFFER
+                                      : *USB_EP_TX_ADDR(CDC_DATA_IN_NUMBER);
+    // Packet memory is 16 bits wide and each half word takes 32 bits of the
+    // address space.
+    volatile uint32_t *pm = (volatile uint32_t *)(USB_PMA_BASE + address * 2);
+    for (uint16_t i = 0; i < length; i += 2) {
+        uint16_t low = serial_tx_ring[(serial_tx_tail + i) % SERIAL_TX_SIZE];
+        uint16_t high = i + 1 < length ?
+            serial_tx_ring[(serial_tx_tail + i + 1) % SERIAL_TX_SIZE] : 0;
+        *pm++ = low | (high << 8);
+    }
+    if (serial_tx_half) {
+        *USB_EP_RX_COUNT(CDC_DATA_IN_NUMBER) = length;
+    } else {
+        *USB_EP_TX_COUNT(CDC_DATA_IN_NUMBER) = length;
+    }
+    serial_consume(length);
+    serial_tx_staged = true;
+}
+
+// Sends the next packet from the ring if it is due, or unconditionally if
+// force is set, and stages the packet after it if it is full. The caller must
+// make sure that the USB interrupt can't run.
+static void serial_send_next(usbd_device *dev, bool force) {
+    (void)dev;
+    if (!serial_tx_busy) {
+        if (!serial_tx_staged) {
+            uint16_t length = serial_due(force);
+            if (length == 0) return;
+            serial_stage(length);
+        }
+        write_cdc_in_register(0, USB_EP_RX_DTOG);
+        serial_tx_half ^= 1;
+        serial_tx_staged = false;
+        serial_tx_busy = true;
+        stats_increment(STAT_USB_REPORTS_SENT);
+    }
+    // Partial packets wait for the endpoint since more may be written first.
+    if (!serial_tx_staged && serial_tx_head - serial_tx_tail >= 64) {
+        serial_stage(64);
+    }
+}
+#else
+// Sends the next packet from the ring if it is due, or unconditionally if
+// force is set. The caller must make sure that the endpoint is free and that
+// the USB interrupt can't run.
+static void serial_send_next(usbd_device *dev, bool force) {
+    if (serial_tx_busy) return;
+    uint16_t length = serial_due(force);
+    if (length == 0) return;
+    uint8_t packet[64];
+    for (uint16_t i = 0; i < length; ++i) {
+        packet[i] = serial_tx_ring[(serial_tx_tail + i) % SERIAL_TX_SIZE];
+    }
+    uint16_t written = count_write(
+        usbd_ep_write_packet(dev, ENDPOINT_CDC_DATA_IN, packet, length));
+    if (written) {
+        serial_consume(written);
+        serial_tx_busy = true;
+    }
+}
+#endif
+
+// Called when the host has read the packet in the CDC data IN endpoint. Bytes
+// that were written while it was in flight have waited long enough, so they
+// go now.
+static void cdc_tx_callback(usbd_device *dev, uint8_t ep) {
+    (void)ep;
+    serial_tx_busy = false;
+    serial_send_next(dev, serial_flush_ms == 0);
+}
+
+// The last packet from the CDC data OUT endpoint. The endpoint NAKs until it
+// has all been taken by usb_receive_serial_data(), which keeps the host from
+// sending faster than the main loop can keep up.
+static uint8_t serial_rx_packet[64];
+static volatile uint16_t serial_rx_length;
+static uint16_t serial_rx_taken;
+
+static void cdc_rx_callback(usbd_device *dev, uint8_t ep) {
+    usbd_ep_nak_set(dev, ep, 1);
+    serial_rx_taken = 0;
+    serial_rx_length = usbd_ep_read_packet(dev, ep, serial_rx_packet,
+                                           sizeof(serial_rx_packet));
+    if (serial_rx_length == 0) {
+        usbd_ep_nak_set(dev, ep, 0);
+    }
+}
+
+// Reports wait here for the keyboard IN endpoint so that every change of key
+// state reaches the host in order, even when they come faster than the host
+// polls. The report in the endpoint has already left the queue.
+#define KEYBOARD_QUEUE_SIZE 16
+static struct {
+    uint8_t length;
+    uint8_t data[32];
+} keyboard_queue[KEYBOARD_QUEUE_SIZE];
+static volatile uint8_t keyboard_queue_head;
+static volatile uint8_t keyboard_queue_tail;
+// Set while a report is sitting in the keyboard IN endpoint.
+static volatile bool keyboard_in_busy;
+
+#if ENABLE_SOF_SYNC
+// The host polls an interrupt endpoint on a fixed schedule of frames, and
+// often not the one asked for in bInterval. Linux, for one, rounds 10 down to
+// 8. The schedule is learned from the frames that reports are read in, and
+// once it is known reports are only put in the endpoint at the start of the
+// frame before the one that the host is going to read it in. The host sends
+// its IN token for a periodic endpoint right after the SOF, which is often
+// before the SOF interrupt has put the report in, so a report put in at the
+// start of the poll frame itself would mostly miss it and wait a whole period.
+// Until the schedule is known reports go to the endpoint as soon as they can,
+// as they do without ENABLE_SOF_SYNC.
+//
+// The schedule is learned from back to back reads, where a report was waiting
+// in the endpoint by the frame after the previous read, so the gap between
+// them is one poll period. The same gap three times in a row is taken as the
+// period. If a report is put in the endpoint for a poll and the host reads it
+// in any but the next frame then the schedule is forgotten and learned again.
+
+// The frame counter in the peripheral is only 11 bits so it is extended here.
+// Call with the USB interrupt disabled or from it.
+static uint32_t frame_count;
+static uint16_t frame_fnr;
+static uint32_t current_frame(void) {
+    uint16_t fnr = *USB_FNR_REG & USB_FNR_FN;
+    frame_count += (uint16_t)(fnr - frame_fnr) & USB_FNR_FN;
+    frame_fnr = fnr;
+    return frame_count;
+}
+
+// The host's poll period in frames or 0 while it isn't known.
+static volatile uint32_t poll_period;
+static uint32_t poll_candidate;
+static uint8_t poll_agreement;
+static bool poll_seen;
+// The frame of the last read and the frame that the report in the endpoint was
+// put there.
+static uint32_t poll_frame;
+static uint32_t armed_frame;
+
+// Returns how many frames have passed since the last frame that the host was
+// due to poll in. This is 0 in a frame that it is due to poll in.
+static uint32_t frames_past_poll(uint32_t frame) {
+    return (frame - poll_frame) % poll_period;
+}
+
+// Returns true if the host is due to poll in the frame after this one, which
+// is when a report is put in the keyboard IN endpoint.
+static bool poll_is_next(uint32_t frame) {
+    return frames_past_poll(frame) + 1 == poll_period;
+}
+
+// Returns true if a report may be put in the keyboard IN endpoint right now.
+static bool keyboard_may_send(void) {
+    return poll_period == 0 || poll_is_next(current_frame());
+}
+
+static void set_poll_period(uint32_t period) {
+    poll_period = period;
+    stats_set(STAT_USB_POLL_PERIOD, period);
+}
+
+// Learns the schedule from a read by the host in frame.
+static void observe_poll(uint32_t frame) {
+    if (poll_period != 0 && frame != armed_frame + 1) {
+        set_poll_period(0);
+        poll_agreement = 0;
+    } else if (poll_period == 0 && poll_seen &&
+               (int32_t)(armed_frame - poll_frame) <= 1) {
+        uint32_t gap = frame - poll_frame;
+        if (gap == poll_candidate) {
+            if (++poll_agreement >= 3) set_poll_period(gap);
+        } else {
+            poll_candidate = gap;
+            poll_agreement = 1;
+        }
+    }
+    poll_frame = frame;
+    poll_seen = true;
+}
+#else
+static bool keyboard_may_send(void) {
+    return true;
+}
+#endif
+
+// Hands the next queued report to the keyboard IN endpoint if there is one.
+// The caller must make sure that the endpoint is free and that the USB
+// interrupt can't run.
+static void keyboard_send_next(usbd_device *dev) {
+    if (keyboard_queue_head == keyboard_queue_tail) return;
+    uint8_t i = keyboard_queue_tail % KEYBOARD_QUEUE_SIZE;
+    if (count_write(usbd_ep_write_packet(dev, ENDPOINT_KEYBOARD_HID_IN,
+                                         keyboard_queue[i].data,
+                                         keyboard_queue[i].length))) {
+        latency_mark(LATENCY_QUEUED);
+        ++keyboard_queue_tail;
+        keyboard_in_busy = true;
+#if ENABLE_SOF_SYNC
+        armed_frame = current_frame();
+#endif
     }
 }
 
+// Called when the host has read the report in the keyboard IN endpoint.
+static void keyboard_tx_callback(usbd_device *dev, uint8_t ep) {
+    (void)ep;
+    latency_mark(LATENCY_SENT);
+    keyboard_in_busy = false;
+#if ENABLE_SOF_SYNC
+    observe_poll(current_frame());
+#endif
+    if (keyboard_may_send()) {
+        keyboard_send_next(dev);
+    }
+}
+
+// Strokes wait here for the Plover HID IN endpoint. Each one is sent as a
+// report with its keys followed by one with no keys, since Plover takes the
+// stroke when every key is up, so it takes two reports and at least two
+// frames. An entry of zero is the report with no keys.
+//
+// Unless something on the host has the interface open it doesn't poll the
+// endpoint, so the report in it and the queue behind it go stale. Reports
+// with keys that have waited longer than PLOVER_HID_MAX_AGE_MS are skipped
+// when the endpoint is next free, which leaves at most the one stroke in the
+// endpoint to be read late, and once the queue is full strokes are dropped.
+#define PLOVER_HID_QUEUE_SIZE 16
+#define PLOVER_HID_MAX_AGE_MS 100
+static struct {
+    uint32_t stroke;
+    uint32_t millis;
+} plover_hid_queue[PLOVER_HID_QUEUE_SIZE];
+static volatile uint8_t plover_hid_queue_head;
+static volatile uint8_t plover_hid_queue_tail;
+// Set while a report is sitting in the Plover HID IN endpoint.
+static volatile bool plover_hid_in_busy;
+
+// Fills in the Plover HID report for a stroke.
+static void make_plover_hid_report(uint32_t stroke) {
+    for (int i = 1; i < 9; ++i) {
+        plover_hid_report[i] = 0;
+    }
+#define PLOVER_HID_KEY(name, label, bit, txbolt_byte, txbolt_bit, \
+                       gemini_byte, gemini_bit, plover_key, ...) \
+    plover_hid_report[1 + (plover_key) / 8] |= \
+        stroke_has(stroke, bit) << (7 - (plover_key) % 8);
+    STENO_LAYOUT(PLOVER_HID_KEY)
+#undef PLOVER_HID_KEY
+}
+
+// Hands the next queued report to the Plover HID IN endpoint if there is one.
+// The caller must make sure that the endpoint is free and that the USB
+// interrupt can't run.
+static void plover_hid_send_next(usbd_device *dev) {
+    while (plover_hid_queue_head != plover_hid_queue_tail) {
+        uint8_t i = plover_hid_queue_tail % PLOVER_HID_QUEUE_SIZE;
+        uint32_t stroke = plover_hid_queue[i].stroke;
+        if (stroke != 0 && system_millis - plover_hid_queue[i].millis >
+                               PLOVER_HID_MAX_AGE_MS) {
+            ++plover_hid_queue_tail;
+            continue;
+        }
+        make_plover_hid_report(stroke);
+        if (count_write(usbd_ep_write_packet(dev, ENDPOINT_PLOVER_HID_IN,
+                                             plover_hid_report,
+                                             sizeof(plover_hid_report)))) {
+            ++plover_hid_queue_tail;
+            plover_hid_in_busy = true;
+        }
+        return;
+    }
+}
+
+// Called when the host has read the report in the Plover HID IN endpoint.
+static void plover_hid_tx_callback(usbd_device *dev, uint8_t ep) {
+    (void)ep;
+    plover_hid_in_busy = false;
+    plover_hid_send_next(dev);
+}
+
 // The device is not configured for its function until the host chooses a
 // configuration even if the device only supports one configuration like this
 // one. This function sets up the real USB interface that we want to use. It
@@ -880,12 +1501,30 @@ static void set_config_handler(usbd_device *dev, uint16_t wValue) {
     (void)dev;
     (void)wValue;
 
+    raw_hid_in_busy = false;
+    raw_hid_response_pending = false;
+    raw_hid_reset_pending = false;
+    serial_tx_busy = false;
+    serial_rx_length = 0;
+    keyboard_in_busy = false;
+    keyboard_queue_tail = keyboard_queue_head;
+    plover_hid_in_busy = false;
+    plover_hid_queue_tail = plover_hid_queue_head;
+#if ENABLE_SOF_SYNC
+    set_poll_period(0);
+    poll_agreement = 0;
+    poll_seen = false;
+#endif
+
     // The address argument uses the MSB to indicate whether data is going in to
     // the host or out to the device (0 for out, 1 for in).
     // HID endpoints:
     // Set up endpoint 1 for data going IN to the host.
-    usbd_ep_setup(
-        dev, ENDPOINT_RAW_HID_IN, USB_ENDPOINT_ATTR_INTERRUPT, 64, NULL);
+    usbd_ep_setup(dev,
+                  ENDPOINT_RAW_HID_IN,
+                  USB_ENDPOINT_ATTR_INTERRUPT,
+                  64,
+                  hid_tx_callback);
     // Set up endpoint 1 for data coming OUT from the host.
     usbd_ep_setup(dev, 
                   ENDPOINT_RAW_HID_OUT, 
@@ -894,9 +1533,14 @@ static void set_config_handler(usbd_device *dev, uint16_t wValue) {
                   hid_rx_callback);
     // CDC endpoints:
     // OUT endpoint for data.
-    usbd_ep_setup(dev, ENDPOINT_CDC_DATA_OUT, USB_ENDPOINT_ATTR_BULK, 64, NULL);
+    usbd_ep_setup(dev, ENDPOINT_CDC_DATA_OUT, USB_ENDPOINT_ATTR_BULK, 64,
+                  cdc_rx_callback);
     // IN endpoint for data.
-    usbd_ep_setup(dev, ENDPOINT_CDC_DATA_IN, USB_ENDPOINT_ATTR_BULK, 64, NULL);
+    usbd_ep_setup(dev, ENDPOINT_CDC_DATA_IN, USB_ENDPOINT_ATTR_BULK, 64,
+                  cdc_tx_callback);
+#if ENABLE_CDC_DOUBLE_BUFFER
+    serial_double_buffer_setup();
+#endif
     // Useless IN endpoint for comm.
     // TODO: Can this be smaller?
     usbd_ep_setup(
@@ -906,7 +1550,10 @@ static void set_config_handler(usbd_device *dev, uint16_t wValue) {
                   ENDPOINT_KEYBOARD_HID_IN, 
                   USB_ENDPOINT_ATTR_INTERRUPT, 
                   32, 
-                  NULL);
+                  keyboard_tx_callback);
+
+    usbd_ep_setup(dev, ENDPOINT_PLOVER_HID_IN, USB_ENDPOINT_ATTR_INTERRUPT, 16,
+                  plover_hid_tx_callback);
 
     // This callback is registered for requests that are sent to an interface.
     // It does this by applying the mask to bmRequestType and making sure it is
@@ -916,6 +1563,8 @@ static void set_config_handler(usbd_device *dev, uint16_t wValue) {
         USB_REQ_TYPE_INTERFACE, // Mask
         USB_REQ_TYPE_RECIPIENT, // Value
         interface_control_request_handler); // Callback
+
+    configured = true;
 }
 
 // The buffer used for control requests. This needs to be big enough to hold any
@@ -926,12 +1575,30 @@ static uint8_t usbd_control_buffer[256];
 // Structure holding all the info related to the usb device.
 static usbd_device *usbd_dev;
 
-void usb_init(bool (*handler)(uint8_t*)) {
+#if ENABLE_SOF_SYNC
+// Called at the start of every frame. If the host is due to poll the keyboard
+// endpoint in the next frame then the next report goes in now.
+static void sof_callback(void) {
+    if (configured && !keyboard_in_busy && poll_period != 0 &&
+        poll_is_next(current_frame())) {
+        keyboard_send_next(usbd_dev);
+    }
+}
+#endif
+
+void usb_init(raw_hid_result (*handler)(uint8_t*),
+              bool (*source)(uint8_t*)) {
     packet_handler = handler;
+    packet_source = source;
     usbd_dev = usbd_init(&stm32f103_usb_driver, &device_descriptor,
                          &config_descriptor, usb_strings, sizeof(usb_strings),
                          usbd_control_buffer, sizeof(usbd_control_buffer));
     usbd_register_set_config_callback(usbd_dev, set_config_handler);
+#if ENABLE_SOF_SYNC
+    // The SOF interrupt isn't enabled by libopencm3 even with a callback.
+    usbd_register_sof_callback(usbd_dev, sof_callback);
+    *USB_CNTR_REG |= USB_CNTR_SOFM;
+#endif
     nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
     // Enable USB by raising up D+ via a 1.5K resistor. This is done on the
     // WaveShare board by removing the USB EN jumper and  connecting PC0 to the
@@ -946,83 +1613,202 @@ void usb_init(bool (*handler)(uint8_t*)) {
                   GPIO0);
 }
 
-uint32_t usb_send_serial_data(void *buf, int len) {
-    return usbd_ep_write_packet(usbd_dev, ENDPOINT_CDC_DATA_IN, buf, len);
+void usb_raw_hid_flush(void) {
+    if (!configured) return;
+    // Keep the USB interrupt from sending at the same time.
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    if (!raw_hid_in_busy) {
+        raw_hid_send_next(usbd_dev);
+    }
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
 }
 
-void usb_keyboard_keys_up() {
-    for (size_t i = 0; i < sizeof(nkro_key_report); ++i) {
-        nkro_key_report[i] = 0;
+uint32_t usb_send_serial_data(const void *buf, int len) {
+    const uint8_t *b = buf;
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    uint32_t space = SERIAL_TX_SIZE - (serial_tx_head - serial_tx_tail);
+    uint32_t accepted = (uint32_t)len < space ? (uint32_t)len : space;
+    uint32_t deadline = system_millis + serial_flush_ms;
+    if (serial_tx_head == serial_tx_tail) {
+        serial_tx_mark_tail = serial_tx_mark_head;
+        serial_tx_deadline = deadline;
     }
-    key_state_chaged = true;
+    uint8_t marks = serial_tx_mark_head - serial_tx_mark_tail;
+    if (accepted > 0 && marks < SERIAL_TX_MARKS &&
+        (marks == 0 || serial_tx_marks[(uint8_t)(serial_tx_mark_head - 1) %
+                                       SERIAL_TX_MARKS].deadline != deadline)) {
+        uint8_t i = serial_tx_mark_head++ % SERIAL_TX_MARKS;
+        serial_tx_marks[i].position = serial_tx_head;
+        serial_tx_marks[i].deadline = deadline;
+    }
+    for (uint32_t i = 0; i < accepted; ++i) {
+        serial_tx_ring[serial_tx_head++ % SERIAL_TX_SIZE] = b[i];
+    }
+    if (configured) {
+        serial_send_next(usbd_dev, false);
+    }
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    if (accepted < (uint32_t)len) {
+        stats_add(STAT_CDC_BYTES_DROPPED, len - accepted);
+        events_post(EVENT_OVERFLOW, OVERFLOW_SERIAL_TX);
+    }
+    return accepted;
 }
 
-void usb_keyboard_key_up(uint8_t usb_keycode) {
-    uint8_t bit = usb_keycode % 8;
-    uint8_t byte = (usb_keycode / 8) + 1;
+uint32_t usb_serial_space(void) {
+    return SERIAL_TX_SIZE - (serial_tx_head - serial_tx_tail);
+}
 
-    if (usb_keycode >= 240 && usb_keycode <= 247) {
-        nkro_key_report[0] &= ~(1 << bit);
+uint32_t usb_receive_serial_data(void *buf, int len) {
+    if (serial_rx_length == 0) return 0;
+    uint8_t *b = buf;
+    uint32_t count = 0;
+    while (count < (uint32_t)len && serial_rx_taken < serial_rx_length) {
+        b[count++] = serial_rx_packet[serial_rx_taken++];
     }
-    else if (byte > 0 && byte < sizeof(nkro_key_report)) {
-        nkro_key_report[byte] &= ~(1 << bit);
+    if (serial_rx_taken == serial_rx_length) {
+        serial_rx_length = 0;
+        nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+        usbd_ep_nak_set(usbd_dev, ENDPOINT_CDC_DATA_OUT, 0);
+        nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
     }
-    key_state_chaged = true;
+    return count;
+}
+
+void usb_serial_set_flush_delay(uint32_t ms) {
+    serial_flush_ms = ms;
 }
 
-void usb_keyboard_key_down(uint8_t usb_keycode) {
-    uint8_t bit = usb_keycode % 8;
-    uint8_t byte = (usb_keycode / 8) + 1;
+void usb_serial_poll(void) {
+    if (!configured) return;
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    serial_send_next(usbd_dev, false);
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+}
 
-    if (usb_keycode >= 240 && usb_keycode <= 247) {
-        nkro_key_report[0] |= (1 << bit);
+void usb_keyboard_keys_up() {
+    key_report_clear();
+    key_state_chaged = true;
+}
+
+// A key can only change while there is room to queue a report of the change.
+// Otherwise it would be folded into the change that is still waiting for room,
+// and a key that went down and up again would never be seen to go down.
+bool usb_keyboard_key_up(uint8_t usb_keycode) {
+    if (usb_keyboard_queue_space() == 0) return false;
+    if (key_report_up(usb_keycode)) {
+        key_state_chaged = true;
     }
-    else if (byte > 0 && byte < sizeof(nkro_key_report)) {
-        nkro_key_report[byte] |= (1 << bit);
+    return true;
+}
+
+bool usb_keyboard_key_down(uint8_t usb_keycode) {
+    if (usb_keyboard_queue_space() == 0) return false;
+    if (key_report_down(usb_keycode)) {
+        key_state_chaged = true;
     }
-    key_state_chaged = true;
+    return true;
 }
 
 uint32_t usb_send_keys_if_changed(void) {
     if (!key_state_chaged) return 0;
-    key_state_chaged = false;
-    return usb_send_keyboard_report();
+    uint32_t written = usb_send_keyboard_report();
+    // A refused report is tried again next time.
+    if (written) key_state_chaged = false;
+    return written;
+}
+
+// Adds a report to the keyboard queue and sends it if the endpoint is free.
+// Returns zero, and queues nothing, if the queue is full. Replacing a waiting
+// report instead would lose the step in between.
+static uint16_t write_keyboard_report(const void *report, uint16_t length) {
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    uint8_t waiting = keyboard_queue_head - keyboard_queue_tail;
+    if (waiting == KEYBOARD_QUEUE_SIZE) {
+        nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+        stats_increment(STAT_KEYBOARD_REPORTS_REFUSED);
+        return 0;
+    }
+    uint8_t i = keyboard_queue_head++ % KEYBOARD_QUEUE_SIZE;
+    stats_max(STAT_KEYBOARD_QUEUE_HIGH_WATER, waiting + 1);
+    const uint8_t *r = report;
+    for (uint16_t j = 0; j < length; ++j) {
+        keyboard_queue[i].data[j] = r[j];
+    }
+    keyboard_queue[i].length = length;
+    if (configured && !keyboard_in_busy && keyboard_may_send()) {
+        keyboard_send_next(usbd_dev);
+    }
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    return length;
 }
 
+uint32_t usb_keyboard_queue_space(void) {
+    return KEYBOARD_QUEUE_SIZE - (uint8_t)(keyboard_queue_head -
+                                           keyboard_queue_tail);
+}
+
+bool usb_keyboard_report_due(void) {
+    uint32_t space = usb_keyboard_queue_space();
+#if ENABLE_SOF_SYNC
+    // Once the schedule is known a report is only made in the frame that it
+    // goes in the endpoint, the one before the host's poll, or the frame before
+    // that, so that it takes in as many key events as possible. Anything made
+    // earlier would just sit in the queue.
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    bool due = true;
+    if (poll_period != 0) {
+        uint32_t past = frames_past_poll(current_frame());
+        due = space == KEYBOARD_QUEUE_SIZE &&
+              past + 2 >= poll_period;
+    }
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    if (!due) return false;
+#endif
+    return space > 0;
+}
+
+// Both reports are kept up to date by key_report.c so there's nothing to build.
 uint32_t usb_send_keyboard_report(void) {
     if (keyboard_protocol) {
-        return usbd_ep_write_packet(
-            usbd_dev, ENDPOINT_KEYBOARD_HID_IN, &nkro_key_report, 32);
+        return write_keyboard_report(nkro_key_report,
+                                     sizeof(nkro_key_report));
     } else {
-        // Convert to boot report.
-        int nkeys = 0;
-        boot_key_report.modifiers = nkro_key_report[0];
-        for (size_t i = 1; i < sizeof(nkro_key_report); ++i) {
-            if (nkro_key_report[i]) {
-                for (int j = 0; j < 8; ++j) {
-                    if ((nkro_key_report[i] >> (7 - j)) & 1) {
-                        if (nkeys < 6) {
-                            boot_key_report.keys[nkeys] = (i * 8) + j;
-                        } else {
-                            for (int k = 0; k < 6; ++k) {
-                                boot_key_report.keys[k] = 1; // Error rollover.
-                            }
-                            break;
-                        }
-                    }
-                }
-            }
+        return write_keyboard_report(&boot_key_report,
+                                     sizeof(boot_key_report));
+    }
+}
+
+bool usb_send_plover_stroke(uint32_t stroke) {
+    if (stroke == 0) return true;
+    nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    uint8_t waiting = plover_hid_queue_head - plover_hid_queue_tail;
+    bool queued = waiting + 2 <= PLOVER_HID_QUEUE_SIZE;
+    if (queued) {
+        uint8_t i = plover_hid_queue_head++ % PLOVER_HID_QUEUE_SIZE;
+        plover_hid_queue[i].stroke = stroke;
+        plover_hid_queue[i].millis = system_millis;
+        i = plover_hid_queue_head++ % PLOVER_HID_QUEUE_SIZE;
+        plover_hid_queue[i].stroke = 0;
+        plover_hid_queue[i].millis = system_millis;
+        if (configured && !plover_hid_in_busy) {
+            plover_hid_send_next(usbd_dev);
         }
-        return usbd_ep_write_packet(usbd_dev, 
-                                    ENDPOINT_KEYBOARD_HID_IN, 
-                                    &boot_key_report, 
-                                    sizeof(boot_key_report));
     }
+    nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+    if (!queued) {
+        stats_increment(STAT_STENO_REPORTS_DROPPED);
+        events_post(EVENT_OVERFLOW, OVERFLOW_PLOVER_HID);
+    }
+    return queued;
 }
 
 // This is the interrupt handler for low priority USB events. Implementing a
 // function with this name makes it the function used for the interrupt.
 // TODO: Handle the other USB interrupts.
 void usb_lp_can_rx0_isr(void) {
+    TRACE(TRACE_USB_ISR_BEGIN, 0);
+    stats_increment(STAT_USB_INTERRUPTS);
     usbd_poll(usbd_dev);
+    TRACE(TRACE_USB_ISR_END, 0);
 }
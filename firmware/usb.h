@@ -28,20 +28,94 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-extern uint8_t nkro_key_report[32];
+// The Makefile sets this from CDC_DOUBLE_BUFFER. Building without it gives the
+// single buffered serial endpoint for comparison.
+#ifndef ENABLE_CDC_DOUBLE_BUFFER
+#define ENABLE_CDC_DOUBLE_BUFFER 1
+#endif
 
-void usb_init(bool (*)(uint8_t*));
+// The Makefile sets this from SOF_SYNC. Building without it puts keyboard
+// reports in the endpoint as soon as they are made instead of just before the
+// host polls for them.
+#ifndef ENABLE_SOF_SYNC
+#define ENABLE_SOF_SYNC 1
+#endif
 
-uint32_t usb_send_serial_data(void *buf, int len);
+// How often the host polls the keyboard endpoint, in milliseconds. The
+// Makefile sets this from KEYBOARD_INTERVAL. At 1 the keyboard can type
+// several hundred characters a second, but some hosts wake up more often.
+#ifndef KEYBOARD_INTERVAL_MS
+#define KEYBOARD_INTERVAL_MS 10
+#endif
+
+// What to do once a packet from the host has been handled.
+typedef enum {
+    // Send the buffer back to the host as the response.
+    RAW_HID_REPLY,
+    // Send the buffer back and then reset the device.
+    RAW_HID_REPLY_AND_RESET,
+    // Don't send anything back for this packet.
+    RAW_HID_NO_REPLY,
+} raw_hid_result;
+
+// The first function is called with each packet that the host sends to the raw
+// HID interface and should replace it with the response. The second is called
+// whenever the raw HID IN endpoint is free and should fill in the next packet
+// to send to the host, if any. See protocol.h.
+void usb_init(raw_hid_result (*)(uint8_t*), bool (*)(uint8_t*));
+
+// Sends the next packet from the raw HID packet source if the IN endpoint is
+// free. Call this from the main loop after making a packet available.
+void usb_raw_hid_flush(void);
+
+// Queues len bytes for the USB serial port and returns how many fit, which is
+// less than len only if the host has stopped reading. This never waits. The
+// bytes are packed into 64 byte packets and a partial packet is held for at
+// most the flush delay in case more is written.
+uint32_t usb_send_serial_data(const void *buf, int len);
+
+// Returns how many bytes usb_send_serial_data() would take right now.
+uint32_t usb_serial_space(void);
+
+// Copies up to len bytes that the host has written to the USB serial port into
+// buf and returns how many there were. This never waits.
+uint32_t usb_receive_serial_data(void *buf, int len);
+
+// Sets how long a partial serial packet may wait for more bytes, in
+// milliseconds. The default of zero sends as soon as the endpoint is free. The
+// delay must be no more than USB_SERIAL_MAX_FLUSH_MS.
+void usb_serial_set_flush_delay(uint32_t ms);
+
+#define USB_SERIAL_MAX_FLUSH_MS 1000
+
+// Sends a serial packet whose flush delay has run out. Call this from the main
+// loop.
+void usb_serial_poll(void);
 
 void usb_keyboard_keys_up(void);
 
-void usb_keyboard_key_up(uint8_t usb_keycode);
+// Release or press a key in the keyboard report. Returns false, and leaves the
+// key alone, if the report queue is full, in which case the caller should try
+// again once a report has been sent.
+bool usb_keyboard_key_up(uint8_t usb_keycode);
 
-void usb_keyboard_key_down(uint8_t usb_keycode);
+bool usb_keyboard_key_down(uint8_t usb_keycode);
 
 uint32_t usb_send_keyboard_report(void);
 
+// Returns how many more keyboard reports can be queued.
+uint32_t usb_keyboard_queue_space(void);
+
+// Returns true if a keyboard report should be made now. This is when there is
+// room in the queue and, once the host's polling schedule is known, its next
+// poll is at most a frame away.
+bool usb_keyboard_report_due(void);
+
 uint32_t usb_send_keys_if_changed(void);
 
+// Queues a stroke, as in stroke.h, for the Plover HID interface. Returns false,
+// and drops the stroke, if the queue is full, which only happens when nothing
+// on the host is reading the interface.
+bool usb_send_plover_stroke(uint32_t stroke);
+
 #endif // STENOSAURUS_FIRMWARE_USB_H